@@ -0,0 +1,84 @@
+/*******************************
+ *       commitgraph.h         *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __COMMITGRAPH_H__
+#define __COMMITGRAPH_H__
+
+#include "neogit.h"
+
+// Commit graph (commitgraph.h) :
+// .neogit/commit-graph : "<magic:4><version:4 LE><count:4 LE><branch-count:4 LE><names-len:8 LE>" followed by
+//                        <count> records "<hash:8 LE><time:8 LE><prev:4 LE><merged:4 LE><branch:4 LE><generation:4 LE>"
+//                        and <branch-count> NUL-terminated branch names (<names-len> bytes)
+// prev/merged are indexes of the parent records (COMMIT_GRAPH_NONE if there is no parent), branch is an index of a name,
+// and the generation of a commit is 1 + the maximum generation of its parents (1 for root commits).
+// Records are appended by createCommit, and the whole file is rebuilt from the commit files if it is missing or stale.
+#define COMMIT_GRAPH_MAGIC "\x7fNGC"
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_HEADER_SIZE 24
+#define COMMIT_GRAPH_RECORD_SIZE 32
+#define COMMIT_GRAPH_NONE 0xFFFFFFFFU
+
+// The history information of a commit (commitgraph.h)
+typedef struct _commit_info_t
+{
+	uint64_t hash;		   /**< Hash of the commit. */
+	uint64_t prev;		   /**< Hash of the previous commit (0xFFFFFF if there is none). */
+	uint64_t mergedCommit; /**< Hash of the merged commit (0 if there is none). */
+	time_t time;		   /**< Commit time. */
+	constString branch;	   /**< Branch of the commit (owned by the graph; valid until the graph is closed). */
+	uint generation;	   /**< Generation number (A commit is never an ancestor of a commit with a lower generation). */
+} CommitInfo;
+
+/**
+ * @brief Get the history information of a commit from the commit graph. (commitgraph.h)
+ *
+ * The graph is mapped in memory on the first call, and each lookup is a hash table lookup.
+ * If a commit is not in the graph but its file exists (e.g. made by an older version), the graph is rebuilt.
+ *
+ * @param hash The hash of the commit.
+ * @param dest The destination for the information. (NULL is allowed)
+ *
+ * @return true if the commit is found, false otherwise.
+ */
+bool getCommitInfo(uint64_t hash, CommitInfo *dest);
+
+/**
+ * @brief Get the history information of all commits. (commitgraph.h)
+ *
+ * @param dest The destination for the dynamically allocated array (It must be freed; the branch names must not).
+ *
+ * @return The number of commits.
+ */
+uint listCommitInfos(CommitInfo **dest);
+
+/**
+ * @brief Append a new commit to the commit graph. (commitgraph.h)
+ *
+ * @param commit The new commit (Its file must be already written).
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if the graph could not be written.
+ */
+int addCommitToGraph(const Commit *commit);
+
+/**
+ * @brief Rebuild the commit graph from all commit files of the current repository. (commitgraph.h)
+ *
+ * The graph is written in a temporary file first and then renamed.
+ *
+ * @param countDest The destination for the number of commits in the graph. (NULL is allowed)
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if the graph could not be written.
+ */
+int writeCommitGraph(uint *countDest);
+
+/**
+ * @brief Unmap the commit graph (It is mapped again on the next lookup). (commitgraph.h)
+ */
+void closeCommitGraph();
+
+#endif
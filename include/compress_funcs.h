@@ -0,0 +1,128 @@
+/*******************************
+ *      compress_funcs.h       *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __COMPRESS_FUNCS_H__
+#define __COMPRESS_FUNCS_H__
+
+#include "common.h"
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Maximum size of the compressed output of a block. (compress_funcs.h)
+ *
+ * A destination buffer of this size is always enough for lzCompress (incompressible data grows a little).
+ *
+ * @param n Size of the input block in bytes.
+ */
+#define LZ_COMPRESS_BOUND(n) ((n) + ((n) / 255) + 16)
+
+// Size of the blocks of the base which are indexed for finding common regions (compress_funcs.h)
+#define DELTA_BLOCK_SIZE 16
+
+/**
+ * @brief Compress a block of data with a fast LZ77 compressor (LZ4 block format). (compress_funcs.h)
+ *
+ * The output is a sequence of (literals, match) pairs with 16-bit back references,
+ * so each block is independent of the others and can be decompressed on its own.
+ *
+ * @param src The input data.
+ * @param srcLen The length of the input data in bytes.
+ * @param dst The destination buffer.
+ * @param dstCap The capacity of the destination buffer. (LZ_COMPRESS_BOUND(srcLen) is always enough)
+ *
+ * @return The size of the compressed data, or 0 if it does not fit in the destination buffer.
+ */
+size_t lzCompress(const uchar *src, size_t srcLen, uchar *dst, size_t dstCap);
+
+/**
+ * @brief Decompress a block compressed by lzCompress. (compress_funcs.h)
+ *
+ * The input is fully validated, so a corrupted block never writes outside the destination buffer.
+ *
+ * @param src The compressed data.
+ * @param srcLen The length of the compressed data in bytes.
+ * @param dst The destination buffer.
+ * @param dstCap The capacity of the destination buffer.
+ *
+ * @return The size of the decompressed data, or -1 if the compressed data is corrupted.
+ */
+long lzDecompress(const uchar *src, size_t srcLen, uchar *dst, size_t dstCap);
+
+/**
+ * @brief Encode a file version as a binary delta against a base version. (compress_funcs.h)
+ *
+ * The delta is a sequence of instructions: "copy <len> bytes from <offset> of the base" and
+ * "insert <len> literal bytes". Regions shared with the base are found by indexing the base
+ * in DELTA_BLOCK_SIZE-byte blocks, so small edits produce small deltas.
+ *
+ * @param base The base content.
+ * @param baseLen The length of the base content.
+ * @param target The content to be encoded.
+ * @param targetLen The length of the content to be encoded.
+ * @param dst The destination buffer.
+ * @param dstCap The capacity of the destination buffer (A delta larger than this is not worth storing).
+ *
+ * @return The size of the delta, or 0 if it does not fit in the destination buffer (or on memory errors).
+ */
+size_t deltaEncode(const uchar *base, size_t baseLen, const uchar *target, size_t targetLen, uchar *dst, size_t dstCap);
+
+/**
+ * @brief Rebuild a content from its base and a delta made by deltaEncode. (compress_funcs.h)
+ *
+ * The delta is fully validated, so a corrupted delta never reads or writes outside the buffers.
+ *
+ * @param base The base content.
+ * @param baseLen The length of the base content.
+ * @param delta The delta instructions.
+ * @param deltaLen The length of the delta.
+ * @param dst The destination buffer.
+ * @param dstCap The capacity of the destination buffer.
+ *
+ * @return The size of the rebuilt content, or -1 if the delta is corrupted.
+ */
+long deltaDecode(const uchar *base, size_t baseLen, const uchar *delta, size_t deltaLen, uchar *dst, size_t dstCap);
+
+// Sizes of the chunks of content-defined chunking (compress_funcs.h)
+#define CDC_MIN_SIZE (16 * 1024)
+#define CDC_AVG_SIZE (64 * 1024)
+#define CDC_MAX_SIZE (256 * 1024)
+
+/**
+ * @brief Find the end of the first chunk of a content with content-defined chunking (FastCDC). (compress_funcs.h)
+ *
+ * A rolling (gear) hash of the last bytes decides the cut points, so an insertion or deletion only changes
+ * the chunks around it and the next chunks are cut at the same places as before. Cut points are harder to
+ * reach before CDC_AVG_SIZE and easier after it, which keeps most chunks close to the average size.
+ *
+ * @param data The content (the rest of a file).
+ * @param len The length of the content. Less than CDC_MAX_SIZE bytes must only be passed at the end of the file.
+ *
+ * @return The length of the first chunk (between CDC_MIN_SIZE and CDC_MAX_SIZE, or len if it is shorter).
+ */
+size_t cdcChunkLength(const uchar *data, size_t len);
+
+/**
+ * @brief Store a 32-bit / 64-bit number in little-endian byte order. (compress_funcs.h)
+ *
+ * @param dest The destination buffer (4 or 8 bytes).
+ * @param value The number to store.
+ */
+void putLE32(uchar *dest, uint32_t value);
+void putLE64(uchar *dest, uint64_t value);
+
+/**
+ * @brief Load a 32-bit / 64-bit number stored in little-endian byte order. (compress_funcs.h)
+ *
+ * @param src The source buffer (4 or 8 bytes).
+ *
+ * @return The loaded number.
+ */
+uint32_t getLE32(const uchar *src);
+uint64_t getLE64(const uchar *src);
+
+#endif
@@ -54,6 +54,24 @@ typedef struct _diff_t
  */
 #define getFileName(path) (strrchr(path, '/') ? strrchr(path, '/') + 1 : path)
 
+// Number of leading characters of a name which select its subdirectory in sharded directories (file_funcs.h)
+#define SHARD_PREFIX_LEN 2
+
+/**
+ * @brief Get the path of an entry in a sharded (two-level fan-out) directory. (file_funcs.h)
+ *
+ * Example:
+ * - Input: getShardedPath(buffer, "/repo/.neogit/objects", "9f86d0...")
+ *   Output: "/repo/.neogit/objects/9f/9f86d0..."
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ * @param dir The path of the sharded directory.
+ * @param name The name of the entry (at least SHARD_PREFIX_LEN characters).
+ *
+ * @return The destination string.
+ */
+#define getShardedPath(dest, dir, name) ({ char _prefix[SHARD_PREFIX_LEN + 1] = {0}; strncpy(_prefix, name, SHARD_PREFIX_LEN); strcat_s(dest, dir, "/", _prefix, "/", name); })
+
 /**
  * @brief Extract the parent directory name from a given file path. (file_funcs.h)
  *
@@ -154,6 +172,16 @@ typedef struct _diff_t
  */
 bool isFilesSame(constString path1, constString path2);
 
+/**
+ * @brief Get the difference between two opened files within specified line ranges. (file_funcs.h)
+ *
+ * Same as getDiff, but reads from already opened streams (e.g. decompressed objects).
+ * Both streams must be positioned at their beginning.
+ *
+ * @return A Diff structure containing the added and removed lines along with their line numbers.
+ */
+Diff getDiffStreams(FILE *baseFile, FILE *changedFile, int f1begin, int f1end, int f2begin, int f2end);
+
 /**
  * @brief Get the difference between two files within specified line ranges. (file_funcs.h)
  *
@@ -262,12 +290,123 @@ int removeLine(FILE *file, int lineNumber);
  */
 int insertLine(FILE *file, int lineNumber, constString newContent);
 
+/**
+ * @brief Map a whole file in memory (read only). (file_funcs.h)
+ *
+ * @param path The path of the file <<absolute or relative to the current working directory>>
+ * @param lenDest The destination for the size of the file.
+ *
+ * @return The address of the mapped content, or NULL if the file could not be mapped (or is empty).
+ *
+ * @note - The mapping must be released by unmapFile. It remains valid if the file is replaced or removed.
+ */
+const uchar *mapFile(constString path, size_t *lenDest);
+
+/**
+ * @brief Release a mapping obtained from mapFile. (file_funcs.h)
+ *
+ * @param map The address of the mapped content. (NULL is allowed)
+ * @param len The size of the mapped file.
+ */
+void unmapFile(const uchar *map, size_t len);
+
+// A reader of the lines of a file mapped in memory (file_funcs.h)
+// Lines are returned as views into the mapping, so they are valid until the tokenizer is closed.
+typedef struct _tokenizer_t
+{
+	const uchar *map; /**< Mapped content (NULL for an empty file). */
+	size_t len;		  /**< Size of the content. */
+	size_t pos;		  /**< Position of the next line. */
+	bool owned;		  /**< Whether the content is read into a buffer instead of being mapped. */
+} Tokenizer;
+
+// Files up to this size are read into a buffer by openTokenizer instead of being mapped (file_funcs.h)
+#define TOKENIZER_READ_MAX (64 * 1024)
+
+/**
+ * @brief Map a file for reading its lines. (file_funcs.h)
+ *
+ * Small files (see TOKENIZER_READ_MAX) are read into a buffer at once, which is cheaper than mapping them.
+ *
+ * @param tokenizer The tokenizer to be initialized.
+ * @param path The path of the file <<absolute or relative to the current working directory>>
+ *
+ * @return true on success (also for an empty file), false if the file could not be read.
+ */
+bool openTokenizer(Tokenizer *tokenizer, constString path);
+
+/**
+ * @brief Get the next line of a tokenizer (without its '\n' or '\r\n'). (file_funcs.h)
+ *
+ * @param tokenizer The tokenizer.
+ * @param line The destination for the view of the line.
+ *
+ * @return true if a line is read, false at the end of the file.
+ */
+bool nextLine(Tokenizer *tokenizer, StrView *line);
+
+/**
+ * @brief Unmap the file of a tokenizer. (file_funcs.h)
+ */
+void closeTokenizer(Tokenizer *tokenizer);
+
+// Size of the buffer of copyFile when the kernel can not copy the files itself (file_funcs.h)
+#define COPY_BUF_SIZE (1024 * 1024)
+
+// Environment variable which enables trace messages (e.g. copy throughput) on stderr (file_funcs.h)
+#define TRACE_ENV "NEOGIT_TRACE"
+
+/**
+ * @brief Create a directory and all of its missing parents (like mkdir -p). (file_funcs.h)
+ *
+ * @param path The path of the directory <<absolute or relative to the current working directory>>
+ *
+ * @return ERR_NOERR on success (also if it already exists), or ERR_FILE_ERROR on failure.
+ */
+int makeDirs(constString path);
+
+/**
+ * @brief Create an empty file if it does not exist (like touch, without changing an existing file). (file_funcs.h)
+ *
+ * @param path The path of the file <<absolute or relative to the current working directory>>
+ *
+ * @return ERR_NOERR on success (also if it already exists), or ERR_FILE_ERROR on failure.
+ */
+int ensureFile(constString path);
+
+/**
+ * @brief Remove a file or a directory with all of its contents (like rm -r). (file_funcs.h)
+ *
+ * Symbolic links are removed themselves; their targets are never followed.
+ *
+ * @param path The path <<absolute or relative to the current working directory>>
+ *
+ * @return ERR_NOERR on success (also if it does not exist), or ERR_FILE_ERROR if anything could not be removed.
+ */
+int removeTree(constString path);
+
+/**
+ * @brief Replace the content of a file at once. (file_funcs.h)
+ *
+ * The content is written in a temporary file next to the file, and then it is renamed over the file,
+ * so readers see either the old or the new content.
+ *
+ * @param path The path of the file <<absolute or relative to the current working directory>>
+ * @param data The new content.
+ * @param len The length of the new content.
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR on failure (the old file is not changed).
+ */
+int atomicReplace(constString path, const void *data, size_t len);
+
 /**
  * @brief Copy a file from the source path to the destination path. (file_funcs.h)
  *
  * The copyFile function copies the contents of a source file to a destination file. If the
  * destination file already exists, it is overwritten. The paths are constructed based on the
  * provided repository path.
+ * The data is copied inside the kernel (copy_file_range, then sendfile) when possible,
+ * otherwise with a large buffer. Set NEOGIT_TRACE to see the throughput of each copy.
  * Example:
  * - Input: copyFile("file.txt", "backup/file_copy.txt", "/path/to/repo")
  *   This copies the contents of "/path/to/repo/file.txt" to "/path/to/repo/backup/file_copy.txt".
@@ -0,0 +1,97 @@
+/*******************************
+ *        fsmonitor.h          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __FSMONITOR_H__
+#define __FSMONITOR_H__
+
+#include "neogit.h"
+
+// File system monitor (fsmonitor.h) :
+// "neogit fsmonitor start" runs a daemon which watches the directories of the working tree with inotify and records
+// the paths which are changed in them. Commands ask it over a unix socket (.neogit/fsmonitor.sock):
+//   "query <token>\n" ("-" for no token) -> "ok <token>\n" followed by the paths changed since the token (one per line),
+//                                           or "full <token>\n" if they are not known (another daemon, or lost events)
+//   "status\n"                           -> "ok <token> <watched directories> <changed paths>[ overflowed]\n"
+//   "stop\n"                             -> "ok\n"
+// .neogit/fsmonitor-state : "<token>\n<key>\n" followed by the changed files of the last status (one per line).
+// The key identifies HEAD, the staging area and the tracked files; the state is stale if any of them is changed.
+// Any other file was unchanged at the token, so only these files and the paths changed since then are checked.
+#define FSMONITOR_SOCKET_FILE "fsmonitor.sock"
+#define FSMONITOR_STATE_FILE "fsmonitor-state"
+#define FSMONITOR_TIMEOUT_MS 1000
+
+/**
+ * @brief Start the file system monitor daemon of the current repository. (fsmonitor.h)
+ *
+ * The directories of the working tree are watched before the daemon process is forked,
+ * so no change is lost after its first answer.
+ *
+ * @param pidDest The destination for the process ID of the daemon.
+ * @param dirCountDest The destination for the number of watched directories.
+ *
+ * @return ERR_NOERR on success, ERR_ALREADY_EXIST if it is already running, or ERR_GENERAL on errors.
+ */
+int startFsmonitor(pid_t *pidDest, uint *dirCountDest);
+
+/**
+ * @brief Stop the file system monitor daemon of the current repository. (fsmonitor.h)
+ *
+ * @return ERR_NOERR on success, or ERR_NOT_EXIST if it is not running.
+ */
+int stopFsmonitor();
+
+/**
+ * @brief Get the status of the file system monitor daemon of the current repository. (fsmonitor.h)
+ *
+ * @param dirCountDest The destination for the number of watched directories.
+ * @param pathCountDest The destination for the number of recorded paths.
+ * @param overflowedDest The destination for the overflow flag (Some changes are lost; every query needs a full scan).
+ *
+ * @return ERR_NOERR on success, or ERR_NOT_EXIST if it is not running.
+ */
+int getFsmonitorStatus(uint *dirCountDest, uint *pathCountDest, bool *overflowedDest);
+
+/**
+ * @brief Get the files of the working tree which may be changed from the staging area or HEAD. (fsmonitor.h)
+ *
+ * They are the changed files of the last status and the files changed since then (files of changed directories
+ * are included). Any other file is unchanged. The daemon is asked once per process.
+ *
+ * @param dest The destination for the paths <<relative to the repository>> (owned by this module).
+ *
+ * @return The number of files, or -1 if the working tree must be scanned (the daemon is not running or has
+ * overflowed, or HEAD, the staging area or the tracked files are changed since the last status).
+ */
+int getFsmonitorCandidates(constString **dest);
+
+/**
+ * @brief Check if a file is returned by getFsmonitorCandidates (which must be called first). (fsmonitor.h)
+ *
+ * @param path The path of the file <<relative to the repository>>.
+ *
+ * @return true if the file may be changed, false if it is unchanged.
+ */
+bool isFsmonitorCandidate(constString path);
+
+/**
+ * @brief Check if the daemon answered the query of getFsmonitorCandidates (The state can be written). (fsmonitor.h)
+ *
+ * @return true if it answered, false otherwise.
+ */
+bool isFsmonitorRunning();
+
+/**
+ * @brief Write the changed files of a status, with the token of the query (only if the daemon answered). (fsmonitor.h)
+ *
+ * @param paths All changed files <<relative to the repository>> (see listChangedFiles).
+ * @param count The number of files.
+ *
+ * @return ERR_NOERR on success (also if the daemon is not running), or ERR_FILE_ERROR if the state could not be written.
+ */
+int writeFsmonitorState(constString *paths, uint count);
+
+#endif
@@ -0,0 +1,219 @@
+/*******************************
+ *        hash_funcs.h         *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __HASH_FUNCS_H__
+#define __HASH_FUNCS_H__
+
+#include "common.h"
+#include "string_funcs.h"
+#include <stdint.h>
+#include <string.h>
+
+#define SHA256_DIGEST_LEN 32 // Length of a raw SHA-256 digest in bytes
+#define SHA256_HEX_LEN 64	 // Length of a SHA-256 digest in hexadecimal characters
+
+// Streaming state of a SHA-256 computation (hash_funcs.h)
+typedef struct _sha256_context_t
+{
+	uint32_t state[8];	/**< Intermediate hash value. */
+	uint64_t bitLen;	/**< Total number of processed bits. */
+	uchar block[64];	/**< Pending (not yet processed) input block. */
+	uint blockLen;		/**< Number of bytes in the pending block. */
+} Sha256Context;
+
+// A set of strings with open addressing (hash_funcs.h)
+typedef struct _string_set_t
+{
+	String *slots; /**< Table of copied strings (NULL for empty slots). */
+	size_t cap;	   /**< Number of slots (a power of two). */
+	size_t len;	   /**< Number of strings in the set. */
+} StringSet;
+
+// The key of an element of an indexed array (hash_funcs.h)
+typedef const void *(*IndexMapKeyFn)(const void *ctx, uint index);
+
+// A map from keys to the indices of an array, with open addressing (hash_funcs.h)
+// The keys are not copied: they are read from the array by a callback, so the map has only one uint per slot.
+typedef struct _index_map_t
+{
+	uint *slots;		 /**< Table of (index + 1), 0 for empty slots (at most half full). */
+	uint mask;			 /**< Number of slots - 1 (0 if there is no table). */
+	uint len;			 /**< Number of indices in the map. */
+	IndexMapKeyFn keyOf; /**< Key of an index (a string, or keyLen bytes). */
+	const void *ctx;	 /**< Passed to keyOf (e.g. the array, if it is not global). */
+	size_t keyLen;		 /**< Length of the keys in bytes (0 for strings). */
+} IndexMap;
+
+/**
+ * @brief Initialize a SHA-256 context. (hash_funcs.h)
+ *
+ * @param ctx The context to be initialized.
+ */
+void sha256Init(Sha256Context *ctx);
+
+/**
+ * @brief Feed data into a SHA-256 computation. (hash_funcs.h)
+ *
+ * The sha256Update function can be called any number of times with consecutive
+ * pieces of the input data.
+ *
+ * @param ctx The context initialized by sha256Init.
+ * @param data Pointer to the input data.
+ * @param len Length of the input data in bytes.
+ */
+void sha256Update(Sha256Context *ctx, const void *data, size_t len);
+
+/**
+ * @brief Finish a SHA-256 computation and obtain the digest. (hash_funcs.h)
+ *
+ * @param ctx The context to be finalized. (It must be initialized again before reuse.)
+ * @param digest The destination buffer of SHA256_DIGEST_LEN bytes.
+ */
+void sha256Final(Sha256Context *ctx, uchar digest[SHA256_DIGEST_LEN]);
+
+/**
+ * @brief Convert a raw digest to a lowercase hexadecimal string. (hash_funcs.h)
+ *
+ * Example:
+ * - Input: digestToHex(buf, {0xAB, 0x01}, 2)
+ *   Output: "ab01"
+ *
+ * @param dest The pre-allocated destination string (at least 2 * len + 1 characters).
+ * @param digest The raw digest bytes.
+ * @param len Number of bytes in the digest.
+ *
+ * @return The destination string.
+ */
+String digestToHex(String dest, const uchar *digest, size_t len);
+
+/**
+ * @brief Convert a hexadecimal string to a raw digest. (hash_funcs.h)
+ *
+ * @param dest The pre-allocated destination buffer (len bytes).
+ * @param hex The hexadecimal string (at least 2 * len characters, upper or lower case).
+ * @param len Number of bytes in the digest.
+ *
+ * @return true on success, or false if the string contains a non-hexadecimal character.
+ */
+bool hexToDigest(uchar *dest, constString hex, size_t len);
+
+/**
+ * @brief Compute the SHA-256 hash of the content of a file. (hash_funcs.h)
+ *
+ * The file is read in large blocks, so memory usage does not depend on the file size.
+ *
+ * @param path The path of the file <<absolute or relative to the current working directory>>
+ * @param hexDest The pre-allocated destination string (at least SHA256_HEX_LEN + 1 characters).
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if the file could not be read.
+ */
+int sha256File(constString path, String hexDest);
+
+/**
+ * @brief Hash of a string (FNV-1a, 64 bits). (hash_funcs.h)
+ *
+ * @param str The string to be hashed.
+ *
+ * @return The hash value.
+ */
+uint64_t strHash(constString str);
+
+/**
+ * @brief Hash of a memory block (FNV-1a, 64 bits; the same as strHash for the characters of a string). (hash_funcs.h)
+ *
+ * @param data Pointer to the data.
+ * @param len Length of the data in bytes.
+ *
+ * @return The hash value.
+ */
+uint64_t memHash(const void *data, size_t len);
+
+/**
+ * @brief Initialize an empty string set. (hash_funcs.h)
+ *
+ * @param set The set to be initialized.
+ * @param expected Expected number of strings (the table grows automatically).
+ */
+void stringSetInit(StringSet *set, size_t expected);
+
+/**
+ * @brief Add a copy of a string to a set. (hash_funcs.h)
+ *
+ * @param set The set.
+ * @param str The string to be added.
+ *
+ * @return true if the string is added, or false if it was already in the set (or on memory errors).
+ */
+bool stringSetAdd(StringSet *set, constString str);
+
+/**
+ * @brief Check if a string is in a set. (hash_funcs.h)
+ *
+ * @return true if the string is in the set, false otherwise.
+ */
+bool stringSetContains(const StringSet *set, constString str);
+
+/**
+ * @brief Free all strings of a set and its table. (hash_funcs.h)
+ *
+ * @param set The set to be freed (It is empty and reusable after this call).
+ */
+void stringSetFree(StringSet *set);
+
+/**
+ * @brief Initialize an empty index map. (hash_funcs.h)
+ *
+ * @param map The map to be initialized.
+ * @param keyOf The function which gives the key of an index of the array.
+ * @param ctx The context which is passed to keyOf.
+ * @param keyLen The length of the keys in bytes, or 0 if they are strings.
+ */
+void indexMapInit(IndexMap *map, IndexMapKeyFn keyOf, const void *ctx, size_t keyLen);
+
+/**
+ * @brief Make room in a map for a number of indices, so they are added without growing the table. (hash_funcs.h)
+ *
+ * @return true on success, or false on memory errors (the map is not changed).
+ */
+bool indexMapReserve(IndexMap *map, uint count);
+
+/**
+ * @brief Add an index to a map, under the key of its element. (hash_funcs.h)
+ *
+ * @param map The map.
+ * @param index The index in the array (keyOf must give its key).
+ *
+ * @return true if the index is added, or false if the key is already in the map (the first index is kept)
+ * or on memory errors.
+ */
+bool indexMapAdd(IndexMap *map, uint index);
+
+/**
+ * @brief Find the index of a key in a map. (hash_funcs.h)
+ *
+ * @return The index, or -1 if the key is not in the map.
+ */
+long indexMapFind(const IndexMap *map, const void *key);
+
+/**
+ * @brief Remove a key from a map (The indices of the other keys are not changed). (hash_funcs.h)
+ *
+ * @return true if the key was in the map, false otherwise.
+ */
+bool indexMapRemove(IndexMap *map, const void *key);
+
+/**
+ * @brief Remove all indices of a map (Its table is kept for reuse). (hash_funcs.h)
+ */
+void indexMapClear(IndexMap *map);
+
+/**
+ * @brief Free the table of a map (It is empty and reusable after this call). (hash_funcs.h)
+ */
+void indexMapFree(IndexMap *map);
+
+#endif
@@ -11,6 +11,7 @@
 #include "common.h"
 #include "string_funcs.h"
 #include "file_funcs.h"
+#include "objects.h"
 
 #define PROGRAM_NAME "neogit"
 
@@ -41,11 +42,11 @@ int process_command(int argc, constString argv[], bool performActions);
 
 /////////////////////////// STRUCTS OF GIT REPOSITORY ////////////////////////
 
-// The GitObject struct represents a file in the staging area or commit, including the file details and a 10-digit hash string.
+// The GitObject struct represents a file in the staging area or commit, including the file details and its content hash string.
 typedef struct _git_object_t
 {
-	FileEntry file;	  /**< Details of the object file. */
-	char hashStr[11]; /**< 10-digit hash string. */
+	FileEntry file;					/**< Details of the object file. */
+	char hashStr[OBJ_HASH_LEN + 1]; /**< Content hash string (or a 10-digit ID in old repositories). */
 } GitObject;
 // The GitObjectArray struct holds an array of GitObject elements along with the length of the array.
 typedef struct _git_object_array_t
@@ -57,26 +58,61 @@ typedef struct _git_object_array_t
 // Struct representing the HEAD of the repository.
 typedef struct _head_t
 {
-	uint64_t hash;			  /**< Hash of the HEAD state. */
-	String branch;			  /**< Current branch. */
-	GitObjectArray headFiles; /**< Array of files in the HEAD state. */
+	uint64_t hash;					 /**< Hash of the HEAD state. */
+	String branch;					 /**< Current branch. */
+	GitObjectArray headFiles;		 /**< Array of files in the HEAD state. */
+	char treeHash[OBJ_HASH_LEN + 1]; /**< Hash of the root tree of the HEAD commit (empty for old commits). */
 } HEAD;
 
 // Struct representing a commit in the repository.
 typedef struct _commit_t
 {
-	uint64_t hash;				  /**< Hash of the commit. */
-	String username;			  /**< Username of the committer. */
-	String useremail;			  /**< Email of the committer. */
-	time_t time;				  /**< Commit time. */
-	String message;				  /**< Commit message. */
-	String branch;				  /**< Branch associated with the commit. */
-	GitObjectArray commitedFiles; /**< Array of files committed in this commit. */
-	GitObjectArray headFiles;	  /**< Array of files in the HEAD state after this commit. */
-	uint64_t prev;				  /**< Hash of the previous commit. */
-	uint64_t mergedCommit;		  /**< Hash of the merged commit (if applicable). */
+	uint64_t hash;					 /**< Hash of the commit. */
+	String username;				 /**< Username of the committer. */
+	String useremail;				 /**< Email of the committer. */
+	time_t time;					 /**< Commit time. */
+	String message;					 /**< Commit message. */
+	String branch;					 /**< Branch associated with the commit. */
+	GitObjectArray commitedFiles;	 /**< Array of files committed in this commit. */
+	GitObjectArray headFiles;		 /**< Array of files in the HEAD state after this commit. */
+	uint commitedCount;				 /**< Number of files committed in this commit (valid without loading commitedFiles). */
+	uint64_t prev;					 /**< Hash of the previous commit. */
+	uint64_t mergedCommit;			 /**< Hash of the merged commit (if applicable). */
+	char treeHash[OBJ_HASH_LEN + 1]; /**< Hash of the root tree of the HEAD files (empty for old commits). */
+	bool commitedFilesLoaded;		 /**< Whether commitedFiles is loaded (see getCommitedFiles). */
+	bool headFilesLoaded;			 /**< Whether headFiles is loaded (see getCommitHeadFiles). */
+	bool cached;					 /**< Whether the commit is shared through the commit cache. */
+	uint refCount;					 /**< Number of users of a cached commit (released by freeCommitStruct). */
 } Commit;
 
+// Parsed commits are shared through a per-process cache keyed by hash (neogit.h)
+// Commits which are not in use are kept up to "core.commitCacheSize" bytes (or with a K/M/G suffix; 0 disables keeping),
+// and the least recently used ones are evicted first. Hits and misses are reported on stderr if NEOGIT_TRACE is set.
+#define COMMIT_CACHE_SIZE_CONFIG "core.commitCacheSize"
+#define COMMIT_CACHE_SIZE_DEFAULT (32 * 1024 * 1024)
+
+// Staging index (neogit.h) :
+// .neogit/stage/index : "<magic:4><version:4 LE><count:4 LE><generation:4 LE>" followed by <count> entries sorted by path:
+//                       "<time:8 LE><perm:4 LE><path-len:4 LE><hash:64 (NUL padded)><path:path-len>"
+// It replaces the text file ".neogit/stage/info" of old versions, which is still read if there is no index.
+// Changes of the staging area are kept in memory and appended to the journal once per command (see writeStagingArea).
+#define STAGE_INDEX_MAGIC "\x7fNGX"
+#define STAGE_INDEX_VERSION 1
+#define STAGE_INDEX_HEADER_SIZE 16
+#define STAGE_INDEX_ENTRY_SIZE (16 + OBJ_HASH_LEN)
+
+// Staging journal (neogit.h) :
+// .neogit/stage/journal : "<magic:4><version:4 LE><generation:4 LE><reserved:4>" followed by a record for each change:
+//                         "<checksum:4 LE><entry>" (an entry of the index; the hash of a removed path is empty)
+// The checksum is the low 32 bits of the memHash of the entry. A journal is replayed on the index of its generation
+// (the last record of a path wins), and a record which is cut by a crash is ignored with everything after it.
+// The journal is replaced by a new index (compacted) when it has more records than the staging area has files,
+// but not before it has STAGE_JOURNAL_COMPACT_MIN records.
+#define STAGE_JOURNAL_MAGIC "\x7fNGJ"
+#define STAGE_JOURNAL_VERSION 1
+#define STAGE_JOURNAL_HEADER_SIZE 16
+#define STAGE_JOURNAL_COMPACT_MIN 1024
+
 // The Repository struct holds information about a repository (path, staging area, head)
 typedef struct _repository_t
 {
@@ -211,8 +247,8 @@ bool isGitIgnore(FileEntry *entry);
 /**
  * @brief Tracks a file by adding it to the list of tracked files.
  *
- * This function checks if the file is already tracked. If not, it adds the file path
- * to the manifest file that keeps track of all the files being monitored.
+ * This function checks if the file is already tracked. If not, it adds the file path to the set of tracked files,
+ * and it is appended to the manifest file at the end of the command (see writeTrackedFiles).
  *
  * @param filepath <<Must be relative to repo path>>.
  * @return Returns ERR_NOERR if the operation is successful, otherwise an error code.
@@ -222,14 +258,32 @@ int trackFile(constString filepath);
 /**
  * @brief Checks if a file is tracked.
  *
- * This function reads the manifest file containing the list of tracked files and
- * checks if the specified file path is present in the list.
+ * The manifest file containing the list of tracked files is loaded once into a hash set,
+ * and the specified file path is looked up in the set.
  *
  * @param path <<Must be relative to repo path>>.
  * @return Returns true if the file is tracked, otherwise false.
  */
 bool isTrackedFile(constString path);
 
+/**
+ * @brief Get all tracked files, in the order they were tracked. (neogit.h)
+ *
+ * @param dest The destination for the array of paths <<relative to repo path>> (owned by the tracked set; must not be freed).
+ *
+ * @return The number of tracked files.
+ */
+uint listTrackedFiles(constString **dest);
+
+/**
+ * @brief Write the manifest of tracked files if new files are tracked. (neogit.h)
+ *
+ * The manifest is written in a temporary file first and then renamed. It is called once at the end of each command.
+ *
+ * @return ERR_NOERR on success (also if nothing is changed), or ERR_FILE_ERROR if the manifest could not be written.
+ */
+int writeTrackedFiles();
+
 /**
  * @brief Generates a unique identifier.
  *
@@ -243,7 +297,8 @@ ullong generateUniqueId(int hexdigits);
 /**
  * @brief Adds a file to the staging area.
  *
- * This function adds the specified file to the staging area, updating its information in the staging area and info file.
+ * This function adds the specified file to the staging area in memory (The index is written by writeStagingArea).
+ * The staged object is named by the content hash of the file, so re-adding unchanged content writes nothing.
  *
  * @param filePath <<Must be relative to repo path>>.
  * @return Returns an error code. ERR_NOERR on success, other codes on failure.
@@ -253,7 +308,7 @@ int addToStage(constString filePath);
 /**
  * @brief Removes a file from the staging area.
  *
- * This function removes the specified file from the staging area, updating its information in the staging area and info file.
+ * This function removes the specified file from the staging area in memory (The index is written by writeStagingArea).
  *
  * @param filePath <<Must be relative to repo path>>.
  * @return Returns an error code. ERR_NOERR on success, ERR_NOT_EXIST if the file is not in the staging area, other codes on failure.
@@ -261,29 +316,39 @@ int addToStage(constString filePath);
 int removeFromStage(constString filePath);
 
 /**
- * @brief Creates backups of the staging area by moving existing backups and copying the current staging area.
+ * @brief Creates a snapshot of the staging area by moving existing snapshots and writing the index of the current staging area.
  *
- * This function creates backups of the staging area by moving existing backups to newer versions (old0 to old1, old1 to old2, ...),
- * and then copying the current staging area to old0.
+ * This function moves existing snapshots to newer versions (old0 to old1, old1 to old2, ..., old9 is removed),
+ * and then writes an index of the current staging area to old0. Staged objects are not copied: they are never changed,
+ * and they are kept while a snapshot refers to them (see writeStagingArea).
  *
  * @return Returns 0 if successful, or an error code if there was an issue during the backup process.
  */
 int backupStagingArea();
 
 /**
- * @brief Restores the staging area from the backup (old0) by moving backed up files and removing the backup directory.
+ * @brief Restores the staging area from the last snapshot (old0) by moving its index and removing the snapshot directory.
  *
- * This function restores the staging area by moving files from the backup (old0) to the staging area and
- * then removing the backup directory.
+ * This function replaces the staging index with the index of the snapshot (old0), removes the staging journal,
+ * and then moves the other snapshots to older versions (old1 to old0, ...).
  *
  * @return Returns 0 if successful, or an error code if there was an issue during the restoration process.
  */
 int restoreStageingBackup();
 
+/**
+ * @brief Adds the hashes of the objects which are referenced by the snapshots of the staging area (old0 to old9) to a set.
+ *
+ * Every snapshot is kept for "reset -undo" (it can be repeated), so their objects must be kept too.
+ *
+ * @param dest The destination set.
+ */
+void addSnapshotObjects(StringSet *dest);
+
 /**
  * @brief Gets the StagedFile corresponding to the provided file path.
  *
- * This function searches for the GitObject in the GitObjectArray of the current repository based on the provided file path.
+ * This function looks up the GitObject in the GitObjectArray of the current repository in a hash table of paths.
  *
  * @param path <<Must be relative to repo path>>.
  * @return Returns a pointer to the GitObject if found, or NULL if not found.
@@ -291,14 +356,39 @@ int restoreStageingBackup();
 GitObject *getStagedFile(constString path);
 
 /**
- * @brief Fetches the information of files in the staging area from the info file.
+ * @brief Fetches the information of files in the staging area from the staging index.
  *
- * This function reads the information of files in the staging area from the info file and updates the GitObjectArray in the curRepository.
+ * This function reads the staging index (see readStageIndex) and replaces the GitObjectArray in the curRepository,
+ * and indexes its files by path for getStagedFile.
  *
  * @return Returns an error code. ERR_NOERR on success, ERR_FILE_ERROR on file-related errors.
  */
 int fetchStagingArea();
 
+/**
+ * @brief Read the files of a staging index. (neogit.h)
+ *
+ * The journal of the directory is replayed on the index.
+ * If the directory has no index, the text file "info" of old versions is read instead.
+ *
+ * @param stageDir The absolute path of the staging directory (e.g. ".neogit/stage" or a backup of it).
+ * @param dest The destination array (free with freeGitObjectArray).
+ *
+ * @return ERR_NOERR on success, ERR_NOT_EXIST if there is no index, or ERR_FILE_ERROR if it is corrupted.
+ */
+int readStageIndex(constString stageDir, GitObjectArray *dest);
+
+/**
+ * @brief Write the changes of the staging area, if there is any. (neogit.h)
+ *
+ * The changed paths are appended to the staging journal. When the journal is too long (or it could not be appended),
+ * the whole index is written in a temporary file first and then renamed, and the journal is removed.
+ * The staged objects which are no longer used by any staged file or snapshot are removed. It is called once at the end of each command.
+ *
+ * @return ERR_NOERR on success (also if nothing is changed), or ERR_FILE_ERROR if the index could not be written.
+ */
+int writeStagingArea();
+
 /**
  * @brief Get the change status of a file relative to the staging area and the HEAD commit.
  *
@@ -346,12 +436,36 @@ int lsWithHead(FileEntry **buf, constString path);
  * This function lists files with changes in the specified destination directory. It includes both files that have
  * changes in the working directory and files that have changes staged in the HEAD commit. <<The paths in the output
  * buffer are absolute>>.
+ * The first call walks the directory once, bottom-up, and caches the changed entries of each subdirectory, so the
+ * following calls for the subdirectories (e.g. by processTree) visit no entry again. The cache is dropped when the
+ * staging area or HEAD is changed.
  *
  * @param buf Pointer to the buffer where the list of files with changes will be stored.
  * @param dest The relative-to-cwd or absolute path of the destination directory to list.
  * @return Returns the number of entries in the list on success, or an error code if an error occurs during listing.
  */
 int lsChangedFiles(FileEntry **buf, constString dest);
+
+/**
+ * @brief Set the changed files of the working tree, so lsChangedFiles does not walk it (e.g. found by a scan).
+ *
+ * The files and their parent directories are listed in the same order as lsWithHead lists them. Files which
+ * lsWithHead does not list (ignored, or deleted and not in HEAD) are skipped. The files are valid until the staging
+ * area or HEAD is changed, like the cache of lsChangedFiles.
+ *
+ * @param paths All changed files <<relative to the repository>>.
+ * @param count The number of files.
+ */
+void setChangedFiles(constString *paths, uint count);
+
+/**
+ * @brief List all changed files of the working tree (lsChangedFiles of the repository, and the staged files which
+ * are deleted from the working tree but not listed since they are not in HEAD).
+ *
+ * @param dest The destination for the dynamically allocated paths <<relative to the repository>> (They must be freed).
+ * @return Returns the number of files.
+ */
+uint listChangedFiles(String **dest);
 #define _LIST_FILES_CHANGED_FROM_HEAD ({extern bool _ls_head_changed_files; _ls_head_changed_files=true; })
 #define _LIST_FILES_CHANGED_FROM_STAGE ({extern bool _ls_head_changed_files; _ls_head_changed_files=false; })
 
@@ -390,22 +504,82 @@ void freeGitObjectArray(GitObjectArray *array);
  */
 Commit *createCommit(GitObjectArray *filesToCommit, constString username, constString email, constString message, uint64_t mergedHash);
 
+/**
+ * @brief Get the absolute path of a commit file.
+ *
+ * Commit files are sharded into subdirectories of .neogit/commits by the first SHARD_PREFIX_LEN digits of their hash.
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ * @param hash The hash of the commit.
+ * @return The destination string.
+ */
+String getCommitPath(String dest, uint64_t hash);
+
+/**
+ * @brief List the hashes of all commits of the repository.
+ *
+ * The commit directories are only read (no stat and no sort), so the order of the result is not specified.
+ *
+ * @param dest The destination for the dynamically allocated array of hashes (The caller must free it).
+ * @return The number of commits.
+ */
+uint listCommitHashes(uint64_t **dest);
+
+/**
+ * @brief Open a commit file for reading.
+ *
+ * @param hash The hash of the commit.
+ * @return The opened file (in the sharded layout, or in the flat layout of repositories which are not migrated), or NULL if it does not exist.
+ */
+FILE *openCommitFile(uint64_t hash);
+
 /**
  * @brief Retrieve a commit by its hash.
  *
- * This function retrieves a commit from the repository by its hash.
+ * This function retrieves a commit from the repository by its hash, with its committed files and HEAD files.
+ * The commit is shared through the commit cache, so it must not be modified, and it must be released by freeCommitStruct.
  *
  * @param hash The hash of the commit to retrieve.
  * @return Returns a pointer to the retrieved commit on success, or NULL if the commit is not found or an error occurs.
  */
 Commit *getCommit(uint64_t hash);
 
+/**
+ * @brief Retrieve a commit by its hash, without its file lists.
+ *
+ * Only the header lines (author, time, branch, parents, message) and the tree hash are parsed.
+ * commitedFiles and headFiles are empty until they are loaded by getCommitedFiles / getCommitHeadFiles.
+ * The commit is shared through the commit cache (see getCommit).
+ *
+ * @param hash The hash of the commit to retrieve.
+ * @return Returns a pointer to the retrieved commit (free with freeCommitStruct), or NULL if it is not found or corrupted.
+ */
+Commit *getCommitHeader(uint64_t hash);
+
+/**
+ * @brief Get the committed files of a commit, loading them on the first access.
+ *
+ * @param commit The commit (obtained from getCommit / getCommitHeader).
+ * @return The address of commit->commitedFiles, or NULL if the commit file could not be read.
+ */
+GitObjectArray *getCommitedFiles(Commit *commit);
+
+/**
+ * @brief Get the HEAD files of a commit, loading them (from its tree) on the first access.
+ *
+ * @param commit The commit (obtained from getCommit / getCommitHeader).
+ * @return The address of commit->headFiles, or NULL if the commit file or its tree could not be read.
+ */
+GitObjectArray *getCommitHeadFiles(Commit *commit);
+
 /**
  * @brief Free the memory allocated for a Commit structure.
  *
  * This function frees the memory allocated for a Commit structure, including its fields and arrays.
+ * A commit obtained from the commit cache (getCommit / getCommitHeader) is only released: it is freed
+ * when it is not in use anymore and is evicted from the cache.
  *
- * @param object Pointer to the Commit structure to be freed.
+ * @param object Pointer to the Commit structure to be freed. (NULL is allowed)
  */
 void freeCommitStruct(Commit *object);
 
@@ -465,6 +639,7 @@ uint64_t getBrachHeadPrev(constString branchName, uint order);
  *
  * This function searches for the GitObject associated with the specified file path
  * within the given GitObjectArray. The input path <<must be relative to the repository.>>
+ * The HEAD files of the current repository are looked up in a hash table of paths (built on the first lookup).
  *
  * @param path <<must be relative to the repository.>>
  * @param head the GitObjectArray (which search within)
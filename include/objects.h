@@ -0,0 +1,287 @@
+/*******************************
+ *         objects.h           *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __OBJECTS_H__
+#define __OBJECTS_H__
+
+#include "common.h"
+#include "string_funcs.h"
+#include "file_funcs.h"
+#include "hash_funcs.h"
+#include "compress_funcs.h"
+#include "packs.h"
+
+// Length of the content hash (hex SHA-256) which is used as the name of objects (objects.h)
+#define OBJ_HASH_LEN SHA256_HEX_LEN
+
+// Check if a hash string is a content hash (Old repositories have 10-digit random IDs) (objects.h)
+#define isContentHash(hash) (strlen(hash) == OBJ_HASH_LEN)
+
+// Stored object format (objects.h) :
+// Header (16 bytes) : "<magic:4><type:1><reserved:3><content-size:8 LE>"
+// Type 'Z' : content is split into blocks of OBJ_BLOCK_SIZE bytes, each block is
+//            "<stored-size:4 LE><content-size:4 LE><data>" and compressed by lzCompress
+//            (if OBJ_BLOCK_STORED flag is set in stored-size, the block is not compressed)
+// Type 'D' : "<base-hash:64>" followed by LZ blocks of the instructions of deltaEncode against the base object
+//            (The first reserved byte is the length of the chain of bases; content-size is the rebuilt size)
+// Type 'C' : LZ blocks of the manifest of a chunked file: "<chunk-hash:64><chunk-size:8 LE>" for each chunk
+//            (Chunks are cut by cdcChunkLength and stored as separate 'Z' objects named by their own content hash)
+// Objects of old repositories have no header and are read as they are (type 'R')
+#define OBJ_MAGIC "\x7fNGO"
+#define OBJ_HEADER_SIZE 16
+#define OBJ_TYPE_RAW 'R'
+#define OBJ_TYPE_LZ 'Z'
+#define OBJ_TYPE_DELTA 'D'
+#define OBJ_TYPE_CHUNKED 'C'
+#define OBJ_BLOCK_SIZE (256 * 1024)
+#define OBJ_BLOCK_STORED 0x80000000U
+#define OBJ_DELTA_MAX_DEPTH 10				  // Maximum length of a chain of delta objects
+#define OBJ_DELTA_MAX_SIZE (16 * 1024 * 1024) // Larger files are never stored as deltas (they are rebuilt in memory)
+#define OBJ_CHUNK_ENTRY_SIZE (OBJ_HASH_LEN + 8)
+
+// Files of at least this size are stored in chunks (objects.h)
+// It can be changed by the "core.chunkThreshold" config (in bytes, or with a K/M/G suffix; 0 disables chunking)
+#define OBJ_CHUNK_THRESHOLD_CONFIG "core.chunkThreshold"
+#define OBJ_CHUNK_THRESHOLD_DEFAULT OBJ_DELTA_MAX_SIZE
+
+// A sequential reader of the content of a stored object (objects.h)
+typedef struct _object_reader_t
+{
+	FILE *file;						/**< The stored object file. */
+	char type;						/**< Type of the stored object (OBJ_TYPE_*). */
+	uchar depth;					/**< Length of the chain of bases (0 if not a delta). */
+	uint64_t size;					/**< Size of the object content in bytes. */
+	uchar *block;					/**< Current decoded block. */
+	uchar *storedBuf;				/**< Buffer for reading compressed blocks. */
+	uint blockLen;					/**< Length of the current decoded block. */
+	uint blockPos;					/**< Read position in the current decoded block. */
+	bool error;						/**< Set if the stored object is corrupted. */
+	uchar *manifest;				/**< Manifest of a chunked object (OBJ_CHUNK_ENTRY_SIZE bytes per chunk). */
+	uint64_t chunkCount;			/**< Number of chunks of a chunked object. */
+	uint64_t chunkIndex;			/**< Index of the next chunk to be opened. */
+	struct _object_reader_t *chunk; /**< Reader of the current chunk. */
+} ObjectReader;
+
+/**
+ * @brief Get the absolute path of an object in the object store. (objects.h)
+ *
+ * Objects are sharded into subdirectories by the first SHARD_PREFIX_LEN characters of their hash.
+ *
+ * Example:
+ * - Input: getObjectPath(buf, "9f86d0...")
+ *   Output: "/path/to/repo/.neogit/objects/9f/9f86d0..."
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ * @param hash The hash string of the object.
+ *
+ * @return The destination string.
+ */
+String getObjectPath(String dest, constString hash);
+
+/**
+ * @brief Get the absolute path of a staged object (in the staging area). (objects.h)
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ * @param hash The hash string of the object.
+ *
+ * @return The destination string.
+ */
+String getStagedObjectPath(String dest, constString hash);
+
+/**
+ * @brief Find the file which holds an object (object store first, then the staging area). (objects.h)
+ *
+ * Objects of repositories which are not migrated to the sharded layout are found in the flat layout too.
+ *
+ * Since objects are named by their content hash, an object with a given hash has the same
+ * content wherever it is found.
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ * @param hash The hash string of the object.
+ *
+ * @return The destination string, or NULL if the object does not exist.
+ */
+String findObject(String dest, constString hash);
+
+/**
+ * @brief Check if an object exists (in packs, the object store or the staging area). (objects.h)
+ *
+ * @param hash The hash string of the object.
+ *
+ * @return true if the object exists, false otherwise.
+ */
+bool isObjectExist(constString hash);
+
+/**
+ * @brief Open a stored object file for reading its content. (objects.h)
+ *
+ * @param objPath The absolute path of the stored object file.
+ *
+ * @return A reader which must be closed by closeObject, or NULL if the file could not be opened.
+ */
+ObjectReader *openObjectFile(constString objPath);
+
+/**
+ * @brief Open an object (by its hash) for reading its content. (objects.h)
+ *
+ * The object is looked up in the pack files first, then as a loose file (see findObject).
+ *
+ * @param hash The hash string of the object.
+ *
+ * @return A reader which must be closed by closeObject, or NULL if the object does not exist.
+ */
+ObjectReader *openObject(constString hash);
+
+/**
+ * @brief Get the base of a delta object, without rebuilding its content. (objects.h)
+ *
+ * @param dest The pre-allocated destination string (OBJ_HASH_LEN + 1).
+ * @param hash The hash string of the object.
+ *
+ * @return The destination string, or NULL if the object is not a delta (or does not exist).
+ */
+String getDeltaBase(String dest, constString hash);
+
+/**
+ * @brief Get the chunks of a chunked object, without reading them. (objects.h)
+ *
+ * @param hash The hash string of the object.
+ * @param chunksDest The destination for the array of hash strings of the chunks (It must be freed with its strings).
+ *
+ * @return The number of chunks, or 0 if the object is not chunked (or does not exist).
+ */
+uint listObjectChunks(constString hash, String **chunksDest);
+
+/**
+ * @brief Read (decompressed) content of an object. (objects.h)
+ *
+ * @param reader The reader obtained from openObject / openObjectFile.
+ * @param buf The destination buffer.
+ * @param len Number of bytes to read.
+ *
+ * @return Number of bytes read. It is less than len at the end of the content or on error (reader->error is set).
+ */
+size_t readObject(ObjectReader *reader, void *buf, size_t len);
+
+/**
+ * @brief Close a reader and free its resources. (objects.h)
+ *
+ * @param reader The reader to be closed. (NULL is allowed)
+ */
+void closeObject(ObjectReader *reader);
+
+/**
+ * @brief Write the content of a file as a compressed stored object. (objects.h)
+ *
+ * The object is written in a temporary file first and then renamed, so a partially written object is never visible.
+ *
+ * @param srcPath The absolute path of the source file.
+ * @param objPath The absolute path of the stored object file.
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if an error occurs.
+ */
+int writeObjectFile(constString srcPath, constString objPath);
+
+/**
+ * @brief Store a content from memory as an object named by its content hash (e.g. trees, chunks). (objects.h)
+ *
+ * The object is written directly into the object store, only if an object with the same hash does not exist.
+ *
+ * @param data The content.
+ * @param len The length of the content.
+ * @param hashDest The pre-allocated destination string for the hash (OBJ_HASH_LEN + 1).
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if the object could not be written.
+ */
+int writeObjectBuffer(const void *data, size_t len, String hashDest);
+
+/**
+ * @brief Store an object as a delta against another object (e.g. the previous version of the same file). (objects.h)
+ *
+ * The delta is only written if both objects are smaller than OBJ_DELTA_MAX_SIZE, the chain of bases
+ * is shorter than OBJ_DELTA_MAX_DEPTH and the delta is smaller than half of the content.
+ *
+ * @param hash The hash string of the object (It must be readable, e.g. staged).
+ * @param baseHash The hash string of the base object (It must be in the object store).
+ * @param objPath The absolute path of the stored object file to be written.
+ *
+ * @return ERR_NOERR if the delta is written, or an error code if it is not (then the object must be stored completely).
+ */
+int writeDeltaObject(constString hash, constString baseHash, constString objPath);
+
+/**
+ * @brief Write the content of an object to a file (e.g. in the working tree). (objects.h)
+ *
+ * @param hash The hash string of the object.
+ * @param destPath The absolute path of the destination file. (It is replaced if exists)
+ *
+ * @return ERR_NOERR on success, ERR_NOT_EXIST if the object is not found, or ERR_FILE_ERROR on errors.
+ */
+int restoreObject(constString hash, constString destPath);
+
+/**
+ * @brief Check if the content of a file is the same as the content of an object. (objects.h)
+ *
+ * @param filePath The path of the file <<absolute or relative to the current working directory>>
+ * @param hash The hash string of the object.
+ *
+ * @return true if both have the same content, false otherwise (or if any of them is not found).
+ */
+bool isFileSameAsObject(constString filePath, constString hash);
+
+/**
+ * @brief Check if two objects have the same content. (objects.h)
+ *
+ * @note - Objects with different content hashes always differ; this is only needed for old random IDs.
+ *
+ * @return true if both objects exist and have the same content, false otherwise.
+ */
+bool isObjectsSame(constString hash1, constString hash2);
+
+/**
+ * @brief Get the content of an object as a temporary file. (objects.h)
+ *
+ * This is used for reading objects line by line (grep, diff).
+ *
+ * @param hash The hash string of the object.
+ *
+ * @return A temporary file positioned at its beginning (removed automatically on fclose), or NULL on errors.
+ */
+FILE *openObjectAsFile(constString hash);
+
+/**
+ * @brief Store a working tree file as a staged object named by its content hash. (objects.h)
+ *
+ * The content hash of the file is calculated, and the file is compressed into the staging area
+ * only if an object with the same hash does not already exist (staged or committed).
+ *
+ * Files larger than the chunk threshold (see OBJ_CHUNK_THRESHOLD_CONFIG) are split by content-defined chunking:
+ * the new chunks are written directly into the object store and only the manifest is staged, so a small change
+ * of a large file only stores the chunks around it.
+ *
+ * @param filePath <<Must be relative to repo path>>.
+ * @param hashDest The pre-allocated destination string for the hash (OBJ_HASH_LEN + 1).
+ *
+ * @return ERR_NOERR on success, or ERR_FILE_ERROR if the file could not be read or stored.
+ */
+int writeStagedObject(constString filePath, String hashDest);
+
+/**
+ * @brief Move a staged object into the object store. (objects.h)
+ *
+ * If an object with the same hash already exists in the object store, nothing is written.
+ * Otherwise, it is stored as a delta against the base object if possible (see writeDeltaObject),
+ * or the staged file is renamed into the object store (it is copied only across file systems).
+ *
+ * @param hash The hash string of the staged object.
+ * @param baseHash The hash string of the previous version of the same file (NULL if there is none).
+ *
+ * @return ERR_NOERR on success, or an error code if the object could not be stored.
+ */
+int commitStagedObject(constString hash, constString baseHash);
+
+#endif
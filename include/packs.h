@@ -0,0 +1,104 @@
+/*******************************
+ *          packs.h            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __PACKS_H__
+#define __PACKS_H__
+
+#include "common.h"
+#include "string_funcs.h"
+#include "file_funcs.h"
+#include "hash_funcs.h"
+
+// Pack files (packs.h) :
+// .neogit/packs/pack-<id>.pack : stored object files (with their headers) one after another
+// .neogit/packs/pack-<id>.idx  : "<magic:4><version:4 LE><count:8 LE>" followed by <count> entries
+//                                "<digest:32><offset:8 LE><length:8 LE>" sorted by digest
+// The index is written after the pack, so a pack without index is never used.
+#define PACK_IDX_MAGIC "\x7fNGI"
+#define PACK_IDX_VERSION 1
+#define PACK_IDX_HEADER_SIZE 16
+#define PACK_IDX_ENTRY_SIZE (SHA256_DIGEST_LEN + 16)
+
+// A pack file and its index mapped in memory (packs.h)
+typedef struct _pack_t
+{
+	const uchar *idx;  /**< Mapped index file. */
+	size_t idxLen;	   /**< Size of the index file. */
+	const uchar *data; /**< Mapped pack file. */
+	size_t dataLen;	   /**< Size of the pack file. */
+	uint64_t count;	   /**< Number of objects in the pack. */
+	String idxPath;	   /**< Path of the index file. */
+} Pack;
+
+/**
+ * @brief Get the absolute path of the packs directory of the current repository. (packs.h)
+ *
+ * @param dest The pre-allocated destination string (PATH_MAX).
+ *
+ * @return The destination string.
+ */
+String getPacksPath(String dest);
+
+/**
+ * @brief Find an object in the pack files of the current repository. (packs.h)
+ *
+ * Packs are mapped in memory on the first call, and each lookup is a binary search in their indexes.
+ *
+ * @param hash The hash string of the object (Only content hashes can be packed).
+ * @param dataDest The destination for the address of the stored object in the mapped pack. (NULL is allowed)
+ * @param lenDest The destination for the size of the stored object. (NULL is allowed)
+ *
+ * @return true if the object is found, false otherwise.
+ */
+bool findPackedObject(constString hash, const uchar **dataDest, size_t *lenDest);
+
+/**
+ * @brief Call a function for every object of the pack files. (packs.h)
+ *
+ * An object which is in more than one pack is visited once for each pack.
+ *
+ * @param callback The function to be called with the hash string of each object.
+ * @param arg The argument which is passed to the callback.
+ *
+ * @return The number of visited objects.
+ */
+uint64_t forEachPackedObject(void (*callback)(constString hash, void *arg), void *arg);
+
+/**
+ * @brief Unmap all pack files (They are mapped again on the next lookup). (packs.h)
+ *
+ * @note - It must not be called while other threads read packed objects.
+ */
+void closePacks();
+
+/**
+ * @brief Move all loose objects of the object store into a new pack file. (packs.h)
+ *
+ * Objects of old repositories (not named by a content hash) remain loose.
+ * The loose files are removed only after the pack and its index are completely written.
+ *
+ * @param countDest The destination for the number of packed objects. (NULL is allowed)
+ *
+ * @return ERR_NOERR on success (also if nothing is packed), or an error code on failures.
+ */
+int packLooseObjects(uint *countDest);
+
+/**
+ * @brief Remove unreachable objects from the pack files. (packs.h)
+ *
+ * The reachable objects of each pack which has unreachable objects are written into a new pack,
+ * and then the old packs are removed. Packs without unreachable objects are not touched.
+ *
+ * @param reachable The set of hash strings of reachable objects.
+ * @param removedDest The destination for the number of removed objects. (NULL is allowed)
+ * @param freedDest The destination for the number of freed bytes. (NULL is allowed)
+ *
+ * @return ERR_NOERR on success, or an error code on failures (then no pack is removed).
+ */
+int prunePacks(const StringSet *reachable, uint *removedDest, uint64_t *freedDest);
+
+#endif
@@ -9,6 +9,9 @@
 #define __PHASE_1_H__
 
 #include "neogit.h"
+#include "commitgraph.h"
+#include "worktree.h"
+#include "fsmonitor.h"
 
 // Declare an struct for command 'log' options
 typedef struct _log_options_t
@@ -51,7 +54,9 @@ int command_init(int argc, constString argv[], bool performActions);
 int command_config(int argc, constString argv[], bool performActions);
 #define CMD_CONFIG_USAGE "Set a config: " _BOLD PROGRAM_NAME " config [--global] <key> <value>\n" _UNBOLD \
 						 "Remove a config : " _BOLD PROGRAM_NAME " config [--global] -R <key>\n" _UNBOLD  \
-						 "Valid keys are : user.* / alias.*\n"
+						 "Valid keys are : user.* / alias.* / core.*\n"                                \
+						 "  core.chunkThreshold : files of at least this size (e.g. 16M, 0 = never) are stored in chunks\n" \
+						 "  core.commitCacheSize : memory for parsed commits which are not in use (e.g. 32M, 0 = none)\n"
 
 /**
  * @brief Add files to the staging area or list, stage, or undo changes.
@@ -9,6 +9,7 @@
 #define __PHASE_2_H__
 
 #include "neogit.h"
+#include "commitgraph.h"
 
 /**
  * @brief Reverts the working tree to a specified commit and optionally creates a new commit.
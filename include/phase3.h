@@ -0,0 +1,96 @@
+/*******************************
+ *         phase3.h            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __PHASE_3_H__
+#define __PHASE_3_H__
+
+#include "neogit.h"
+#include "trees.h"
+#include "commitgraph.h"
+#include "fsmonitor.h"
+
+/**
+ * @brief Moves loose objects of the object store into a pack file.
+ *
+ * All objects in .neogit/objects (except objects of old repositories) are written into a single pack file
+ * with a sorted index, and then the loose files are removed. Objects are read from packs first.
+ *
+ * @param argc          The number of arguments.
+ * @param argv          The array of command-line arguments.
+ * @param performActions A boolean indicating whether to perform the actions or only check syntax.
+ * @return              An error code indicating the result of the operation.
+ */
+int command_repack(int argc, constString argv[], bool performActions);
+#define CMD_REPACK_USAGE \
+	"\n" _BOLD "neogit repack " _UNBOLD ": Moves loose objects of the repository into a pack file.\n"
+
+/**
+ * @brief Migrates the object store and the commits of an old repository to the sharded layout.
+ *
+ * Loose objects and commit files which are directly in .neogit/objects and .neogit/commits are moved into
+ * subdirectories named by the first SHARD_PREFIX_LEN characters of their names. Repositories which are not
+ * migrated still work (files are looked up in both layouts), but directory operations stay slow.
+ *
+ * @param argc          The number of arguments.
+ * @param argv          The array of command-line arguments.
+ * @param performActions A boolean indicating whether to perform the actions or only check syntax.
+ * @return              An error code indicating the result of the operation.
+ */
+int command_migrate(int argc, constString argv[], bool performActions);
+#define CMD_MIGRATE_USAGE \
+	"\n" _BOLD "neogit migrate " _UNBOLD ": Moves objects and commits of an old repository into the sharded (xx/) layout.\n"
+
+/**
+ * @brief Removes unreachable objects and commits, and stale staged blobs.
+ *
+ * Commits are marked from all branch heads, tags and HEAD (following their previous and merged commits),
+ * then every object in their HEAD files (and the bases of delta objects) is marked. The staging area and
+ * all of its snapshots (used by "reset -undo") are kept. Everything else is swept and the reclaimed space is reported.
+ *
+ * @param argc          The number of arguments.
+ * @param argv          The array of command-line arguments.
+ * @param performActions A boolean indicating whether to perform the actions or only check syntax.
+ * @return              An error code indicating the result of the operation.
+ */
+int command_gc(int argc, constString argv[], bool performActions);
+#define CMD_GC_USAGE \
+	"\n" _BOLD "neogit gc " _UNBOLD ": Removes unreachable objects/commits and stale staged files.\n"
+
+/**
+ * @brief Verifies the integrity of the repository.
+ *
+ * Branches, tags and HEAD must point at existing commits, and the commit graph is walked from them.
+ * Every object referenced by the commits and the staging area (with the bases of deltas and the chunks
+ * of chunked objects) is read completely and checked against its content hash on a pool of threads.
+ * Missing, corrupt and dangling (unreachable) objects and commits are reported.
+ *
+ * @param argc          The number of arguments.
+ * @param argv          The array of command-line arguments.
+ * @param performActions A boolean indicating whether to perform the actions or only check syntax.
+ * @return              ERR_NOERR if no problem is found, ERR_GENERAL otherwise (or another error code).
+ */
+int command_fsck(int argc, constString argv[], bool performActions);
+#define CMD_FSCK_USAGE \
+	"\n" _BOLD "neogit fsck [-j <threads>]" _UNBOLD ": Verifies commits and objects and reports missing, corrupt and dangling ones.\n"
+
+/**
+ * @brief Starts, stops or reports the file system monitor daemon of the repository.
+ *
+ * The daemon watches the working tree with inotify, so status, add -redo and checkout only check the files
+ * which are changed since the last status instead of scanning the whole tree (see fsmonitor.h).
+ * Without the daemon (or if it has lost events), the working tree is scanned as before.
+ *
+ * @param argc          The number of arguments.
+ * @param argv          The array of command-line arguments.
+ * @param performActions A boolean indicating whether to perform the actions or only check syntax.
+ * @return              An error code indicating the result of the operation.
+ */
+int command_fsmonitor(int argc, constString argv[], bool performActions);
+#define CMD_FSMONITOR_USAGE \
+	"\n" _BOLD "neogit fsmonitor start|stop|status" _UNBOLD ": Runs a daemon which watches the working tree, so status does not scan it.\n"
+
+#endif
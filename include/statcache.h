@@ -0,0 +1,74 @@
+/*******************************
+ *        statcache.h          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __STATCACHE_H__
+#define __STATCACHE_H__
+
+#include "neogit.h"
+
+// Stat cache (statcache.h) :
+// .neogit/stat-cache : "<magic:4><version:4 LE><count:4 LE><reserved:4>" followed by <count> entries sorted by path:
+//                      "<size:8 LE><mtime-ns:8 LE><ctime-ns:8 LE><inode:8 LE><path-len:4 LE><reserved:4><hash:64 (NUL padded)><path>"
+// An entry records that a working tree file with these stat data had the content of an object.
+// If the stat data of the file are still the same, the file is not opened again for comparing its content.
+// A file which is modified after the cache is written is never trusted (racily clean: its timestamps are not older
+// than the cache file), so its content is compared and it is recorded again.
+// Entries which are recorded by the current process are used until it exits (their stat data are taken before reading).
+#define STAT_CACHE_MAGIC "\x7fNGS"
+#define STAT_CACHE_VERSION 1
+#define STAT_CACHE_HEADER_SIZE 16
+#define STAT_CACHE_ENTRY_SIZE (40 + OBJ_HASH_LEN)
+
+/**
+ * @brief Check if a working tree file has the same content as an object, using the stat cache. (statcache.h)
+ *
+ * If the file is recorded with the same stat data, its content is known without opening it;
+ * otherwise it is compared with the object (see isFileSameAsObject) and recorded if it is the same.
+ *
+ * @param path The path of the file <<relative to the repository>>.
+ * @param hash The hash string of the object.
+ *
+ * @return true if both have the same content, false otherwise (or if any of them is not found).
+ */
+bool isWorkingFileSame(constString path, constString hash);
+
+/**
+ * @brief Record that a working tree file has the content of an object (e.g. just staged or restored). (statcache.h)
+ *
+ * @param path The path of the file <<relative to the repository>>.
+ * @param st The stat data of the file when its content was read or written.
+ * @param hash The hash string of the object.
+ */
+void recordStatCache(constString path, const struct stat *st, constString hash);
+
+/**
+ * @brief Load the stat cache of the current repository (It is also loaded on the first lookup). (statcache.h)
+ */
+void loadStatCache();
+
+/**
+ * @brief Get the content hash of a working tree file from the stat cache, if its stat data are the same. (statcache.h)
+ *
+ * It only reads the cache, so it may be called from many threads at the same time after loadStatCache
+ * (while no file is recorded).
+ *
+ * @param path The path of the file <<relative to the repository>>.
+ * @param st The current stat data of the file.
+ * @param hashDest The destination for the hash (at least OBJ_HASH_LEN + 1 characters).
+ *
+ * @return true if the file is recorded with the same stat data, false otherwise.
+ */
+bool lookupStatCache(constString path, const struct stat *st, String hashDest);
+
+/**
+ * @brief Write the stat cache if it is changed (in a temporary file, and then renamed). (statcache.h)
+ *
+ * @return ERR_NOERR on success (also if nothing is changed), or ERR_FILE_ERROR if the cache could not be written.
+ */
+int writeStatCache();
+
+#endif
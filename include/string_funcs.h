@@ -17,6 +17,13 @@
 
 #define SEARCH_DELIMETERS " \n\r\t.,!?()"
 
+// A view of a part of a string (e.g. a line of a mapped file); it is not NUL-terminated and not owned (string_funcs.h)
+typedef struct _str_view_t
+{
+	constString str; /**< Start of the view (NULL when a split view is exhausted). */
+	size_t len;		 /**< Length of the view. */
+} StrView;
+
 /*!
  * @brief Concatenate constant strings using a macro and return a newly allocated string (string_funcs.h)
  *
@@ -273,6 +280,79 @@ String strptime(constString s, constString f, struct tm *tm);
  */
 time_t parseDateTimeAuto(constString dateTimeStr);
 
+/**
+ * @brief Parse a size in bytes, with an optional K/M/G suffix (e.g. "512", "64K", "16M"). (string_funcs.h)
+ *
+ * @param sizeStr The input string.
+ * @param dest The destination for the size in bytes.
+ * @return true on success, false if the string is not a valid size or the size overflows. (dest is not changed)
+ */
+bool parseSize(constString sizeStr, uint64_t *dest);
+
+/**
+ * @brief Take the next field of a view, up to the first delimiter. (string_funcs.h)
+ *
+ * Example:
+ * - Splitting "a:b:c" by ":" gives "a", "b" and "c", and then false.
+ *
+ * @param rest The view to be split; it is advanced past the delimiter (or exhausted if there is no delimiter).
+ * @param delim The delimiter string.
+ * @param field The destination for the field (the whole rest if there is no delimiter).
+ * @return true if a field is taken, false if the view was already exhausted.
+ */
+bool nextField(StrView *rest, constString delim, StrView *field);
+
+/**
+ * @brief Take the last field of a view, after the last delimiter. (string_funcs.h)
+ *
+ * This is used for fields which are followed by fields that never contain the delimiter (e.g. paths with ':').
+ *
+ * @param rest The view to be split; it is shortened to the part before the delimiter (or exhausted if there is none).
+ * @param delim The delimiter character.
+ * @param field The destination for the field (the whole rest if there is no delimiter).
+ * @return true if a field is taken, false if the view was already exhausted.
+ */
+bool lastField(StrView *rest, char delim, StrView *field);
+
+/**
+ * @brief Remove a prefix from a view if the view starts with it. (string_funcs.h)
+ *
+ * @return true if the prefix is removed, false if the view does not start with it.
+ */
+bool viewSkipPrefix(StrView *view, constString prefix);
+
+/**
+ * @brief Check if a view is equal to a string. (string_funcs.h)
+ */
+bool viewEquals(StrView view, constString str);
+
+/**
+ * @brief Parse a whole view as an unsigned number. (string_funcs.h)
+ *
+ * @param view The view (digits only).
+ * @param base The base of the number (10 or 16).
+ * @param dest The destination for the number.
+ * @return true on success, false if the view is empty or has other characters.
+ */
+bool viewToU64(StrView view, int base, uint64_t *dest);
+
+/**
+ * @brief Copy a view into a pre-allocated string. (string_funcs.h)
+ *
+ * @param dest The destination string.
+ * @param destSize The size of the destination (including the NUL).
+ * @param view The view to be copied.
+ * @return true on success, false if the view does not fit (then nothing is copied).
+ */
+bool viewCopy(String dest, size_t destSize, StrView view);
+
+/**
+ * @brief Copy a view into a newly allocated string. (string_funcs.h)
+ *
+ * @return The new string (The caller must free it), or NULL if memory could not be allocated.
+ */
+String viewDup(StrView view);
+
 
 /**
  * @brief Concatenate constant strings and return a newly allocated string  (string_funcs.h)
@@ -0,0 +1,83 @@
+/*******************************
+ *          trees.h            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __TREES_H__
+#define __TREES_H__
+
+#include "neogit.h"
+
+// Tree objects (trees.h) :
+// A tree is a stored object which lists one directory of a commit, one entry per line sorted by name:
+// "<name>:<time>:<perm>:<hash>" for files (same format with staging info), and "<name>/:<tree-hash>" for subdirectories.
+// Trees are named by their content hash, so a directory which is not changed is shared by all commits.
+
+// An entry of a tree object (trees.h)
+typedef struct _tree_entry_t
+{
+	String name;					/**< Name of the file or the subdirectory. */
+	bool isTree;					/**< Whether the entry is a subdirectory (a tree). */
+	time_t dateModif;				/**< Modification time of the file. */
+	uint permission;				/**< Permission of the file. */
+	char hashStr[OBJ_HASH_LEN + 1]; /**< Hash of the file object (or of the tree). */
+} TreeEntry;
+
+/**
+ * @brief Read the entries of a tree object. (trees.h)
+ *
+ * @param hash The hash string of the tree.
+ * @param entriesDest The destination for the dynamically allocated array of entries (free with freeTreeEntries).
+ * @param countDest The destination for the number of entries.
+ *
+ * @return ERR_NOERR on success, ERR_NOT_EXIST if the tree does not exist, or ERR_FILE_ERROR if it is corrupted.
+ */
+int readTree(constString hash, TreeEntry **entriesDest, uint *countDest);
+
+/**
+ * @brief Free an array of tree entries. (trees.h)
+ */
+void freeTreeEntries(TreeEntry *entries, uint count);
+
+/**
+ * @brief Write the trees of a new version of a base tree. (trees.h)
+ *
+ * Only the directories which contain changed files are read and written again;
+ * the hashes of the other subdirectories are taken from the base tree as they are.
+ *
+ * @param baseHash The hash string of the base root tree. (NULL or empty for an empty tree)
+ * @param changes The changed files (paths <<relative to the repository>>). They replace the files with the same paths.
+ * @param hashDest The pre-allocated destination string for the hash of the new root tree (OBJ_HASH_LEN + 1).
+ *
+ * @return ERR_NOERR on success, or an error code if a tree could not be read or written.
+ */
+int writeTree(constString baseHash, const GitObjectArray *changes, String hashDest);
+
+/**
+ * @brief Get all files of a tree (recursively) as an array of objects. (trees.h)
+ *
+ * @param hash The hash string of the root tree.
+ * @param dest The destination array (Its paths are <<relative to the repository>>; free with freeGitObjectArray).
+ *
+ * @return ERR_NOERR on success, or an error code if a tree could not be read.
+ */
+int loadTreeFiles(constString hash, GitObjectArray *dest);
+
+/**
+ * @brief Visit the trees of a root tree which are not visited yet. (trees.h)
+ *
+ * A tree which is already in the visited set is skipped with all of its subtrees,
+ * so walking the trees of many commits only reads each shared directory once.
+ *
+ * @param hash The hash string of the root tree.
+ * @param visited The set of the hashes of the visited trees (New trees are added to it).
+ * @param callback The function to be called for each file entry of the new trees. (NULL is allowed)
+ * @param arg The argument which is passed to the callback.
+ *
+ * @return ERR_NOERR on success, or an error code if a tree could not be read.
+ */
+int walkTree(constString hash, StringSet *visited, void (*callback)(const TreeEntry *entry, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,74 @@
+/*******************************
+ *         worktree.h          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#ifndef __WORKTREE_H__
+#define __WORKTREE_H__
+
+#include "neogit.h"
+
+// Working tree scan (worktree.h) :
+// Directories are scanned by a pool of threads. Each worker has a deque of directories: it takes the newest one from its
+// own deque (depth first) and steals the oldest one of another worker when its deque is empty. Files are stat'ed, and
+// the content of tracked files is hashed unless the stat cache knows it. The results are merged in the order of a depth
+// first walk (the order of ls in each directory), so they can be processed and printed like a sequential walk.
+// The number of threads is "core.scanThreads" (1 scans in the calling thread; by default the number of CPUs).
+#define SCAN_THREADS_CONFIG "core.scanThreads"
+#define SCAN_MAX_THREADS 64
+
+// An entry of the working tree (worktree.h)
+typedef struct _scan_entry_t
+{
+	String path;				 /**< Path relative to the repository. */
+	struct stat st;				 /**< Stat data (taken before the content is read). */
+	bool isDir;					 /**< Is it a directory? */
+	bool hashed;				 /**< The hash is computed by the scan (It is not known from the stat cache). */
+	char hash[OBJ_HASH_LEN + 1]; /**< Content hash of a tracked file ("" if it is unknown). */
+} ScanEntry;
+
+/**
+ * @brief Scan a directory of the working tree and its subdirectories in parallel. (worktree.h)
+ *
+ * The .neogit directory and ignored directories (see isGitIgnore) are skipped. The hashed files are recorded in the
+ * stat cache, so the following comparisons of them with staged or committed objects do not read them again.
+ *
+ * @param dirPath The path of the directory <<relative to the repository>> ("." for the root).
+ * @param dest The destination for the dynamically allocated entries: a directory is before its entries, and the
+ * entries of a directory are in the order of ls (Directory first, Name Ascending). Free them with freeScanEntries.
+ * @param countDest The destination for the number of entries.
+ *
+ * @return ERR_NOERR on success, or ERR_MALLOC if the memory could not be allocated.
+ */
+int scanWorkingTree(constString dirPath, ScanEntry **dest, uint *countDest);
+
+/**
+ * @brief Free the entries of a working tree scan. (worktree.h)
+ *
+ * @param entries The entries.
+ * @param count The number of entries.
+ */
+void freeScanEntries(ScanEntry *entries, uint count);
+
+/**
+ * @brief Scan the working tree and list the files which may be changed from the staging area or HEAD. (worktree.h)
+ *
+ * They are the files of the working tree and the deleted files of HEAD, so they can be given to setChangedFiles
+ * after they are compared (lsChangedFiles does not walk the tree again).
+ *
+ * @param dest The destination for the dynamically allocated paths <<relative to the repository>> (They must be freed).
+ *
+ * @return The number of files, or -1 if the memory could not be allocated.
+ */
+int scanChangeCandidates(String **dest);
+
+/**
+ * @brief Get the number of threads of working tree scans ("core.scanThreads"). (worktree.h)
+ *
+ * @return The number of threads (1 to SCAN_MAX_THREADS).
+ */
+uint getScanThreadCount();
+
+#endif
@@ -0,0 +1,455 @@
+/*******************************
+ *       commitgraph.c         *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#define _GNU_SOURCE // For qsort_r
+#include "commitgraph.h"
+
+extern Repository *curRepository; // Declared in neogit.c
+
+// Commit graph of the current repository (mapped on the first lookup)
+static const uchar *__graph = NULL;
+static size_t __graphLen = 0;
+static uint __graphCount = 0;
+static constString *__graphBranches = NULL; // Addresses of the names in the mapped file
+static uint __graphBranchCount = 0;
+static IndexMap __graphTable = {NULL}; // Index of the records by commit hash
+static bool __graphLoaded = false;
+static bool __graphRebuilt = false; // The graph is rebuilt at most once in a run
+
+// A commit read from its file while the graph is rebuilt
+typedef struct _graph_entry_t
+{
+	uint64_t hash;
+	uint64_t prev;
+	uint64_t merged;
+	time_t time;
+	uint branch;
+	uint prevIndex;
+	uint mergedIndex;
+	uint generation;
+} GraphEntry;
+
+#define __graph_record(index) (__graph + COMMIT_GRAPH_HEADER_SIZE + (size_t)(index) * COMMIT_GRAPH_RECORD_SIZE)
+
+static String __get_graph_path(String dest)
+{
+	return strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/commit-graph");
+}
+
+// Key of a record: the commit hash at its start (8 bytes LE); the context is the mapped file
+static const void *__graph_record_key(const void *ctx, uint index)
+{
+	return (const uchar *)ctx + COMMIT_GRAPH_HEADER_SIZE + (size_t)index * COMMIT_GRAPH_RECORD_SIZE;
+}
+
+// Index of the record of a commit in the mapped graph
+static uint __find_record(uint64_t hash)
+{
+	uchar key[8];
+	putLE64(key, hash);
+	long index = indexMapFind(&__graphTable, key);
+	return index >= 0 ? (uint)index : COMMIT_GRAPH_NONE;
+}
+
+// Map the graph file and index its records (false if it does not exist or is not valid)
+static bool __map_graph()
+{
+	char path[PATH_MAX];
+	size_t len = 0;
+	const uchar *map = mapFile(__get_graph_path(path), &len);
+	if (!map)
+		return false;
+
+	bool valid = len >= COMMIT_GRAPH_HEADER_SIZE && memcmp(map, COMMIT_GRAPH_MAGIC, 4) == 0 && getLE32(map + 4) == COMMIT_GRAPH_VERSION;
+	uint count = valid ? getLE32(map + 8) : 0, branchCount = valid ? getLE32(map + 12) : 0;
+	uint64_t namesLen = valid ? getLE64(map + 16) : 0;
+	valid = valid && len == COMMIT_GRAPH_HEADER_SIZE + (uint64_t)count * COMMIT_GRAPH_RECORD_SIZE + namesLen && (!namesLen || map[len - 1] == '\0');
+
+	// Branch names
+	constString *branches = valid ? malloc((branchCount + 1) * sizeof(constString)) : NULL;
+	constString name = (constString)map + COMMIT_GRAPH_HEADER_SIZE + (size_t)count * COMMIT_GRAPH_RECORD_SIZE;
+	valid = valid && branches;
+	for (uint i = 0; valid && i < branchCount; i++)
+	{
+		if (name >= (constString)map + len)
+			valid = false;
+		else
+		{
+			branches[i] = name;
+			name += strlen(name) + 1;
+		}
+	}
+
+	// Hash table of records (at most half full)
+	IndexMap table;
+	indexMapInit(&table, __graph_record_key, map, 8);
+	valid = valid && indexMapReserve(&table, count);
+	for (uint i = 0; valid && i < count; i++)
+	{
+		const uchar *record = __graph_record_key(map, i);
+		uint prev = getLE32(record + 16), merged = getLE32(record + 20);
+		if ((prev != COMMIT_GRAPH_NONE && prev >= count) || (merged != COMMIT_GRAPH_NONE && merged >= count) || getLE32(record + 24) >= branchCount)
+			valid = false;
+		indexMapAdd(&table, i); // The first record of a commit is found
+	}
+
+	if (!valid)
+	{
+		free(branches);
+		indexMapFree(&table);
+		unmapFile(map, len);
+		return false;
+	}
+	__graph = map;
+	__graphLen = len;
+	__graphCount = count;
+	__graphBranches = branches;
+	__graphBranchCount = branchCount;
+	__graphTable = table;
+	return true;
+}
+
+// Check if the heads of all branches are in the graph (commits of older versions are not)
+static bool __is_graph_up_to_date()
+{
+	char path[PATH_MAX];
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/branches");
+	bool upToDate = true;
+	with(branchesFile, fopen(path, "r"), fclose(branchesFile))
+	{
+		char name[STR_LINE_MAX];
+		uint64_t hash;
+		while (upToDate && fscanf(branchesFile, "%[^:]:%lx\n", name, &hash) == 2)
+		{
+			if (hash == 0xFFFFFF || __find_record(hash) != COMMIT_GRAPH_NONE)
+				continue;
+			FILE *commitFile = openCommitFile(hash);
+			if (commitFile)
+			{
+				upToDate = false;
+				fclose(commitFile);
+			}
+		}
+	}
+	return upToDate;
+}
+
+static void __rebuild_graph()
+{
+	__graphRebuilt = true;
+	closeCommitGraph();
+	writeCommitGraph(NULL);
+	__map_graph();
+	__graphLoaded = true;
+}
+
+static void __ensure_graph_loaded()
+{
+	if (__graphLoaded)
+		return;
+	__graphLoaded = true;
+	if (!__map_graph() || !__is_graph_up_to_date())
+		__rebuild_graph();
+}
+
+static uint __get_generation(uint index)
+{
+	return index == COMMIT_GRAPH_NONE ? 0 : getLE32(__graph_record(index) + 28);
+}
+
+static void __fill_commit_info(uint index, CommitInfo *dest)
+{
+	const uchar *record = __graph_record(index);
+	uint prev = getLE32(record + 16), merged = getLE32(record + 20);
+	dest->hash = getLE64(record);
+	dest->time = (time_t)getLE64(record + 8);
+	dest->prev = prev == COMMIT_GRAPH_NONE ? 0xFFFFFF : getLE64(__graph_record(prev));
+	dest->mergedCommit = merged == COMMIT_GRAPH_NONE ? 0 : getLE64(__graph_record(merged));
+	dest->branch = __graphBranches[getLE32(record + 24)];
+	dest->generation = getLE32(record + 28);
+}
+
+bool getCommitInfo(uint64_t hash, CommitInfo *dest)
+{
+	__ensure_graph_loaded();
+	uint index = __find_record(hash);
+	if (index == COMMIT_GRAPH_NONE && !__graphRebuilt && hash != 0 && hash != 0xFFFFFF)
+	{
+		FILE *commitFile = openCommitFile(hash);
+		if (commitFile) // The commit is made by an older version
+		{
+			fclose(commitFile);
+			__rebuild_graph();
+			index = __find_record(hash);
+		}
+	}
+	if (index == COMMIT_GRAPH_NONE)
+		return false;
+	if (dest)
+		__fill_commit_info(index, dest);
+	return true;
+}
+
+uint listCommitInfos(CommitInfo **dest)
+{
+	__ensure_graph_loaded();
+	*dest = malloc((__graphCount + 1) * sizeof(CommitInfo));
+	if (!*dest)
+		return 0;
+	for (uint i = 0; i < __graphCount; i++)
+		__fill_commit_info(i, &(*dest)[i]);
+	return __graphCount;
+}
+
+// Find a branch name in an array of names, or add it
+static uint __get_branch_id(String **branches, uint *count, constString name)
+{
+	for (uint i = 0; i < *count; i++)
+		if (!strcmp((*branches)[i], name))
+			return i;
+	ADD_EMPTY(*branches, *count, String);
+	(*branches)[*count - 1] = strDup(name);
+	return *count - 1;
+}
+
+static int __entry_hash_comparator(const void *a, const void *b)
+{
+	uint64_t h1 = ((const GraphEntry *)a)->hash, h2 = ((const GraphEntry *)b)->hash;
+	return h1 < h2 ? -1 : h1 > h2;
+}
+
+// Order of records in a rebuilt graph: by time (then by hash)
+static int __entry_time_comparator(const void *a, const void *b)
+{
+	const GraphEntry *e1 = a, *e2 = b;
+	if (e1->time != e2->time)
+		return e1->time < e2->time ? -1 : 1;
+	return __entry_hash_comparator(a, b);
+}
+
+// Index of a commit in an array of entries sorted by hash (byHash holds the indexes)
+static uint __find_entry(const GraphEntry *entries, const uint *byHash, uint count, uint64_t hash)
+{
+	uint lo = 0, hi = count;
+	while (lo < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (entries[byHash[mid]].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < count && entries[byHash[lo]].hash == hash ? byHash[lo] : COMMIT_GRAPH_NONE;
+}
+
+static int __cmp_indexes_by_hash(const void *a, const void *b, void *entries)
+{
+	return __entry_hash_comparator(&((GraphEntry *)entries)[*(const uint *)a], &((GraphEntry *)entries)[*(const uint *)b]);
+}
+
+// Calculate the generation numbers of all entries (parents first, without recursion)
+static void __calc_generations(GraphEntry *entries, uint count)
+{
+	uint *stack = malloc((count + 1) * sizeof(uint)), top = 0;
+	for (uint i = 0; stack && i < count; i++)
+	{
+		if (entries[i].generation)
+			continue;
+		entries[i].generation = COMMIT_GRAPH_NONE; // In progress (a cycle is ignored)
+		stack[top++] = i;
+		while (top)
+		{
+			GraphEntry *e = &entries[stack[top - 1]];
+			uint parents[2] = {e->prevIndex, e->mergedIndex}, generation = 0;
+			bool pushed = false;
+			for (int j = 0; j < 2 && !pushed; j++)
+			{
+				if (parents[j] == COMMIT_GRAPH_NONE)
+					continue;
+				if (!entries[parents[j]].generation)
+				{
+					entries[parents[j]].generation = COMMIT_GRAPH_NONE;
+					stack[top++] = parents[j];
+					pushed = true;
+				}
+				else if (entries[parents[j]].generation != COMMIT_GRAPH_NONE && entries[parents[j]].generation > generation)
+					generation = entries[parents[j]].generation;
+			}
+			if (!pushed)
+			{
+				e->generation = generation + 1;
+				top--;
+			}
+		}
+	}
+	free(stack);
+}
+
+int writeCommitGraph(uint *countDest)
+{
+	uint64_t *hashes = NULL;
+	uint hashCount = listCommitHashes(&hashes), count = 0, branchCount = 0;
+	String *branches = NULL;
+	GraphEntry *entries = malloc((hashCount + 1) * sizeof(GraphEntry));
+	uint *byHash = malloc((hashCount + 1) * sizeof(uint));
+	if (!entries || !byHash)
+	{
+		free(hashes);
+		free(entries);
+		free(byHash);
+		return ERR_FILE_ERROR;
+	}
+
+	// Read the history lines of all commits
+	for (uint i = 0; i < hashCount; i++)
+	{
+		Commit *commit = getCommitHeader(hashes[i]);
+		if (!commit)
+			continue;
+		GraphEntry *entry = &entries[count++];
+		entry->hash = commit->hash;
+		entry->prev = commit->prev;
+		entry->merged = commit->mergedCommit;
+		entry->time = commit->time;
+		entry->branch = __get_branch_id(&branches, &branchCount, commit->branch);
+		freeCommitStruct(commit);
+	}
+	free(hashes);
+	qsort(entries, count, sizeof(GraphEntry), __entry_time_comparator);
+
+	// Resolve the parents into record indexes
+	for (uint i = 0; i < count; i++)
+		byHash[i] = i;
+	qsort_r(byHash, count, sizeof(uint), __cmp_indexes_by_hash, entries);
+	for (uint i = 0; i < count; i++)
+	{
+		entries[i].prevIndex = entries[i].prev == 0xFFFFFF ? COMMIT_GRAPH_NONE : __find_entry(entries, byHash, count, entries[i].prev);
+		entries[i].mergedIndex = entries[i].merged ? __find_entry(entries, byHash, count, entries[i].merged) : COMMIT_GRAPH_NONE;
+		entries[i].generation = 0;
+	}
+	free(byHash);
+	__calc_generations(entries, count);
+
+	// Serialize the graph
+	size_t namesLen = 0;
+	for (uint i = 0; i < branchCount; i++)
+		namesLen += strlen(branches[i]) + 1;
+	size_t len = COMMIT_GRAPH_HEADER_SIZE + (size_t)count * COMMIT_GRAPH_RECORD_SIZE + namesLen;
+	uchar *content = malloc(len);
+	if (content)
+	{
+		memcpy(content, COMMIT_GRAPH_MAGIC, 4);
+		putLE32(content + 4, COMMIT_GRAPH_VERSION);
+		putLE32(content + 8, count);
+		putLE32(content + 12, branchCount);
+		putLE64(content + 16, namesLen);
+		for (uint i = 0; i < count; i++)
+		{
+			uchar *record = content + COMMIT_GRAPH_HEADER_SIZE + (size_t)i * COMMIT_GRAPH_RECORD_SIZE;
+			putLE64(record, entries[i].hash);
+			putLE64(record + 8, (uint64_t)entries[i].time);
+			putLE32(record + 16, entries[i].prevIndex);
+			putLE32(record + 20, entries[i].mergedIndex);
+			putLE32(record + 24, entries[i].branch);
+			putLE32(record + 28, entries[i].generation);
+		}
+		uchar *names = content + len - namesLen;
+		for (uint i = 0; i < branchCount; i++)
+			names = (uchar *)stpcpy((String)names, branches[i]) + 1;
+	}
+	free(entries);
+	for (uint i = 0; i < branchCount; i++)
+		free(branches[i]);
+	free(branches);
+
+	// Replace the old graph at once
+	char path[PATH_MAX], tmpPath[PATH_MAX];
+	strcat_s(tmpPath, __get_graph_path(path), ".tmp");
+	bool ok = false;
+	if (content)
+		with(graphFile, fopen(tmpPath, "wb"), fclose(graphFile))
+			ok = fwrite(content, 1, len, graphFile) == len && fflush(graphFile) == 0;
+	free(content);
+	if (!ok || rename(tmpPath, path) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
+	}
+
+	closeCommitGraph(); // The new graph is mapped on the next lookup
+	if (countDest)
+		*countDest = count;
+	return ERR_NOERR;
+}
+
+int addCommitToGraph(const Commit *commit)
+{
+	__ensure_graph_loaded();
+	if (__find_record(commit->hash) != COMMIT_GRAPH_NONE) // The graph is just rebuilt with this commit
+		return ERR_NOERR;
+
+	uint prev = commit->prev == 0xFFFFFF ? COMMIT_GRAPH_NONE : __find_record(commit->prev);
+	uint merged = commit->mergedCommit ? __find_record(commit->mergedCommit) : COMMIT_GRAPH_NONE;
+	if (!__graph || (prev == COMMIT_GRAPH_NONE && commit->prev != 0xFFFFFF) || (merged == COMMIT_GRAPH_NONE && commit->mergedCommit))
+		return writeCommitGraph(NULL);
+
+	// The names follow the records, so they are written again after the new record
+	size_t namesLen = __graphLen - COMMIT_GRAPH_HEADER_SIZE - (size_t)__graphCount * COMMIT_GRAPH_RECORD_SIZE;
+	size_t newNamesLen = namesLen;
+	uint branch = 0, branchCount = __graphBranchCount;
+	while (branch < branchCount && strcmp(__graphBranches[branch], commit->branch))
+		branch++;
+	if (branch == branchCount)
+		newNamesLen += strlen(commit->branch) + 1, branchCount++;
+
+	uchar *tail = malloc(COMMIT_GRAPH_RECORD_SIZE + newNamesLen);
+	if (!tail)
+		return ERR_FILE_ERROR;
+	uint prevGeneration = __get_generation(prev), mergedGeneration = __get_generation(merged);
+	putLE64(tail, commit->hash);
+	putLE64(tail + 8, (uint64_t)commit->time);
+	putLE32(tail + 16, prev);
+	putLE32(tail + 20, merged);
+	putLE32(tail + 24, branch);
+	putLE32(tail + 28, (prevGeneration > mergedGeneration ? prevGeneration : mergedGeneration) + 1);
+	memcpy(tail + COMMIT_GRAPH_RECORD_SIZE, __graph + __graphLen - namesLen, namesLen);
+	if (newNamesLen != namesLen)
+		strcpy((String)tail + COMMIT_GRAPH_RECORD_SIZE + namesLen, commit->branch);
+
+	// The header is updated last; an interrupted update leaves an invalid graph, which is rebuilt
+	uchar header[COMMIT_GRAPH_HEADER_SIZE];
+	memcpy(header, __graph, COMMIT_GRAPH_HEADER_SIZE);
+	putLE32(header + 8, __graphCount + 1);
+	putLE32(header + 12, branchCount);
+	putLE64(header + 16, newNamesLen);
+	long offset = COMMIT_GRAPH_HEADER_SIZE + (long)__graphCount * COMMIT_GRAPH_RECORD_SIZE;
+	closeCommitGraph();
+
+	char path[PATH_MAX];
+	bool ok = false;
+	with(graphFile, fopen(__get_graph_path(path), "rb+"), fclose(graphFile))
+	{
+		ok = fseek(graphFile, offset, SEEK_SET) == 0 && fwrite(tail, 1, COMMIT_GRAPH_RECORD_SIZE + newNamesLen, graphFile) == COMMIT_GRAPH_RECORD_SIZE + newNamesLen;
+		ok = ok && fflush(graphFile) == 0 && fseek(graphFile, 0, SEEK_SET) == 0;
+		ok = ok && fwrite(header, 1, COMMIT_GRAPH_HEADER_SIZE, graphFile) == COMMIT_GRAPH_HEADER_SIZE;
+	}
+	free(tail);
+	return ok ? ERR_NOERR : ERR_FILE_ERROR;
+}
+
+void closeCommitGraph()
+{
+	unmapFile(__graph, __graphLen);
+	free(__graphBranches);
+	indexMapFree(&__graphTable);
+	__graph = NULL;
+	__graphLen = 0;
+	__graphCount = 0;
+	__graphBranches = NULL;
+	__graphBranchCount = 0;
+	__graphLoaded = false;
+}
@@ -0,0 +1,380 @@
+/*******************************
+ *      compress_funcs.c       *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "compress_funcs.h"
+
+#define LZ_MIN_MATCH 4				// Shortest match which is encoded
+#define LZ_LAST_LITERALS 5			// The last bytes of a block are always literals
+#define LZ_MF_LIMIT 12				// No match may start in the last 12 bytes of a block
+#define LZ_MAX_OFFSET 65535			// Back references are 16 bits
+#define LZ_HASH_LOG 14				// Size of the match finder hash table (log2)
+#define LZ_SKIP_TRIGGER 6			// Speed up the search in incompressible regions
+
+// Read 4 bytes of the input as a number (for comparing and hashing)
+static inline uint32_t __read32(const uchar *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Hash of 4 bytes for the match finder table
+static inline uint32_t __lz_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Write a length which does not fit in a token nibble (255-byte chain)
+static inline uchar *__lz_write_length(uchar *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*(op++) = 255;
+	*(op++) = (uchar)len;
+	return op;
+}
+
+size_t lzCompress(const uchar *src, size_t srcLen, uchar *dst, size_t dstCap)
+{
+	uint32_t table[1 << LZ_HASH_LOG];
+	memset(table, 0, sizeof(table));
+
+	const uchar *ip = src, *anchor = src;
+	const uchar *end = src + srcLen;
+	uchar *op = dst, *opEnd = dst + dstCap;
+
+	if (srcLen > LZ_MF_LIMIT)
+	{
+		const uchar *mfLimit = end - LZ_MF_LIMIT;
+		const uchar *matchLimit = end - LZ_LAST_LITERALS;
+		uint searchCount = 1 << LZ_SKIP_TRIGGER;
+
+		while (ip < mfLimit)
+		{
+			// Find a candidate with the same first 4 bytes
+			uint32_t sequence = __read32(ip);
+			uint32_t h = __lz_hash(sequence);
+			const uchar *ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+
+			if (ref >= ip || ip - ref > LZ_MAX_OFFSET || __read32(ref) != sequence)
+			{
+				ip += (searchCount++ >> LZ_SKIP_TRIGGER);
+				continue;
+			}
+			searchCount = 1 << LZ_SKIP_TRIGGER;
+
+			// Extend the match backwards over pending literals, then forwards
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+				ip--, ref--;
+			const uchar *matchEnd = ip + LZ_MIN_MATCH, *refEnd = ref + LZ_MIN_MATCH;
+			while (matchEnd < matchLimit && *matchEnd == *refEnd)
+				matchEnd++, refEnd++;
+
+			size_t litLen = ip - anchor, matchLen = matchEnd - ip - LZ_MIN_MATCH;
+			if ((size_t)(opEnd - op) < 1 + litLen + litLen / 255 + 1 + 2 + matchLen / 255 + 1 + LZ_LAST_LITERALS)
+				return 0; // Output does not fit
+
+			// Token + literals
+			uchar *token = op++;
+			*token = (uchar)((litLen >= 15 ? 15 : litLen) << 4);
+			if (litLen >= 15)
+				op = __lz_write_length(op, litLen - 15);
+			memcpy(op, anchor, litLen);
+			op += litLen;
+
+			// Offset + match length
+			size_t offset = ip - ref;
+			*(op++) = (uchar)(offset & 0xFF);
+			*(op++) = (uchar)(offset >> 8);
+			*token |= (uchar)(matchLen >= 15 ? 15 : matchLen);
+			if (matchLen >= 15)
+				op = __lz_write_length(op, matchLen - 15);
+
+			ip = anchor = matchEnd;
+		}
+	}
+
+	// Last literals
+	size_t litLen = end - anchor;
+	if ((size_t)(opEnd - op) < 1 + litLen + litLen / 255 + 1)
+		return 0;
+	uchar *token = op++;
+	*token = (uchar)((litLen >= 15 ? 15 : litLen) << 4);
+	if (litLen >= 15)
+		op = __lz_write_length(op, litLen - 15);
+	memcpy(op, anchor, litLen);
+	op += litLen;
+
+	return op - dst;
+}
+
+long lzDecompress(const uchar *src, size_t srcLen, uchar *dst, size_t dstCap)
+{
+	const uchar *ip = src, *ipEnd = src + srcLen;
+	uchar *op = dst, *opEnd = dst + dstCap;
+
+	while (ip < ipEnd)
+	{
+		uint token = *(ip++);
+
+		// Literals
+		size_t litLen = token >> 4;
+		if (litLen == 15)
+		{
+			uint b;
+			do
+			{
+				if (ip >= ipEnd)
+					return -1;
+				litLen += (b = *(ip++));
+			} while (b == 255);
+		}
+		if (litLen > (size_t)(ipEnd - ip) || litLen > (size_t)(opEnd - op))
+			return -1;
+		memcpy(op, ip, litLen);
+		op += litLen;
+		ip += litLen;
+
+		// The last sequence has no match
+		if (ip == ipEnd)
+			break;
+
+		// Match
+		if (ipEnd - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+
+		size_t matchLen = token & 0xF;
+		if (matchLen == 15)
+		{
+			uint b;
+			do
+			{
+				if (ip >= ipEnd)
+					return -1;
+				matchLen += (b = *(ip++));
+			} while (b == 255);
+		}
+		matchLen += LZ_MIN_MATCH;
+		if (matchLen > (size_t)(opEnd - op))
+			return -1;
+
+		// The match may overlap with the output being written
+		const uchar *match = op - offset;
+		if (offset >= matchLen)
+			memcpy(op, match, matchLen);
+		else
+			for (size_t i = 0; i < matchLen; i++)
+				op[i] = match[i];
+		op += matchLen;
+	}
+
+	return op - dst;
+}
+
+// Delta instructions : varint(len << 1 | isCopy) [, varint(offset) for copies] [, literal bytes for inserts]
+#define DELTA_OP_INSERT 0
+#define DELTA_OP_COPY 1
+
+// Hash of a DELTA_BLOCK_SIZE-byte block for the delta index
+static inline uint32_t __delta_hash(const uchar *p, uint bits)
+{
+	uint64_t a, b;
+	memcpy(&a, p, 8);
+	memcpy(&b, p + 8, 8);
+	return (uint32_t)(((a * 0x9E3779B97F4A7C15ULL) ^ (b * 0xC2B2AE3D27D4EB4FULL)) >> (64 - bits));
+}
+
+// Write an unsigned number in 7-bit groups (returns NULL if it does not fit)
+static inline uchar *__write_varint(uchar *op, uchar *opEnd, uint64_t value)
+{
+	do
+	{
+		if (op >= opEnd)
+			return NULL;
+		*(op++) = (uchar)((value & 0x7F) | (value >= 0x80 ? 0x80 : 0));
+		value >>= 7;
+	} while (value);
+	return op;
+}
+
+// Read an unsigned number written by __write_varint (returns NULL if the input is corrupted)
+static inline const uchar *__read_varint(const uchar *ip, const uchar *ipEnd, uint64_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (ip >= ipEnd)
+			return NULL;
+		uchar b = *(ip++);
+		*value |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return ip;
+	}
+	return NULL;
+}
+
+// Emit an insert instruction for target[from, to)
+static inline uchar *__delta_insert(uchar *op, uchar *opEnd, const uchar *from, const uchar *to)
+{
+	size_t len = to - from;
+	if (!len || !op)
+		return op;
+	if (!(op = __write_varint(op, opEnd, (uint64_t)len << 1 | DELTA_OP_INSERT)) || (size_t)(opEnd - op) < len)
+		return NULL;
+	memcpy(op, from, len);
+	return op + len;
+}
+
+size_t deltaEncode(const uchar *base, size_t baseLen, const uchar *target, size_t targetLen, uchar *dst, size_t dstCap)
+{
+	uchar *op = dst, *opEnd = dst + dstCap;
+	const uchar *ip = target, *anchor = target, *end = target + targetLen;
+
+	if (baseLen >= DELTA_BLOCK_SIZE && targetLen >= DELTA_BLOCK_SIZE)
+	{
+		// Index the base blocks (table entries are offset + 1, 0 means empty)
+		uint bits = 10;
+		while (bits < 26 && ((size_t)1 << bits) < baseLen / DELTA_BLOCK_SIZE * 2)
+			bits++;
+		uint32_t *table = calloc((size_t)1 << bits, sizeof(uint32_t));
+		if (!table)
+			return 0;
+		for (size_t i = 0; i + DELTA_BLOCK_SIZE <= baseLen; i += DELTA_BLOCK_SIZE)
+			table[__delta_hash(base + i, bits)] = i + 1;
+
+		while (op && ip + DELTA_BLOCK_SIZE <= end)
+		{
+			uint32_t entry = table[__delta_hash(ip, bits)];
+			const uchar *ref = base + entry - 1;
+			if (!entry || memcmp(ref, ip, DELTA_BLOCK_SIZE) != 0)
+			{
+				ip++;
+				continue;
+			}
+
+			// Extend the common region backwards over pending literals, then forwards
+			const uchar *matchEnd = ip + DELTA_BLOCK_SIZE, *refEnd = ref + DELTA_BLOCK_SIZE;
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+				ip--, ref--;
+			while (matchEnd < end && refEnd < base + baseLen && *matchEnd == *refEnd)
+				matchEnd++, refEnd++;
+
+			op = __delta_insert(op, opEnd, anchor, ip);
+			if (op && (op = __write_varint(op, opEnd, (uint64_t)(matchEnd - ip) << 1 | DELTA_OP_COPY)))
+				op = __write_varint(op, opEnd, ref - base);
+			ip = anchor = matchEnd;
+		}
+		free(table);
+	}
+
+	op = __delta_insert(op, opEnd, anchor, end);
+	return op ? op - dst : 0;
+}
+
+long deltaDecode(const uchar *base, size_t baseLen, const uchar *delta, size_t deltaLen, uchar *dst, size_t dstCap)
+{
+	const uchar *ip = delta, *ipEnd = delta + deltaLen;
+	uchar *op = dst;
+	size_t remaining = dstCap;
+
+	while (ip < ipEnd)
+	{
+		uint64_t instruction, offset;
+		if (!(ip = __read_varint(ip, ipEnd, &instruction)))
+			return -1;
+		uint64_t len = instruction >> 1;
+		if (len == 0 || len > remaining)
+			return -1;
+
+		if ((instruction & 1) == DELTA_OP_COPY)
+		{
+			if (!(ip = __read_varint(ip, ipEnd, &offset)) || offset > baseLen || len > baseLen - offset)
+				return -1;
+			memcpy(op, base + offset, len);
+		}
+		else
+		{
+			if (len > (uint64_t)(ipEnd - ip))
+				return -1;
+			memcpy(op, ip, len);
+			ip += len;
+		}
+		op += len;
+		remaining -= len;
+	}
+
+	return op - dst;
+}
+
+// Masks of content-defined chunking: more bits (harder cut) before the average size, fewer bits after it
+#define CDC_MASK_SMALL (((1ULL << 18) - 1) << 46)
+#define CDC_MASK_LARGE (((1ULL << 14) - 1) << 50)
+
+// Random number of a byte for the gear hash (splitmix64, so the table is the same on every machine)
+static inline uint64_t __cdc_gear(uint64_t x)
+{
+	x = (x + 1) * 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+size_t cdcChunkLength(const uchar *data, size_t len)
+{
+	if (len <= CDC_MIN_SIZE)
+		return len;
+	size_t normal = len < CDC_AVG_SIZE ? len : CDC_AVG_SIZE;
+	size_t end = len < CDC_MAX_SIZE ? len : CDC_MAX_SIZE;
+
+	// The table is cheap compared to a chunk, and keeps this function free of shared state
+	uint64_t gear[256];
+	for (int i = 0; i < 256; i++)
+		gear[i] = __cdc_gear(i);
+
+	// The first CDC_MIN_SIZE bytes are never a cut point, so they are not hashed
+	uint64_t hash = 0;
+	size_t i = CDC_MIN_SIZE;
+	for (; i < normal; i++)
+		if (!((hash = (hash << 1) + gear[data[i]]) & CDC_MASK_SMALL))
+			return i + 1;
+	for (; i < end; i++)
+		if (!((hash = (hash << 1) + gear[data[i]]) & CDC_MASK_LARGE))
+			return i + 1;
+	return end;
+}
+
+void putLE32(uchar *dest, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		dest[i] = (uchar)(value >> (i * 8));
+}
+
+void putLE64(uchar *dest, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		dest[i] = (uchar)(value >> (i * 8));
+}
+
+uint32_t getLE32(const uchar *src)
+{
+	uint32_t value = 0;
+	for (int i = 3; i >= 0; i--)
+		value = (value << 8) | src[i];
+	return value;
+}
+
+uint64_t getLE64(const uchar *src)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--)
+		value = (value << 8) | src[i];
+	return value;
+}
@@ -5,7 +5,12 @@
  *         402106434           *
  *     FOP Project NeoGIT      *
  ********************************/
+#define _GNU_SOURCE // For copy_file_range
 #include "file_funcs.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
 
 /////////////////// Functions related to the file contents ////////////////
 
@@ -27,6 +32,64 @@ bool isFilesSame(constString path1, constString path2)
 	return false;
 }
 
+Diff getDiffStreams(FILE *baseFile, FILE *changedFile, int f1begin, int f1end, int f2begin, int f2end)
+{
+	Diff diff = {NULL, NULL, 0, NULL, NULL, 0};
+
+	char line1[STR_LINE_MAX], line2[STR_LINE_MAX];
+	uint line1_cnt = f1begin - 1, line2_cnt = f2begin - 1;
+	SEEK_TO_LINE(baseFile, f1begin);
+	SEEK_TO_LINE(changedFile, f2begin);
+	char *file1ReadResult = NULL;
+
+	// Compare lines between the specified ranges
+	while ((file1ReadResult = SCAN_LINE_BOUNDED(baseFile, line1, line1_cnt, f1end)) && SCAN_LINE_BOUNDED(changedFile, line2, line2_cnt, f2end))
+	{
+		// If lines are the same, continue to the next iteration
+		if (strcmp(line1, line2) == 0) // if same, continue
+			continue;
+
+		// If lines are different, record them in the diff structure
+		else
+		{
+			ADD_EMPTY(diff.linesRemoved, diff.removedCount, String);
+			diff.removedCount--;
+			ADD_EMPTY(diff.lineNumberRemoved, diff.removedCount, uint);
+			diff.linesRemoved[diff.removedCount - 1] = strDup(line1);
+			diff.lineNumberRemoved[diff.removedCount - 1] = line1_cnt;
+			///////////////
+			ADD_EMPTY(diff.linesAdded, diff.addedCount, String);
+			diff.addedCount--;
+			ADD_EMPTY(diff.lineNumberAdded, diff.addedCount, uint);
+			diff.linesAdded[diff.addedCount - 1] = strDup(line2);
+			diff.lineNumberAdded[diff.addedCount - 1] = line2_cnt;
+		}
+	}
+
+	// Record any remaining lines in the base file
+	while (file1ReadResult || (file1ReadResult = SCAN_LINE_BOUNDED(baseFile, line1, line1_cnt, f1end)))
+	{
+		ADD_EMPTY(diff.linesRemoved, diff.removedCount, String);
+		diff.removedCount--;
+		ADD_EMPTY(diff.lineNumberRemoved, diff.removedCount, uint);
+		diff.linesRemoved[diff.removedCount - 1] = strDup(line1);
+		diff.lineNumberRemoved[diff.removedCount - 1] = line1_cnt;
+		file1ReadResult = NULL;
+	}
+
+	// Record any remaining lines in the changed file
+	while (SCAN_LINE_BOUNDED(changedFile, line2, line2_cnt, f2end))
+	{
+		ADD_EMPTY(diff.linesAdded, diff.addedCount, String);
+		diff.addedCount--;
+		ADD_EMPTY(diff.lineNumberAdded, diff.addedCount, uint);
+		diff.linesAdded[diff.addedCount - 1] = strDup(line2);
+		diff.lineNumberAdded[diff.addedCount - 1] = line2_cnt;
+	}
+
+	return diff;
+}
+
 Diff getDiff(constString baseFilePath, constString changedFilePath, int f1begin, int f1end, int f2begin, int f2end)
 {
 	Diff diff = {NULL, NULL, 0, NULL, NULL, 0};
@@ -36,58 +99,7 @@ Diff getDiff(constString baseFilePath, constString changedFilePath, int f1begin,
 	{
 		// Attempt to open the changed file
 		tryWithFile(changedFile, changedFilePath, throw(0), throw(0))
-		{
-			char line1[STR_LINE_MAX], line2[STR_LINE_MAX];
-			uint line1_cnt = f1begin - 1, line2_cnt = f2begin - 1;
-			SEEK_TO_LINE(baseFile, f1begin);
-			SEEK_TO_LINE(changedFile, f2begin);
-			char *file1ReadResult = NULL;
-
-			// Compare lines between the specified ranges
-			while ((file1ReadResult = SCAN_LINE_BOUNDED(baseFile, line1, line1_cnt, f1end)) && SCAN_LINE_BOUNDED(changedFile, line2, line2_cnt, f2end))
-			{
-				// If lines are the same, continue to the next iteration
-				if (strcmp(line1, line2) == 0) // if same, continue
-					continue;
-
-				// If lines are different, record them in the diff structure
-				else
-				{
-					ADD_EMPTY(diff.linesRemoved, diff.removedCount, String);
-					diff.removedCount--;
-					ADD_EMPTY(diff.lineNumberRemoved, diff.removedCount, uint);
-					diff.linesRemoved[diff.removedCount - 1] = strDup(line1);
-					diff.lineNumberRemoved[diff.removedCount - 1] = line1_cnt;
-					///////////////
-					ADD_EMPTY(diff.linesAdded, diff.addedCount, String);
-					diff.addedCount--;
-					ADD_EMPTY(diff.lineNumberAdded, diff.addedCount, uint);
-					diff.linesAdded[diff.addedCount - 1] = strDup(line2);
-					diff.lineNumberAdded[diff.addedCount - 1] = line2_cnt;
-				}
-			}
-
-			// Record any remaining lines in the base file
-			while (file1ReadResult || (file1ReadResult = SCAN_LINE_BOUNDED(baseFile, line1, line1_cnt, f1end)))
-			{
-				ADD_EMPTY(diff.linesRemoved, diff.removedCount, String);
-				diff.removedCount--;
-				ADD_EMPTY(diff.lineNumberRemoved, diff.removedCount, uint);
-				diff.linesRemoved[diff.removedCount - 1] = strDup(line1);
-				diff.lineNumberRemoved[diff.removedCount - 1] = line1_cnt;
-				file1ReadResult = NULL;
-			}
-
-			// Record any remaining lines in the changed file
-			while (SCAN_LINE_BOUNDED(changedFile, line2, line2_cnt, f2end))
-			{
-				ADD_EMPTY(diff.linesAdded, diff.addedCount, String);
-				diff.addedCount--;
-				ADD_EMPTY(diff.lineNumberAdded, diff.addedCount, uint);
-				diff.linesAdded[diff.addedCount - 1] = strDup(line2);
-				diff.lineNumberAdded[diff.addedCount - 1] = line2_cnt;
-			}
-		}
+			diff = getDiffStreams(baseFile, changedFile, f1begin, f1end, f2begin, f2end);
 	}
 
 	return diff;
@@ -237,6 +249,212 @@ int insertLine(FILE *file, int lineNumber, constString newContent)
 		return ERR_NOERR;
 }
 
+const uchar *mapFile(constString path, size_t *lenDest)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping remains valid
+	if (map == MAP_FAILED)
+		return NULL;
+	*lenDest = st.st_size;
+	return map;
+}
+
+void unmapFile(const uchar *map, size_t len)
+{
+	if (map)
+		munmap((void *)map, len);
+}
+
+bool openTokenizer(Tokenizer *tokenizer, constString path)
+{
+	*tokenizer = (Tokenizer){NULL, 0, 0, false};
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok && st.st_size > 0)
+	{
+		// Mapping a small file costs more than reading it (page faults and unmapping)
+		if (st.st_size <= TOKENIZER_READ_MAX)
+		{
+			uchar *buf = malloc(st.st_size);
+			ssize_t n = 0, len = 0;
+			while (buf && len < st.st_size && (n = read(fd, buf + len, st.st_size - len)) > 0)
+				len += n;
+			if (buf && n >= 0)
+			{
+				tokenizer->map = buf;
+				tokenizer->len = len;
+				tokenizer->owned = true;
+			}
+			else
+				free(buf);
+		}
+		else
+		{
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				tokenizer->map = map;
+				tokenizer->len = st.st_size;
+			}
+		}
+		ok = tokenizer->map != NULL;
+	}
+	close(fd); // The mapping remains valid
+	return ok;
+}
+
+bool nextLine(Tokenizer *tokenizer, StrView *line)
+{
+	if (tokenizer->pos >= tokenizer->len)
+		return false;
+	constString start = (constString)tokenizer->map + tokenizer->pos;
+	constString end = memchr(start, '\n', tokenizer->len - tokenizer->pos);
+	size_t len = end ? (size_t)(end - start) : tokenizer->len - tokenizer->pos;
+	tokenizer->pos += len + (end != NULL);
+	if (len && start[len - 1] == '\r') // files edited on Windows
+		len--;
+	*line = (StrView){start, len};
+	return true;
+}
+
+void closeTokenizer(Tokenizer *tokenizer)
+{
+	if (tokenizer->owned)
+		free((void *)tokenizer->map);
+	else
+		unmapFile(tokenizer->map, tokenizer->len);
+	*tokenizer = (Tokenizer){NULL, 0, 0, false};
+}
+
+int makeDirs(constString path)
+{
+	char dir[PATH_MAX];
+	strcpy(dir, path);
+
+	// Create each missing component from the root
+	for (char *p = dir + 1; *p; p++)
+		if (*p == '/')
+		{
+			*p = '\0';
+			if (mkdir(dir, 0775) != 0 && errno != EEXIST)
+				return ERR_FILE_ERROR;
+			*p = '/';
+		}
+	if (mkdir(dir, 0775) != 0 && errno != EEXIST)
+		return ERR_FILE_ERROR;
+	return ERR_NOERR;
+}
+
+int ensureFile(constString path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		return ERR_FILE_ERROR;
+	close(fd);
+	return ERR_NOERR;
+}
+
+int removeTree(constString path)
+{
+	struct stat st;
+	if (lstat(path, &st) != 0)
+		return errno == ENOENT ? ERR_NOERR : ERR_FILE_ERROR;
+	if (!S_ISDIR(st.st_mode))
+		return unlink(path) == 0 ? ERR_NOERR : ERR_FILE_ERROR;
+
+	int error = ERR_NOERR;
+	tryWith(DIR *, dir, opendir(path), ({ return ERR_FILE_ERROR; }), {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			char childPath[PATH_MAX];
+			if (removeTree(strcat_s(childPath, path, "/", entry->d_name)) != ERR_NOERR)
+				error = ERR_FILE_ERROR;
+		}
+	}
+	if (rmdir(path) != 0)
+		error = ERR_FILE_ERROR;
+	return error;
+}
+
+int atomicReplace(constString path, const void *data, size_t len)
+{
+	char tmpPath[PATH_MAX];
+	strcat_s(tmpPath, path, ".tmp");
+	bool ok = false;
+	with(file, fopen(tmpPath, "wb"), fclose(file))
+		ok = fwrite(data, 1, len, file) == len && fflush(file) == 0;
+	if (!ok || rename(tmpPath, path) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
+	}
+	return ERR_NOERR;
+}
+
+// Copy the whole content between two file descriptors with the fastest available method
+static int __copy_fd(int srcFd, int destFd, off_t size, constString *methodDest)
+{
+	off_t remaining = size;
+
+	// In-kernel copy (may share extents on file systems like btrfs/XFS)
+	*methodDest = "copy_file_range";
+	while (remaining > 0)
+	{
+		ssize_t n = copy_file_range(srcFd, NULL, destFd, NULL, remaining, 0);
+		if (n <= 0)
+			break;
+		remaining -= n;
+	}
+
+	// In-kernel copy through the page cache
+	if (remaining > 0)
+	{
+		*methodDest = "sendfile";
+		while (remaining > 0)
+		{
+			ssize_t n = sendfile(destFd, srcFd, NULL, remaining);
+			if (n <= 0)
+				break;
+			remaining -= n;
+		}
+	}
+
+	// Plain read/write with a large buffer (continues from the current offsets)
+	if (remaining > 0 || size == 0)
+	{
+		if (remaining > 0)
+			*methodDest = "read/write";
+		char *buf = malloc(COPY_BUF_SIZE);
+		if (!buf)
+			return ERR_MALLOC;
+		ssize_t n;
+		while ((n = read(srcFd, buf, COPY_BUF_SIZE)) > 0)
+			for (ssize_t written = 0, w; written < n; written += w)
+				if ((w = write(destFd, buf + written, n - written)) <= 0)
+				{
+					free(buf);
+					return ERR_FILE_ERROR;
+				}
+		free(buf);
+		if (n < 0)
+			return ERR_FILE_ERROR;
+	}
+	return ERR_NOERR;
+}
+
 int copyFile(constString _src, constString _dest, constString repo)
 {
 	// Construct full source and destination paths.
@@ -252,37 +470,45 @@ int copyFile(constString _src, constString _dest, constString repo)
 		strcpy(dest, _dest);
 	}
 
-	// Ensure the destination directory exists.
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	int srcFd = open(src, O_RDONLY);
+	struct stat st;
+	if (srcFd < 0 || fstat(srcFd, &st) != 0)
+	{
+		if (srcFd >= 0)
+			close(srcFd);
+		return ERR_FILE_ERROR;
+	}
+
+	// Ensure the destination directory exists, and replace the destination file (a new file, like touch)
 	char dir[PATH_MAX];
-	systemf("mkdir -p \"%s\"", getParentName(dir, dest));
+	if (access(getParentName(dir, dest), F_OK) != 0)
+		makeDirs(dir);
+	unlink(dest);
+	int destFd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (destFd < 0)
+	{
+		close(srcFd);
+		return ERR_FILE_ERROR;
+	}
+
+	constString method = "";
+	int error = __copy_fd(srcFd, destFd, st.st_size, &method);
+	close(srcFd);
+	if (close(destFd) != 0)
+		error = ERR_FILE_ERROR;
 
-	// Remove existing destination file, create an empty file, and open both source and destination files.
-	systemf("rm \"%s\" >/dev/null 2>/dev/null", dest);
-	systemf("touch \"%s\"", dest);
-	tryWithFile(srcFile, src, ({ return ERR_FILE_ERROR; }), __retTry)
+	// Report the throughput (NEOGIT_TRACE=1)
+	if (getenv(TRACE_ENV))
 	{
-		tryWithFile(destFile, dest, throw(ERR_FILE_ERROR), throw(_ERR))
-		{
-			// Copy file contents in 512-byte chunks.
-			size_t size = GET_FILE_SIZE(srcFile);
-			for (long i = 0; i < size / 512; i++)
-			{
-				char sectorBuf[512];
-				fread(sectorBuf, 1, 512, srcFile);
-				fwrite(sectorBuf, 1, 512, destFile);
-			}
-			// Copy remaining bytes.
-			for (long i = 0; i < size % 512; i++)
-			{
-				char buf;
-				fread(&buf, 1, 1, srcFile);
-				fwrite(&buf, 1, 1, destFile);
-			}
-			// Check for errors during file copying.
-			throw(ferror(srcFile) || ferror(destFile));
-		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+		fprintf(stderr, "[trace] copyFile (%s) \"%s\" -> \"%s\" : %lld bytes in %.6f s (%.1f MB/s)\n", method, src, dest,
+				(long long)st.st_size, seconds, seconds > 0 ? st.st_size / seconds / 1e6 : 0.0);
 	}
-	return ERR_NOERR;
+	return error;
 }
 
 /////////////////// Functions related to the file entries and paths ////////////////
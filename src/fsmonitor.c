@@ -0,0 +1,605 @@
+/*******************************
+ *        fsmonitor.c          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "fsmonitor.h"
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+
+extern Repository *curRepository; // Declared in neogit.c
+
+#define __FSMONITOR_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+							IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static bool __get_socket_address(struct sockaddr_un *dest)
+{
+	char path[PATH_MAX];
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/" FSMONITOR_SOCKET_FILE);
+	memset(dest, 0, sizeof(struct sockaddr_un));
+	dest->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(dest->sun_path)) // Too long for a unix socket
+		return false;
+	strcpy(dest->sun_path, path);
+	return true;
+}
+
+// Directories which are not watched (.neogit folder, and ignored directories)
+static bool __is_skipped_dir(constString parentPath, constString name)
+{
+	return (!*parentPath && !strcmp(name, "." PROGRAM_NAME)) || isMatch(name, ".git");
+}
+
+static String __join_path(String dest, constString dirPath, constString name)
+{
+	return *dirPath ? strcat_s(dest, dirPath, "/", name) : strcpy(dest, name);
+}
+
+/////////////////////////////////////// DAEMON ///////////////////////////////////////
+
+// A path which is changed in the working tree, with the sequence number of its last change
+typedef struct _fsmonitor_path_t
+{
+	String path;
+	uint64_t seq;
+} FsmonitorPath;
+
+static int __inotifyFd = -1;
+static String *__watchPaths = NULL; // Directory of each watch descriptor (relative to the repository; "" for the root)
+static uint __watchCap = 0, __watchCount = 0;
+static FsmonitorPath *__paths = NULL;
+static uint __pathCount = 0, __pathCap = 0;
+static uint64_t __seq = 1;		 // Sequence number of the next token (changes are recorded with it)
+static uint64_t __resetSeq = 0;	 // Tokens before it are not valid (events are lost)
+static bool __overflowed = false; // A directory could not be watched; every query needs a full scan
+static char __daemonId[48] = "";
+
+static const void *__path_key(const void *ctx, uint index)
+{
+	return __paths[index].path;
+}
+
+static IndexMap __pathTable = {NULL, 0, 0, __path_key, NULL, 0}; // Index of __paths by path
+
+// Record a change of a path
+static void __mark_path(constString path)
+{
+	long index = indexMapFind(&__pathTable, path);
+	if (index < 0)
+	{
+		if (__pathCount == __pathCap)
+		{
+			uint newCap = __pathCap ? __pathCap * 2 : 256;
+			FsmonitorPath *paths = realloc(__paths, newCap * sizeof(FsmonitorPath));
+			if (!paths)
+			{
+				__overflowed = true;
+				return;
+			}
+			__paths = paths;
+			__pathCap = newCap;
+		}
+		if (!(__paths[__pathCount].path = strDup(path)) || !indexMapAdd(&__pathTable, __pathCount))
+		{
+			free(__paths[__pathCount].path);
+			__overflowed = true;
+			return;
+		}
+		index = __pathCount++;
+	}
+	__paths[index].seq = __seq;
+}
+
+// Watch a directory (relative to the repository) and its subdirectories, and record their entries if they are new
+static void __watch_directory(constString dirPath, bool markEntries)
+{
+	char absPath[PATH_MAX];
+	strcat_s(absPath, curRepository->absPath, *dirPath ? "/" : "", dirPath);
+	int wd = inotify_add_watch(__inotifyFd, absPath, __FSMONITOR_EVENTS);
+	if (wd < 0)
+	{
+		__overflowed |= errno == ENOSPC || errno == ENOMEM; // Out of watches (It is fine if the directory is removed)
+		return;
+	}
+	if (wd >= __watchCap)
+	{
+		uint newCap = __watchCap ? __watchCap : 64;
+		while (newCap <= wd)
+			newCap *= 2;
+		String *watchPaths = realloc(__watchPaths, newCap * sizeof(String));
+		if (!watchPaths)
+		{
+			__overflowed = true;
+			return;
+		}
+		memset(watchPaths + __watchCap, 0, (newCap - __watchCap) * sizeof(String));
+		__watchPaths = watchPaths;
+		__watchCap = newCap;
+	}
+	if (!__watchPaths[wd])
+		__watchCount++;
+	free(__watchPaths[wd]);
+	__watchPaths[wd] = strDup(dirPath);
+
+	tryWith(DIR *, dir, opendir(absPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			char childPath[PATH_MAX], childAbsPath[PATH_MAX];
+			struct stat st;
+			bool isDir = entry->d_type == DT_DIR ||
+						 (entry->d_type == DT_UNKNOWN && stat(strcat_s(childAbsPath, absPath, "/", entry->d_name), &st) == 0 && S_ISDIR(st.st_mode));
+			if (isDir && __is_skipped_dir(dirPath, entry->d_name))
+				continue;
+			__join_path(childPath, dirPath, entry->d_name);
+			if (markEntries)
+				__mark_path(childPath);
+			if (isDir)
+				__watch_directory(childPath, markEntries);
+		}
+	}
+}
+
+// Stop watching a directory (relative to the repository) and its subdirectories (It is moved out of its place)
+static void __unwatch_directory(constString dirPath)
+{
+	size_t len = strlen(dirPath);
+	for (uint wd = 0; wd < __watchCap; wd++)
+		if (__watchPaths[wd] && !strncmp(__watchPaths[wd], dirPath, len) && (!__watchPaths[wd][len] || __watchPaths[wd][len] == '/'))
+		{
+			inotify_rm_watch(__inotifyFd, wd);
+			free(__watchPaths[wd]);
+			__watchPaths[wd] = NULL;
+			__watchCount--;
+		}
+}
+
+// Read all pending events (Returns false if the working tree is removed or moved)
+static bool __process_events()
+{
+	char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(__inotifyFd, buf, sizeof(buf))) > 0)
+	{
+		for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+		{
+			const struct inotify_event *event = (const struct inotify_event *)ptr;
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				__resetSeq = __seq; // Changes are lost; the tokens which are given before are not valid
+				continue;
+			}
+			constString dirPath = event->wd >= 0 && event->wd < __watchCap ? __watchPaths[event->wd] : NULL;
+			if (!dirPath)
+				continue;
+			if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+			{
+				if (!*dirPath)
+					return false; // The root
+				if (event->mask & IN_IGNORED)
+				{
+					free(__watchPaths[event->wd]);
+					__watchPaths[event->wd] = NULL;
+					__watchCount--;
+				}
+				continue;
+			}
+			if (!event->len)
+				continue;
+
+			// Changes of the entries of directories (but not their own attributes) are recorded
+			bool isDir = event->mask & IN_ISDIR;
+			if (isDir && (__is_skipped_dir(dirPath, event->name) || !(event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))))
+				continue;
+			char path[PATH_MAX];
+			__mark_path(__join_path(path, dirPath, event->name));
+			if (isDir && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+				__watch_directory(path, true); // Its entries may be created before it is watched
+			else if (isDir && (event->mask & IN_MOVED_FROM))
+				__unwatch_directory(path);
+		}
+	}
+	return true;
+}
+
+// Answer a request of a client (Returns false if the daemon must stop)
+static bool __answer_request(int clientFd)
+{
+	struct timeval timeout = {FSMONITOR_TIMEOUT_MS / 1000, FSMONITOR_TIMEOUT_MS % 1000 * 1000};
+	setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	char request[128];
+	size_t len = 0;
+	ssize_t n;
+	while (len < sizeof(request) - 1 && (n = read(clientFd, request + len, sizeof(request) - 1 - len)) > 0)
+		if (memchr(request + (len += n) - n, '\n', n))
+			break;
+	request[len] = '\0';
+
+	bool keepRunning = true;
+	FILE *reply = fdopen(clientFd, "w");
+	if (!reply)
+	{
+		close(clientFd);
+		return true;
+	}
+	if (!strncmp(request, "query ", 6))
+	{
+		// The changes which are already done are read first
+		keepRunning = __process_events();
+		char id[sizeof(__daemonId)] = "";
+		uint64_t since = 0;
+		bool full = __overflowed || sscanf(request + 6, "%47[^:]:%lu", id, &since) != 2 || strcmp(id, __daemonId) ||
+					since < __resetSeq || since >= __seq;
+		fprintf(reply, "%s %s:%lu\n", full ? "full" : "ok", __daemonId, __seq);
+		for (uint i = 0; !full && i < __pathCount; i++)
+			if (__paths[i].seq > since)
+				fprintf(reply, "%s\n", __paths[i].path);
+		__seq++;
+	}
+	else if (!strcmp(request, "status\n"))
+		fprintf(reply, "ok %s:%lu %u %u%s\n", __daemonId, __seq, __watchCount, __pathCount, __overflowed ? " overflowed" : "");
+	else if (!strcmp(request, "stop\n"))
+	{
+		fprintf(reply, "ok\n");
+		keepRunning = false;
+	}
+	fclose(reply);
+	return keepRunning;
+}
+
+// Main loop of the daemon
+static void __run_daemon(int listenFd)
+{
+	struct pollfd fds[2] = {{.fd = __inotifyFd, .events = POLLIN}, {.fd = listenFd, .events = POLLIN}};
+	while (true)
+	{
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if ((fds[0].revents & POLLIN) && !__process_events())
+			break;
+		if (fds[1].revents & POLLIN)
+		{
+			int clientFd = accept(listenFd, NULL, NULL);
+			if (clientFd >= 0 && !__answer_request(clientFd))
+				break;
+		}
+	}
+}
+
+/////////////////////////////////////// CLIENT ///////////////////////////////////////
+
+// Send a request to the daemon (Returns its reply, or NULL if it is not running)
+static FILE *__fsmonitor_request(constString request)
+{
+	struct sockaddr_un address;
+	if (!curRepository || !__get_socket_address(&address))
+		return NULL;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	struct timeval timeout = {FSMONITOR_TIMEOUT_MS / 1000, FSMONITOR_TIMEOUT_MS % 1000 * 1000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	FILE *reply = NULL;
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || send(fd, request, strlen(request), MSG_NOSIGNAL) != strlen(request) ||
+		!(reply = fdopen(fd, "r")))
+		close(fd);
+	return reply;
+}
+
+int startFsmonitor(pid_t *pidDest, uint *dirCountDest)
+{
+	struct sockaddr_un address;
+	if (!__get_socket_address(&address))
+		return ERR_GENERAL;
+	FILE *reply = __fsmonitor_request("status\n");
+	if (reply)
+	{
+		fclose(reply);
+		return ERR_ALREADY_EXIST;
+	}
+
+	// The working tree is watched before the socket accepts requests
+	if ((__inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		return ERR_GENERAL;
+	__watch_directory("", false);
+	int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(address.sun_path); // A socket of a stopped daemon
+	if (!__watchCount || listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 16) != 0)
+	{
+		if (listenFd >= 0)
+			close(listenFd);
+		close(__inotifyFd);
+		return ERR_GENERAL;
+	}
+	*dirCountDest = __watchCount;
+
+	pid_t pid = fork();
+	if (pid != 0) // The command (or an error)
+	{
+		close(listenFd);
+		close(__inotifyFd);
+		if (pid < 0)
+		{
+			unlink(address.sun_path);
+			return ERR_GENERAL;
+		}
+		*pidDest = pid;
+		return ERR_NOERR;
+	}
+
+	// The daemon is detached from the terminal, and never returns to the command
+	setsid();
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, SIG_IGN);
+	int nullFd = open("/dev/null", O_RDWR);
+	if (nullFd >= 0)
+	{
+		dup2(nullFd, STDIN_FILENO);
+		dup2(nullFd, STDOUT_FILENO);
+		dup2(nullFd, STDERR_FILENO);
+		if (nullFd > STDERR_FILENO)
+			close(nullFd);
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	snprintf(__daemonId, sizeof(__daemonId), "%d.%ld%09ld", getpid(), (long)ts.tv_sec, ts.tv_nsec);
+	__run_daemon(listenFd);
+	unlink(address.sun_path);
+	_exit(0);
+}
+
+int stopFsmonitor()
+{
+	FILE *reply = __fsmonitor_request("stop\n");
+	if (!reply)
+		return ERR_NOT_EXIST;
+	char line[16] = "";
+	fgets(line, sizeof(line), reply);
+	fclose(reply);
+	return strncmp(line, "ok", 2) ? ERR_NOT_EXIST : ERR_NOERR;
+}
+
+int getFsmonitorStatus(uint *dirCountDest, uint *pathCountDest, bool *overflowedDest)
+{
+	FILE *reply = __fsmonitor_request("status\n");
+	if (!reply)
+		return ERR_NOT_EXIST;
+	char line[128] = "", flag[16] = "";
+	fgets(line, sizeof(line), reply);
+	fclose(reply);
+	if (sscanf(line, "ok %*s %u %u %15s", dirCountDest, pathCountDest, flag) < 2)
+		return ERR_NOT_EXIST;
+	*overflowedDest = !strcmp(flag, "overflowed");
+	return ERR_NOERR;
+}
+
+// Files which may be changed (The daemon is asked on the first call of getFsmonitorCandidates)
+static StringSet __candidateSet = {NULL, 0, 0};
+static String *__candidateList = NULL;
+static uint __candidateCount = 0;
+static bool __queried = false;
+static int __queryResult = -1;
+static char __token[64] = ""; // Token of the answer of the daemon ("" if it did not answer)
+
+static String __get_state_path(String dest)
+{
+	return strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/" FSMONITOR_STATE_FILE);
+}
+
+// Key of the state: HEAD, and the stat data of the staging index, its journal and the tracked files
+static String __get_state_key(String dest)
+{
+	constString files[] = {"stage/index", "stage/journal", "tracked"};
+	int len = sprintf(dest, "%lx", curRepository->head.hash);
+	for (uint i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		char path[PATH_MAX];
+		struct stat st;
+		if (stat(strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/", files[i]), &st) == 0)
+			len += sprintf(dest + len, " %lx.%lx.%lx.%lx", (uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec, (uint64_t)st.st_ino);
+		else
+			len += sprintf(dest + len, " -");
+	}
+	return dest;
+}
+
+static void __add_candidate(constString path)
+{
+	if (!__candidateSet.slots)
+		stringSetInit(&__candidateSet, 0);
+	if (!stringSetAdd(&__candidateSet, path))
+		return;
+	ADD_EMPTY(__candidateList, __candidateCount, String);
+	__candidateList[__candidateCount - 1] = strDup(path);
+}
+
+// Add the files of a directory (relative to the repository) and its subdirectories
+static void __add_candidate_directory(constString dirPath)
+{
+	char absPath[PATH_MAX];
+	strcat_s(absPath, curRepository->absPath, "/", dirPath);
+	tryWith(DIR *, dir, opendir(absPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			char childPath[PATH_MAX], childAbsPath[PATH_MAX];
+			struct stat st;
+			if (stat(strcat_s(childAbsPath, absPath, "/", entry->d_name), &st) != 0)
+				continue;
+			__join_path(childPath, dirPath, entry->d_name);
+			if (!S_ISDIR(st.st_mode))
+				__add_candidate(childPath);
+			else if (!__is_skipped_dir(dirPath, entry->d_name))
+				__add_candidate_directory(childPath);
+		}
+	}
+}
+
+// Add a changed path of the daemon (A directory, or a removed path which may have been a directory, adds its files)
+static void __add_changed_path(constString path, StringSet *changedDirs)
+{
+	char absPath[PATH_MAX];
+	struct stat st;
+	if (stat(strcat_s(absPath, curRepository->absPath, "/", path), &st) != 0)
+	{
+		__add_candidate(path);
+		stringSetAdd(changedDirs, path);
+	}
+	else if (S_ISDIR(st.st_mode))
+	{
+		stringSetAdd(changedDirs, path);
+		__add_candidate_directory(path);
+	}
+	else
+		__add_candidate(path);
+}
+
+// Check if a path (relative to the repository) is under one of the directories
+static bool __is_under_changed_dir(const StringSet *changedDirs, constString path)
+{
+	char dirPath[PATH_MAX];
+	strcpy(dirPath, path);
+	for (String slash = strrchr(dirPath, '/'); slash; slash = strrchr(dirPath, '/'))
+	{
+		*slash = '\0';
+		if (stringSetContains(changedDirs, dirPath))
+			return true;
+	}
+	return false;
+}
+
+// Ask the daemon for the changes since the state of the last status
+static int __query_candidates()
+{
+	char statePath[PATH_MAX], key[256], request[128] = "query -\n";
+	String line = NULL;
+	size_t lineCap = 0;
+	ssize_t len;
+
+	// The changed files of the last status (only if HEAD, the staging area and the tracked files are the same)
+	bool stateValid = false;
+	with(stateFile, fopen(__get_state_path(statePath), "r"), fclose(stateFile))
+	{
+		char token[64] = "";
+		if ((len = getline(&line, &lineCap, stateFile)) > 1 && len < sizeof(token))
+			strncpy(token, line, len - 1);
+		if (*token && (len = getline(&line, &lineCap, stateFile)) > 0 && line[len - 1] == '\n')
+		{
+			line[len - 1] = '\0';
+			stateValid = !strcmp(line, __get_state_key(key));
+		}
+		while (stateValid && (len = getline(&line, &lineCap, stateFile)) > 0)
+		{
+			if (line[len - 1] == '\n')
+				line[len - 1] = '\0';
+			if (*line)
+				__add_candidate(line);
+		}
+		if (stateValid)
+			strcat_s(request, "query ", token, "\n");
+	}
+
+	FILE *reply = __fsmonitor_request(request);
+	bool full = true;
+	if (reply)
+	{
+		char token[64] = "";
+		if ((len = getline(&line, &lineCap, reply)) > 0 && sscanf(line, "ok %63s", token) == 1)
+			full = false;
+		else if (len > 0)
+			sscanf(line, "full %63s", token);
+		strcpy(__token, token);
+
+		// The changed paths (and the files of changed directories)
+		StringSet changedDirs;
+		stringSetInit(&changedDirs, 0);
+		while (!full && stateValid && (len = getline(&line, &lineCap, reply)) > 0)
+		{
+			if (line[len - 1] != '\n') // Cut off (e.g. timeout)
+			{
+				full = true;
+				break;
+			}
+			line[len - 1] = '\0';
+			__add_changed_path(line, &changedDirs);
+		}
+		fclose(reply);
+
+		// Staged and committed files under changed directories (They may be removed)
+		for (uint i = 0; changedDirs.len && i < curRepository->stagingArea.len; i++)
+			if (__is_under_changed_dir(&changedDirs, curRepository->stagingArea.arr[i].file.path))
+				__add_candidate(curRepository->stagingArea.arr[i].file.path);
+		for (uint i = 0; changedDirs.len && i < curRepository->head.headFiles.len; i++)
+			if (__is_under_changed_dir(&changedDirs, curRepository->head.headFiles.arr[i].file.path))
+				__add_candidate(curRepository->head.headFiles.arr[i].file.path);
+		stringSetFree(&changedDirs);
+	}
+	free(line);
+	return !full && stateValid && *__token ? (int)__candidateCount : -1;
+}
+
+int getFsmonitorCandidates(constString **dest)
+{
+	if (!__queried)
+	{
+		__queried = true;
+		__queryResult = curRepository ? __query_candidates() : -1;
+		if (getenv(TRACE_ENV))
+			fprintf(stderr, "[trace] fsmonitor : %s, %d candidate(s)\n", !*__token ? "not running" : __queryResult < 0 ? "full scan" : "answered",
+					__queryResult);
+	}
+	*dest = (constString *)__candidateList;
+	return __queryResult;
+}
+
+bool isFsmonitorCandidate(constString path)
+{
+	return stringSetContains(&__candidateSet, path);
+}
+
+bool isFsmonitorRunning()
+{
+	return *__token;
+}
+
+int writeFsmonitorState(constString *paths, uint count)
+{
+	if (!*__token)
+		return ERR_NOERR;
+
+	char path[PATH_MAX], tmpPath[PATH_MAX], key[256];
+	strcat_s(tmpPath, __get_state_path(path), ".tmp");
+	bool ok = false;
+	with(stateFile, fopen(tmpPath, "w"), fclose(stateFile))
+	{
+		fprintf(stateFile, "%s\n%s\n", __token, __get_state_key(key));
+		for (uint i = 0; i < count; i++)
+			fprintf(stateFile, "%s\n", paths[i]);
+		ok = !ferror(stateFile);
+	}
+	if (!ok || rename(tmpPath, path) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
+	}
+	return ERR_NOERR;
+}
@@ -0,0 +1,367 @@
+/*******************************
+ *        hash_funcs.c         *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "hash_funcs.h"
+
+// SHA-256 round constants (first 32 bits of the fractional parts of the cube roots of the first 64 primes)
+static const uint32_t __sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define __ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Process one 64-byte block of input
+static void __sha256_transform(Sha256Context *ctx, const uchar *data)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+		w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) | ((uint32_t)data[i * 4 + 2] << 8) | data[i * 4 + 3];
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = __ROTR(w[i - 15], 7) ^ __ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = __ROTR(w[i - 2], 17) ^ __ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+	uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t S1 = __ROTR(e, 6) ^ __ROTR(e, 11) ^ __ROTR(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + S1 + ch + __sha256_k[i] + w[i];
+		uint32_t S0 = __ROTR(a, 2) ^ __ROTR(a, 13) ^ __ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = S0 + maj;
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+void sha256Init(Sha256Context *ctx)
+{
+	static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+										0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	memcpy(ctx->state, initial, sizeof(initial));
+	ctx->bitLen = 0;
+	ctx->blockLen = 0;
+}
+
+void sha256Update(Sha256Context *ctx, const void *_data, size_t len)
+{
+	const uchar *data = _data;
+
+	// Complete the pending block first
+	while (len && ctx->blockLen)
+	{
+		ctx->block[ctx->blockLen++] = *(data++);
+		len--;
+		if (ctx->blockLen == 64)
+		{
+			__sha256_transform(ctx, ctx->block);
+			ctx->bitLen += 512;
+			ctx->blockLen = 0;
+		}
+	}
+
+	// Process whole blocks directly from the input
+	for (; len >= 64; data += 64, len -= 64)
+	{
+		__sha256_transform(ctx, data);
+		ctx->bitLen += 512;
+	}
+
+	// Keep the remainder for the next call
+	memcpy(ctx->block, data, len);
+	ctx->blockLen = len;
+}
+
+void sha256Final(Sha256Context *ctx, uchar digest[SHA256_DIGEST_LEN])
+{
+	uint64_t totalBits = ctx->bitLen + (uint64_t)ctx->blockLen * 8;
+
+	// Append the '1' bit and pad with zeros up to 56 bytes (mod 64)
+	uint i = ctx->blockLen;
+	ctx->block[i++] = 0x80;
+	if (i > 56)
+	{
+		memset(ctx->block + i, 0, 64 - i);
+		__sha256_transform(ctx, ctx->block);
+		i = 0;
+	}
+	memset(ctx->block + i, 0, 56 - i);
+
+	// Append the total length in bits (big-endian)
+	for (int j = 0; j < 8; j++)
+		ctx->block[63 - j] = (uchar)(totalBits >> (j * 8));
+	__sha256_transform(ctx, ctx->block);
+
+	for (int j = 0; j < 8; j++)
+	{
+		digest[j * 4] = (uchar)(ctx->state[j] >> 24);
+		digest[j * 4 + 1] = (uchar)(ctx->state[j] >> 16);
+		digest[j * 4 + 2] = (uchar)(ctx->state[j] >> 8);
+		digest[j * 4 + 3] = (uchar)(ctx->state[j]);
+	}
+}
+
+String digestToHex(String dest, const uchar *digest, size_t len)
+{
+	static const char hexChars[] = "0123456789abcdef";
+	for (size_t i = 0; i < len; i++)
+	{
+		dest[i * 2] = hexChars[digest[i] >> 4];
+		dest[i * 2 + 1] = hexChars[digest[i] & 0xF];
+	}
+	dest[len * 2] = '\0';
+	return dest;
+}
+
+// Value of a hexadecimal digit (-1 if it is not a hexadecimal digit)
+static inline int __hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool hexToDigest(uchar *dest, constString hex, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		int high = __hex_value(hex[i * 2]), low = high < 0 ? -1 : __hex_value(hex[i * 2 + 1]);
+		if (low < 0)
+			return false;
+		dest[i] = (uchar)(high << 4 | low);
+	}
+	return true;
+}
+
+int sha256File(constString path, String hexDest)
+{
+	int error = ERR_FILE_ERROR;
+	with(file, fopen(path, "rb"), fclose(file))
+	{
+		Sha256Context ctx;
+		sha256Init(&ctx);
+
+		// Hash the file content in large blocks
+		uchar buf[64 * 1024];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+			sha256Update(&ctx, buf, n);
+		if (ferror(file))
+			throw(ERR_FILE_ERROR);
+
+		uchar digest[SHA256_DIGEST_LEN];
+		sha256Final(&ctx, digest);
+		digestToHex(hexDest, digest, SHA256_DIGEST_LEN);
+		error = ERR_NOERR;
+	}
+	return error;
+}
+
+uint64_t strHash(constString str)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (; *str; str++)
+		hash = (hash ^ (uchar)*str) * 0x100000001b3ULL;
+	return hash;
+}
+
+uint64_t memHash(const void *data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const uchar *p = data; len--; p++)
+		hash = (hash ^ *p) * 0x100000001b3ULL;
+	return hash;
+}
+
+void stringSetInit(StringSet *set, size_t expected)
+{
+	set->cap = 16;
+	while (set->cap < expected * 2)
+		set->cap <<= 1;
+	set->slots = calloc(set->cap, sizeof(String));
+	set->len = 0;
+	if (!set->slots)
+		set->cap = 0;
+}
+
+// Find the slot of a string (or the empty slot where it must be inserted)
+static size_t __string_set_slot(const StringSet *set, constString str)
+{
+	size_t i = strHash(str) & (set->cap - 1);
+	while (set->slots[i] && strcmp(set->slots[i], str) != 0)
+		i = (i + 1) & (set->cap - 1);
+	return i;
+}
+
+bool stringSetAdd(StringSet *set, constString str)
+{
+	// Keep the load factor under 1/2
+	if ((set->len + 1) * 2 > set->cap)
+	{
+		StringSet grown;
+		stringSetInit(&grown, set->len + 1);
+		if (!grown.slots)
+			return false;
+		for (size_t i = 0; i < set->cap; i++)
+			if (set->slots[i])
+				grown.slots[__string_set_slot(&grown, set->slots[i])] = set->slots[i];
+		grown.len = set->len;
+		free(set->slots);
+		*set = grown;
+	}
+
+	size_t i = __string_set_slot(set, str);
+	if (set->slots[i])
+		return false;
+	if (!(set->slots[i] = strDup(str)))
+		return false;
+	set->len++;
+	return true;
+}
+
+bool stringSetContains(const StringSet *set, constString str)
+{
+	return set->cap && set->slots[__string_set_slot(set, str)] != NULL;
+}
+
+void stringSetFree(StringSet *set)
+{
+	for (size_t i = 0; i < set->cap; i++)
+		free(set->slots[i]);
+	free(set->slots);
+	set->slots = NULL;
+	set->cap = set->len = 0;
+}
+
+void indexMapInit(IndexMap *map, IndexMapKeyFn keyOf, const void *ctx, size_t keyLen)
+{
+	*map = (IndexMap){NULL, 0, 0, keyOf, ctx, keyLen};
+}
+
+static uint64_t __index_map_hash(const IndexMap *map, const void *key)
+{
+	return map->keyLen ? memHash(key, map->keyLen) : strHash(key);
+}
+
+static bool __index_map_equals(const IndexMap *map, uint index, const void *key)
+{
+	const void *other = map->keyOf(map->ctx, index);
+	return map->keyLen ? memcmp(other, key, map->keyLen) == 0 : strcmp(other, key) == 0;
+}
+
+// Find the slot of a key (or the empty slot where it must be inserted)
+static uint __index_map_slot(const IndexMap *map, const void *key)
+{
+	uint slot = (uint)__index_map_hash(map, key) & map->mask;
+	while (map->slots[slot] && !__index_map_equals(map, map->slots[slot] - 1, key))
+		slot = (slot + 1) & map->mask;
+	return slot;
+}
+
+bool indexMapReserve(IndexMap *map, uint count)
+{
+	// Keep the load factor under 1/2
+	uint cap = 16;
+	while (cap < count * 2)
+		cap <<= 1;
+	if (map->slots && cap <= map->mask + 1)
+		return true;
+
+	IndexMap grown = *map;
+	if (!(grown.slots = calloc(cap, sizeof(uint))))
+		return false;
+	grown.mask = cap - 1;
+	for (uint i = 0; map->slots && i <= map->mask; i++)
+		if (map->slots[i])
+			grown.slots[__index_map_slot(&grown, map->keyOf(map->ctx, map->slots[i] - 1))] = map->slots[i];
+	free(map->slots);
+	*map = grown;
+	return true;
+}
+
+bool indexMapAdd(IndexMap *map, uint index)
+{
+	if (!indexMapReserve(map, map->len + 1))
+		return false;
+	uint slot = __index_map_slot(map, map->keyOf(map->ctx, index));
+	if (map->slots[slot])
+		return false;
+	map->slots[slot] = index + 1;
+	map->len++;
+	return true;
+}
+
+long indexMapFind(const IndexMap *map, const void *key)
+{
+	if (!map->slots)
+		return -1;
+	uint value = map->slots[__index_map_slot(map, key)];
+	return value ? (long)value - 1 : -1;
+}
+
+bool indexMapRemove(IndexMap *map, const void *key)
+{
+	if (!map->slots)
+		return false;
+	uint slot = __index_map_slot(map, key);
+	if (!map->slots[slot])
+		return false;
+
+	// The following indices of its cluster are moved back, so they are still found
+	map->slots[slot] = 0;
+	map->len--;
+	for (uint next = (slot + 1) & map->mask; map->slots[next]; next = (next + 1) & map->mask)
+	{
+		uint value = map->slots[next];
+		map->slots[next] = 0;
+		map->slots[__index_map_slot(map, map->keyOf(map->ctx, value - 1))] = value;
+	}
+	return true;
+}
+
+void indexMapClear(IndexMap *map)
+{
+	if (map->slots)
+		memset(map->slots, 0, (map->mask + 1) * sizeof(uint));
+	map->len = 0;
+}
+
+void indexMapFree(IndexMap *map)
+{
+	free(map->slots);
+	map->slots = NULL;
+	map->mask = map->len = 0;
+}
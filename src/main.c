@@ -9,6 +9,8 @@
 #include "install.h"
 #include "phase1.h"
 #include "phase2.h"
+#include "phase3.h"
+#include "statcache.h"
 
 // #define __DEBUG_MODE__ "neogit", "init"
 // #define __DEBUG_WORKSPACE__ "/"
@@ -36,6 +38,11 @@ const Command cmds[] = {
 	{"grep", 6, 9, command_grep, CMD_GREP_USAGE},
 	{"diff", 5, 9, command_diff, CMD_DIFF_USAGE},
 	{"merge", 4, 5, command_merge, CMD_MERGE_USAGE},
+	{"repack", 2, 2, command_repack, CMD_REPACK_USAGE},
+	{"migrate", 2, 2, command_migrate, CMD_MIGRATE_USAGE},
+	{"gc", 2, 2, command_gc, CMD_GC_USAGE},
+	{"fsck", 2, 4, command_fsck, CMD_FSCK_USAGE},
+	{"fsmonitor", 3, 3, command_fsmonitor, CMD_FSMONITOR_USAGE},
 	{NULL, 0, 0, NULL, NULL}}; // End of Commands list
 
 /**
@@ -89,10 +96,15 @@ int main(int argc, constString argv[])
 	extern Repository *curRepository;
 	if (curRepository)
 	{
+		// Changes of the staging area are written once for the whole command
+		if (writeStagingArea() != ERR_NOERR)
+			printError("Error! Could not write the staging index.");
+		if (writeTrackedFiles() != ERR_NOERR)
+			printError("Error! Could not write the list of tracked files.");
+		writeStatCache(); // Only a cache; it is recorded again on errors
 		free(curRepository->absPath);
 		freeGitObjectArray(&curRepository->head.headFiles);
-		if (curRepository->stagingArea.len)
-			free(curRepository->stagingArea.arr);
+		freeGitObjectArray(&curRepository->stagingArea);
 	}
 	return result;
 }
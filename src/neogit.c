@@ -6,6 +6,10 @@
  *     FOP Project NeoGIT      *
  ********************************/
 #include "neogit.h"
+#include "trees.h"
+#include "commitgraph.h"
+#include "statcache.h"
+#include "fsmonitor.h"
 
 // Global variable for cwd (Used in other c files - valued in begining of main())
 String curWorkingDir = NULL;
@@ -99,16 +103,14 @@ String ـgetconfigpath(bool global)
 		// Generate the global configuration path in the user's home directory
 		configPath = strcat_d(getenv("HOME"), "/." PROGRAM_NAME "config");
 		// Ensure the file exists by creating an empty file
-		system("touch ~/." PROGRAM_NAME "config");
+		ensureFile(configPath);
 	}
 	else
 	{
 		// Generate the repository-specific configuration path
 		configPath = strcat_d(curRepository->absPath, "/." PROGRAM_NAME "/config");
-		char cmd[PATH_MAX];
 		// Ensure the file exists by creating an empty file
-		sprintf(cmd, "touch \"%s\"", configPath);
-		system(cmd);
+		ensureFile(configPath);
 	}
 
 	return configPath;
@@ -320,56 +322,95 @@ bool isGitIgnore(FileEntry *entry)
 	return entry->isDir && isMatch(getFileName(entry->path), ".git");
 }
 
-int trackFile(constString filepath)
+// Tracked files of the current repository (loaded on the first use; new ones are written at the end of the command)
+static StringSet __trackedSet = {NULL, 0, 0};
+static String *__trackedList = NULL; // In the order of the manifest file
+static uint __trackedCount = 0, __trackedCap = 0, __trackedNew = 0;
+static bool __trackedLoaded = false;
+
+static bool __add_tracked(constString path)
 {
-	// Check if the file is already tracked
-	if (isTrackedFile(filepath))
-		return ERR_NOERR;
+	if (__trackedCount == __trackedCap)
+	{
+		uint newCap = __trackedCap ? __trackedCap * 2 : 64;
+		String *list = realloc(__trackedList, newCap * sizeof(String));
+		if (!list)
+			return false;
+		__trackedList = list;
+		__trackedCap = newCap;
+	}
+	if (!stringSetAdd(&__trackedSet, path)) // Already tracked (or no memory)
+		return false;
+	__trackedList[__trackedCount++] = strDup(path);
+	return true;
+}
 
-	// Construct the path to the manifest file
-	char manifestFilePath[PATH_MAX];
-	strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked");
+static void __ensure_tracked_loaded()
+{
+	if (__trackedLoaded)
+		return;
+	__trackedLoaded = true;
+	stringSetInit(&__trackedSet, 0);
 
-	// Ensure the manifest file exists
-	systemf("touch \"%s\"", manifestFilePath);
+	char manifestFilePath[PATH_MAX];
+	Tokenizer tokenizer;
+	if (!openTokenizer(&tokenizer, strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked")))
+		return; // Nothing is tracked yet
+	StrView line;
+	char path[PATH_MAX];
+	while (nextLine(&tokenizer, &line))
+		if (line.len && viewCopy(path, sizeof(path), line))
+			__add_tracked(strtrim(path));
+	closeTokenizer(&tokenizer);
+}
 
-	// Open the manifest file for appending
-	tryWithFile(manifestFile, manifestFilePath, ({ return ERR_FILE_ERROR; }), __retTry)
-	{
-		// Append the file path to the manifest file
-		freopen(manifestFilePath, "a+", manifestFile);
-		fputs(filepath, manifestFile);
-		fputc('\n', manifestFile);
-	}
+int trackFile(constString filepath)
+{
+	// Add it to the set (nothing is done if it is already tracked)
+	__ensure_tracked_loaded();
+	if (__add_tracked(filepath))
+		__trackedNew++;
 	return ERR_NOERR;
 }
 
 bool isTrackedFile(constString path)
 {
-	// Construct the path to the manifest file
-	char manifestFilePath[PATH_MAX];
-	strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked");
+	__ensure_tracked_loaded();
+	return stringSetContains(&__trackedSet, path);
+}
 
-	// Ensure the manifest file exists
-	systemf("touch \"%s\"", manifestFilePath);
+uint listTrackedFiles(constString **dest)
+{
+	__ensure_tracked_loaded();
+	*dest = (constString *)__trackedList;
+	return __trackedCount;
+}
 
-	// Open the manifest file for reading
-	tryWithFile(manifestFile, manifestFilePath, ({ return ERR_FILE_ERROR; }), __retTry)
-	{
-		char buf[PATH_MAX];
-		bool found = false;
-		// Iterate through the lines in the manifest file
-		while (fgets(buf, sizeof(buf), manifestFile) != NULL)
-			// Check if the file path matches the current line in the manifest
-			if (isMatch(buf, path))
-			{
-				found = true;
-				break;
-			}
+int writeTrackedFiles()
+{
+	if (!__trackedNew)
+		return ERR_NOERR;
 
-		throw(found);
+	// The manifest is written again with the new files at its end, and then replaced at once
+	char manifestFilePath[PATH_MAX], tmpPath[PATH_MAX];
+	strcat_s(tmpPath, strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked"), ".tmp");
+	bool ok = false;
+	with(manifestFile, fopen(tmpPath, "wb"), fclose(manifestFile))
+	{
+		for (uint i = 0; i < __trackedCount; i++)
+		{
+			fputs(__trackedList[i], manifestFile);
+			fputc('\n', manifestFile);
+		}
+		ok = !ferror(manifestFile);
 	}
-	return false;
+	if (!ok || rename(tmpPath, manifestFilePath) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
+	}
+	__trackedNew = 0;
+	return ERR_NOERR;
 }
 
 ullong generateUniqueId(int hexdigits)
@@ -399,6 +440,55 @@ ullong generateUniqueId(int hexdigits)
 	return hash;
 }
 
+// Staging area of the current repository: files are indexed by path, and changes are written once (see writeStagingArea)
+static const void *__staged_path_key(const void *ctx, uint index)
+{
+	return curRepository->stagingArea.arr[index].file.path;
+}
+
+static IndexMap __stageTable = {NULL, 0, 0, __staged_path_key, NULL, 0}; // Index of the staged files by path
+static StringSet __changedPaths = {NULL, 0, 0};	   // Staged paths which are changed (or removed) by this command
+static StringSet __releasedObjects = {NULL, 0, 0}; // Staged objects which may be no longer used
+static uint __changesGeneration = 0;				   // Changed when the staging area or HEAD is changed (see lsChangedFiles)
+
+// State of the staging journal of the current repository (see writeStagingArea)
+typedef struct _stage_journal_state_t
+{
+	uint generation; // Generation of the index (A journal of another generation is stale)
+	size_t len;		 // Length of the valid part of the journal (0 if there is none)
+	uint records;	 // Number of valid records in the journal
+	bool compact;	 // The next write must replace the journal with a new index (torn or stale journal, old info file)
+} StageJournalState;
+static StageJournalState __journal = {0};
+
+// Build the staging table again for the files of the staging area
+static bool __stage_table_rebuild()
+{
+	indexMapClear(&__stageTable);
+	if (!indexMapReserve(&__stageTable, curRepository->stagingArea.len))
+		return false;
+	for (uint i = 0; i < curRepository->stagingArea.len; i++)
+		indexMapAdd(&__stageTable, i);
+	return true;
+}
+
+// Mark a staged path to be written in the journal at the end of the command
+static void __mark_stage_changed(constString path)
+{
+	if (!__changedPaths.slots)
+		stringSetInit(&__changedPaths, 0);
+	stringSetAdd(&__changedPaths, path);
+	__changesGeneration++;
+}
+
+// Mark a staged object to be removed if no staged file (or snapshot) uses it at the end of the command
+static void __release_staged_object(constString hash)
+{
+	if (!__releasedObjects.slots)
+		stringSetInit(&__releasedObjects, 0);
+	stringSetAdd(&__releasedObjects, hash);
+}
+
 int addToStage(constString filePath)
 {
 	// Declare a pointer to StagedFile
@@ -406,55 +496,43 @@ int addToStage(constString filePath)
 	// Check if the file is already in the staging area
 	if (!(sf = getStagedFile(filePath)))
 	{
-		// If not, allocate memory for a new GitObject in the staging area
+		// If not, allocate memory for a new GitObject in the staging area (and index it)
+		if (!indexMapReserve(&__stageTable, curRepository->stagingArea.len + 1))
+			return ERR_MALLOC;
 		ADD_EMPTY(curRepository->stagingArea.arr, curRepository->stagingArea.len, GitObject);
 		sf = &(curRepository->stagingArea.arr[curRepository->stagingArea.len - 1]);
+		memset(sf, 0, sizeof(GitObject));
+		sf->file.path = strDup(filePath);
+		indexMapAdd(&__stageTable, curRepository->stagingArea.len - 1);
 	}
 	else if (!sf->file.isDeleted)
 		// If the file is not deleted, remove the old file from the staging area
-		withString(oldPath, strcat_d(curRepository->absPath, "/." PROGRAM_NAME "/stage", sf->hashStr))
-			remove(oldPath);
+		__release_staged_object(sf->hashStr);
 
-	// Get the absolute path of the file
+	// Get the absolute path of the file (The path is kept, since the staging table refers to it)
+	String path = sf->file.path;
+	struct stat st;
+	bool statOk = false;
 	withString(absPath, strcat_d(curRepository->absPath, "/", filePath))
+	{
+		statOk = stat(absPath, &st) == 0; // Taken before reading the content (A later change makes it different)
 		sf->file = getFileEntry(absPath, curRepository->absPath);
+	}
+	free(sf->file.path);
+	sf->file.path = path;
+	__mark_stage_changed(path);
 
 	if (!(sf->file.isDeleted))
 	{
-		// Generate a unique hash for the file and update GitObject information
-		withString(hash, toHexString(generateUniqueId(10), 10))
-			strcpy(sf->hashStr, hash);
-
-		// Copy the file to the hashed path in the staging area
-		char hashedPath[PATH_MAX];
-		strcat_s(hashedPath, "." PROGRAM_NAME "/stage/", sf->hashStr);
-		int err = copyFile(sf->file.path, hashedPath, curRepository->absPath);
+		// Store the file in the staging area, named by its content hash
+		int err = writeStagedObject(sf->file.path, sf->hashStr);
 		if (err)
 			return err;
+		if (statOk)
+			recordStatCache(sf->file.path, &st, sf->hashStr);
 	}
 	else // If the file is deleted, set a default hash value
 		strcpy(sf->hashStr, "dddddddddd");
-
-	// Save information to the info file
-	char path[PATH_MAX];
-	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/stage/info");
-	systemf("mkdir -p \"%s/." PROGRAM_NAME "/stage\"", curRepository->absPath);
-	systemf("touch \"%s\"", path);
-
-	// Add or update information in the info file
-	tryWithFile(infoFile, path, ({ return ERR_FILE_ERROR; }), __retTry)
-	{
-		int error = 0;
-		char pattern[STR_LINE_MAX];
-		sprintf(pattern, "%s:*:*:*", sf->file.path);
-		int res = searchLine(infoFile, pattern);
-		sprintf(pattern, "%s:%ld:%u:%s\n", sf->file.path, sf->file.dateModif, sf->file.permission, sf->hashStr);
-		if (res != -1)
-			error = replaceLine(infoFile, res, pattern);
-		else
-			fputs(pattern, freopen(path, "ab+", infoFile));
-		throw(error);
-	}
 	return ERR_NOERR;
 }
 
@@ -466,181 +544,560 @@ int removeFromStage(constString filePath)
 	// Check if the file is in the staging area
 	if (!(sf = getStagedFile(filePath)))
 		return ERR_NOT_EXIST;
+	__mark_stage_changed(sf->file.path);
 
 	// Remove the staged file if it is not deleted
 	if (!sf->file.isDeleted) // We must delete the staged file
-		withString(oldPath, strcat_d(curRepository->absPath, "/." PROGRAM_NAME "/stage", sf->hashStr))
-			remove(oldPath);
-
-	// Remove information from the info file
-	char path[PATH_MAX];
-	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/stage/info");
-	tryWithFile(infoFile, path, ({ return ERR_FILE_ERROR; }), __retTry)
+		__release_staged_object(sf->hashStr);
+
+	// Remove it from the table, and move the last file to its place in the array
+	GitObjectArray *stage = &curRepository->stagingArea;
+	uint index = sf - stage->arr;
+	indexMapRemove(&__stageTable, sf->file.path);
+	free(sf->file.path);
+	if (index != --stage->len)
 	{
-		int error = 0;
-		char pattern[STR_LINE_MAX];
-		sprintf(pattern, "%s:%ld:%u:%s", sf->file.path, sf->file.dateModif, sf->file.permission, sf->hashStr);
-		int res = searchLine(infoFile, pattern);
-		if (res != -1)
-			error = removeLine(infoFile, res);
-		else
-			error = ERR_NOT_EXIST;
-		throw(error);
+		indexMapRemove(&__stageTable, stage->arr[stage->len].file.path);
+		stage->arr[index] = stage->arr[stage->len];
+		indexMapAdd(&__stageTable, index);
 	}
+	return ERR_NOERR;
+}
 
-	// Refresh GitObjectArray in the program
-	fetchStagingArea(curRepository);
+GitObject *getStagedFile(constString path)
+{
+	long index = indexMapFind(&__stageTable, path);
+	return index >= 0 ? &(curRepository->stagingArea.arr[index]) : NULL;
+}
 
-	return ERR_NOERR;
+// Parse a line in the format of staging info: "<path>:<time>:<perm>:<hash>" (The path may contain ':')
+static bool __parse_object_line(StrView line, GitObject *dest)
+{
+	StrView hash, perm, time;
+	uint64_t timeValue, permValue;
+	if (!lastField(&line, ':', &hash) || !lastField(&line, ':', &perm) || !lastField(&line, ':', &time) || !line.str || !line.len ||
+		!viewToU64(time, 10, &timeValue) || !viewToU64(perm, 10, &permValue) || !viewCopy(dest->hashStr, sizeof(dest->hashStr), hash))
+		return false;
+	dest->file.path = viewDup(line);
+	dest->file.dateModif = timeValue;
+	dest->file.permission = permValue;
+	dest->file.isDeleted = (strcmp("dddddddddd", dest->hashStr) == 0);
+	dest->file.isDir = (strcmp("dirdirdird", dest->hashStr) == 0);
+	return dest->file.path != NULL;
 }
 
-int backupStagingArea()
+// Read the text staging info of old versions (The last line of a path wins)
+static int __read_stage_info(constString infoPath, GitObjectArray *dest)
 {
-	char tmp[PATH_MAX];
+	Tokenizer tokenizer;
+	if (!openTokenizer(&tokenizer, infoPath))
+		return ERR_NOT_EXIST;
 
-	// Iterate through existing backups and move them to newer versions
-	for (int i = 9; i >= 0; i--)
+	StringSet paths;
+	stringSetInit(&paths, 0);
+	StrView line;
+	while (nextLine(&tokenizer, &line))
 	{
-		sprintf(tmp, "%s/." PROGRAM_NAME "/stage/old%d", curRepository->absPath, i);
-		// Check if the backup directory exists
-		if (access(tmp, F_OK) == -1)
+		GitObject parsed = {0};
+		if (!line.len || !__parse_object_line(line, &parsed))
+		{
+			free(parsed.file.path);
+			continue;
+		}
+		if (!stringSetAdd(&paths, parsed.file.path)) // Rare: the path was added twice -> replace it
+		{
+			for (uint i = 0; i < dest->len; i++)
+				if (!strcmp(dest->arr[i].file.path, parsed.file.path))
+				{
+					free(dest->arr[i].file.path);
+					dest->arr[i] = parsed;
+					break;
+				}
 			continue;
+		}
+		ADD_EMPTY(dest->arr, dest->len, GitObject);
+		dest->arr[dest->len - 1] = parsed;
+	}
+	stringSetFree(&paths);
+	closeTokenizer(&tokenizer);
+	return ERR_NOERR;
+}
 
-		// Move to a newer version or remove if it's the last one
-		tmp[strlen(tmp) - 1] = '\0'; // Truncate and remove the number from the end of the filename
-		if (i == 9)
-			systemf("rm -r \"%s%d\"", tmp, i);
-		else
-			systemf("mv \"%s%d\" \"%s%d\"", tmp, i, tmp, i + 1);
-	}
-
-	// Create a new backup directory (old0) and copy the current staging area to it
-	sprintf(tmp, "%s/." PROGRAM_NAME "/stage", curRepository->absPath);
-	FileEntry *buf = NULL;
-	int res = ls(&buf, tmp);
-	int error = 0;
-	strcat(tmp, "/old0");
-	mkdir(tmp, 0775);
-
-	// Copy each file from the staging area to the backup directory
-	for (int i = 0; i < res; i++)
-		if (!buf[i].isDir)
-			withString(dest, strcat_d(tmp, "/", getFileName(buf[i].path)))
-				error += copyFile(buf[i].path, dest, NULL);
-
-	// Free the memory used by the list of files
-	freeFileEntry(buf, res);
-	if (buf && res > 0)
-		free(buf);
-	return error;
+// Order of staged files (by path)
+static int __staged_file_comparator(const void *a, const void *b)
+{
+	return strcmp(((const GitObject *)a)->file.path, ((const GitObject *)b)->file.path);
 }
 
-int restoreStageingBackup()
+// Order of journal records: by path, then by their order in the journal (the last one wins)
+static int __journal_record_comparator(const void *a, const void *b)
 {
-	char tmp[PATH_MAX];
-	sprintf(tmp, "%s/." PROGRAM_NAME "/stage/old0", curRepository->absPath);
+	const GitObject *r1 = *(const GitObject **)a, *r2 = *(const GitObject **)b;
+	int cmp = strcmp(r1->file.path, r2->file.path);
+	return cmp ? cmp : (r1 < r2 ? -1 : r1 > r2);
+}
 
-	// Check if the backup directory (old0) exists
-	if (access(tmp, F_OK) == -1)
-		return ERR_NOT_EXIST; // check if not exist
-
-	FileEntry *buf = NULL;
-	strcat_s(tmp, curRepository->absPath, "/." PROGRAM_NAME "/stage");
-	int res = ls(&buf, tmp);
-
-	// Remove existing files in the staging area
-	for (int i = 0; i < res; i++)
-		if (!buf[i].isDir)
-			remove(buf[i].path);
-
-	// Free the memory used by the list of files
-	freeFileEntry(buf, res);
-	if (buf)
-		free(buf);
-
-	// Move backed up files from the backup directory (old0) to the staging area
-	char stagePath[PATH_MAX];
-	strcpy(stagePath, tmp);
-	strcat(tmp, "/old0");
-	systemf("mv \"%s\"/* \"%s\" 2>/dev/null", tmp, stagePath); // move back all backed up files
-	systemf("rm -r \"%s\"", tmp);							   // remove backup folder
-
-	// Shift other backups to fill the gap
-	for (int i = 1; i <= 9; i++)
+// Fill an entry of the staging index (or of a journal record) with a staged file (NULL for a removed path)
+static void __put_stage_entry(uchar *entry, const GitObject *obj, size_t pathLen)
+{
+	memset(entry, 0, STAGE_INDEX_ENTRY_SIZE);
+	putLE32(entry + 12, pathLen);
+	if (!obj)
+		return;
+	putLE64(entry, obj->file.dateModif);
+	putLE32(entry + 8, obj->file.permission);
+	memcpy(entry + 16, obj->hashStr, strlen(obj->hashStr));
+}
+
+// Parse the entry at pos (The hash of a removed path is empty); returns the length of the entry, or 0 if it is invalid
+static size_t __get_stage_entry(const uchar *map, size_t len, size_t pos, GitObject *dest, bool allowRemoved)
+{
+	const uchar *entry = map + pos;
+	uint pathLen = pos + STAGE_INDEX_ENTRY_SIZE <= len ? getLE32(entry + 12) : 0;
+	if (!pathLen || pathLen > len - pos - STAGE_INDEX_ENTRY_SIZE || memchr(entry + STAGE_INDEX_ENTRY_SIZE, '\0', pathLen) ||
+		(!entry[16] && !allowRemoved))
+		return 0;
+	memset(dest, 0, sizeof(GitObject));
+	if (!(dest->file.path = strndup((constString)entry + STAGE_INDEX_ENTRY_SIZE, pathLen)))
+		return 0;
+	dest->file.dateModif = getLE64(entry);
+	dest->file.permission = getLE32(entry + 8);
+	memcpy(dest->hashStr, entry + 16, OBJ_HASH_LEN);
+	dest->hashStr[OBJ_HASH_LEN] = '\0';
+	dest->file.isDeleted = (strcmp("dddddddddd", dest->hashStr) == 0);
+	dest->file.isDir = (strcmp("dirdirdird", dest->hashStr) == 0);
+	return STAGE_INDEX_ENTRY_SIZE + pathLen;
+}
+
+// Merge the last records of the paths (sorted) into the files (sorted by path)
+static int __merge_journal_records(GitObjectArray *files, GitObject **records, uint count)
+{
+	GitObject *merged = calloc(files->len + count + 1, sizeof(GitObject));
+	if (!merged)
+		return ERR_MALLOC;
+	uint len = 0, f = 0, r = 0;
+	while (f < files->len || r < count)
+	{
+		// Only the last record of a path is used
+		if (r < count && r + 1 < count && !strcmp(records[r]->file.path, records[r + 1]->file.path))
+		{
+			free(records[r++]->file.path);
+			continue;
+		}
+		int cmp = f == files->len ? 1 : r == count ? -1
+												   : strcmp(files->arr[f].file.path, records[r]->file.path);
+		if (cmp < 0)
+		{
+			merged[len++] = files->arr[f++];
+			continue;
+		}
+		if (cmp == 0)
+			free(files->arr[f++].file.path);
+		if (records[r]->hashStr[0]) // Not removed
+			merged[len++] = *records[r];
+		else
+			free(records[r]->file.path);
+		r++;
+	}
+	free(files->arr);
+	files->arr = merged;
+	files->len = len;
+	return ERR_NOERR;
+}
+
+// Replay the journal of a staging directory on its files (sorted by path)
+static int __replay_stage_journal(constString stageDir, GitObjectArray *files, StageJournalState *state)
+{
+	char path[PATH_MAX];
+	size_t len = 0;
+	const uchar *map = mapFile(strcat_s(path, stageDir, "/journal"), &len);
+	if (!map)
+		return ERR_NOERR; // No journal (or an empty one)
+	if (len < STAGE_JOURNAL_HEADER_SIZE || memcmp(map, STAGE_JOURNAL_MAGIC, 4) || getLE32(map + 4) != STAGE_JOURNAL_VERSION ||
+		getLE32(map + 8) != state->generation)
 	{
-		sprintf(tmp, "%s/." PROGRAM_NAME "/stage/old%d", curRepository->absPath, i);
+		// Left by a crash after a new index is written (or unknown); the index has all of its changes
+		unmapFile(map, len);
+		state->compact = true;
+		return ERR_NOERR;
+	}
 
-		// Check if  backup directory not exists
-		if (access(tmp, F_OK) == -1)
+	// Valid records until the first torn or corrupted one
+	GitObject *records = NULL;
+	uint count = 0, cap = 0;
+	size_t pos = STAGE_JOURNAL_HEADER_SIZE;
+	int error = ERR_NOERR;
+	while (pos + 4 < len)
+	{
+		if (count == cap)
+		{
+			uint newCap = cap ? cap * 2 : 64;
+			GitObject *newRecords = realloc(records, newCap * sizeof(GitObject));
+			if (!newRecords)
+			{
+				error = ERR_MALLOC;
+				break;
+			}
+			records = newRecords;
+			cap = newCap;
+		}
+		size_t entryLen = __get_stage_entry(map, len, pos + 4, &records[count], true);
+		if (!entryLen)
+			break;
+		if ((uint32_t)memHash(map + pos + 4, entryLen) != getLE32(map + pos))
+		{
+			free(records[count].file.path);
 			break;
+		}
+		count++;
+		pos += 4 + entryLen;
+	}
+	unmapFile(map, len);
+	state->len = pos;
+	state->records = count;
+	state->compact |= pos != len;
 
-		// Move the top backup to the previous version
-		tmp[strlen(tmp) - 1] = '\0'; // truncate and remove number from end of filename
-		systemf("mv \"%s%d\" \"%s%d\"", tmp, i, tmp, i - 1);
+	GitObject **sorted = error == ERR_NOERR ? malloc((count + 1) * sizeof(GitObject *)) : NULL;
+	if (sorted)
+	{
+		for (uint i = 0; i < count; i++)
+			sorted[i] = &records[i];
+		qsort(sorted, count, sizeof(GitObject *), __journal_record_comparator);
+		error = __merge_journal_records(files, sorted, count);
 	}
-	return ERR_NOERR;
+	else
+		error = ERR_MALLOC;
+	if (error != ERR_NOERR)
+		for (uint i = 0; i < count; i++)
+			free(records[i].file.path);
+	free(sorted);
+	free(records);
+	return error;
 }
 
-GitObject *getStagedFile(constString path)
+// Read the index and the journal of a staging directory
+static int __read_stage_index(constString stageDir, GitObjectArray *dest, StageJournalState *state)
 {
-	for (int i = 0; i < curRepository->stagingArea.len; i++)
-		if (!strcmp(curRepository->stagingArea.arr[i].file.path, path))
-			return &(curRepository->stagingArea.arr[i]);
-	return NULL;
+	*dest = (GitObjectArray){NULL, 0};
+	*state = (StageJournalState){0};
+	char path[PATH_MAX];
+	size_t len = 0;
+	const uchar *map = mapFile(strcat_s(path, stageDir, "/index"), &len);
+	int error = ERR_NOERR;
+	if (!map)
+	{
+		if (access(path, F_OK) == 0) // An empty file is not a valid index
+			error = ERR_FILE_ERROR;
+		else if ((error = __read_stage_info(strcat_s(path, stageDir, "/info"), dest)) == ERR_NOERR)
+		{
+			qsort(dest->arr, dest->len, sizeof(GitObject), __staged_file_comparator);
+			state->compact = true; // Migrated to the index
+		}
+	}
+	else
+	{
+		uint count = len >= STAGE_INDEX_HEADER_SIZE ? getLE32(map + 8) : 0;
+		if (len < STAGE_INDEX_HEADER_SIZE || memcmp(map, STAGE_INDEX_MAGIC, 4) || getLE32(map + 4) != STAGE_INDEX_VERSION ||
+			count > (len - STAGE_INDEX_HEADER_SIZE) / STAGE_INDEX_ENTRY_SIZE || !(dest->arr = calloc(count + 1, sizeof(GitObject))))
+			error = ERR_FILE_ERROR;
+		else
+			state->generation = getLE32(map + 12);
+
+		for (size_t pos = STAGE_INDEX_HEADER_SIZE, entryLen; error == ERR_NOERR && dest->len < count; pos += entryLen)
+			if ((entryLen = __get_stage_entry(map, len, pos, &dest->arr[dest->len], false)))
+				dest->len++;
+			else
+				error = ERR_FILE_ERROR;
+		unmapFile(map, len);
+	}
+
+	// A journal may exist without an index (generation 0)
+	bool found = error == ERR_NOERR;
+	if (error == ERR_NOERR || error == ERR_NOT_EXIST)
+		error = __replay_stage_journal(stageDir, dest, state);
+	if (error == ERR_NOERR && !found && !state->len)
+		error = ERR_NOT_EXIST;
+	if (error != ERR_NOERR)
+	{
+		freeGitObjectArray(dest);
+		*dest = (GitObjectArray){NULL, 0};
+		state->compact |= error != ERR_NOT_EXIST; // A corrupted index is replaced by the next write
+	}
+	return error;
+}
+
+int readStageIndex(constString stageDir, GitObjectArray *dest)
+{
+	StageJournalState state;
+	return __read_stage_index(stageDir, dest, &state);
 }
 
 int fetchStagingArea()
 {
-	// Declare a variable to store the file path
+	// Free the existing GitObjectArray in the current repository
+	freeGitObjectArray(&curRepository->stagingArea);
+	curRepository->stagingArea = (GitObjectArray){NULL, 0};
+	__changesGeneration++;
+
+	// Read the index and its journal (a missing index is an empty staging area)
 	char path[PATH_MAX];
+	int error = __read_stage_index(strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/stage"), &curRepository->stagingArea, &__journal);
+	if (!__stage_table_rebuild())
+		return ERR_MALLOC;
+	return error == ERR_NOT_EXIST ? ERR_NOERR : error;
+}
 
-	// Free the existing GitObjectArray in the current repository
-	if (curRepository->stagingArea.arr)
+// Order of the entries of the staging index (by path)
+static int __staged_path_comparator(const void *a, const void *b)
+{
+	return strcmp((*(const GitObject **)a)->file.path, (*(const GitObject **)b)->file.path);
+}
+
+// Write an index of the current staging area (in a temporary file first, and then renamed)
+static int __write_index_file(constString indexPath, uint generation)
+{
+	char tmpPath[PATH_MAX];
+	strcat_s(tmpPath, indexPath, ".tmp");
+	GitObjectArray *stage = &curRepository->stagingArea;
+	const GitObject **sorted = malloc((stage->len + 1) * sizeof(GitObject *));
+	if (!sorted)
+		return ERR_MALLOC;
+	for (uint i = 0; i < stage->len; i++)
+		sorted[i] = &stage->arr[i];
+	qsort(sorted, stage->len, sizeof(GitObject *), __staged_path_comparator);
+
+	bool ok = false;
+	with(indexFile, fopen(tmpPath, "wb"), fclose(indexFile))
 	{
-		free(curRepository->stagingArea.arr);
-		curRepository->stagingArea.arr = NULL;
-		curRepository->stagingArea.len = 0;
+		uchar header[STAGE_INDEX_HEADER_SIZE] = {0}, entry[STAGE_INDEX_ENTRY_SIZE];
+		memcpy(header, STAGE_INDEX_MAGIC, 4);
+		putLE32(header + 4, STAGE_INDEX_VERSION);
+		putLE32(header + 8, stage->len);
+		putLE32(header + 12, generation);
+		fwrite(header, 1, STAGE_INDEX_HEADER_SIZE, indexFile);
+		for (uint i = 0; i < stage->len; i++)
+		{
+			size_t pathLen = strlen(sorted[i]->file.path);
+			__put_stage_entry(entry, sorted[i], pathLen);
+			fwrite(entry, 1, STAGE_INDEX_ENTRY_SIZE, indexFile);
+			fwrite(sorted[i]->file.path, 1, pathLen, indexFile);
+		}
+		ok = !ferror(indexFile);
+	}
+	free(sorted);
+	if (!ok || rename(tmpPath, indexPath) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
 	}
+	return ERR_NOERR;
+}
+
+// Write the whole staging index as a new generation, and remove the journal (and the text info of old versions)
+static int __write_stage_index(constString stagePath)
+{
+	char path[PATH_MAX];
+	int error = __write_index_file(strcat_s(path, stagePath, "/index"), __journal.generation + 1);
+	if (error != ERR_NOERR)
+		return error;
+
+	// The old journal is stale now (A crash before it is removed leaves it with an old generation)
+	remove(strcat_s(path, stagePath, "/journal"));
+	remove(strcat_s(path, stagePath, "/info"));
+	__journal = (StageJournalState){.generation = __journal.generation + 1};
+	return ERR_NOERR;
+}
 
-	// Open the info file for reading
-	tryWithFile(infoFile, strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/stage/info"),
-				({ return ERR_FILE_ERROR; }), __retTry)
+// Append the records of the changed paths to the journal (in one write)
+static int __append_stage_journal(constString stagePath)
+{
+	size_t len = 0, cap = STAGE_JOURNAL_HEADER_SIZE;
+	for (size_t i = 0; i < __changedPaths.cap; i++)
+		if (__changedPaths.slots[i])
+			cap += 4 + STAGE_INDEX_ENTRY_SIZE + strlen(__changedPaths.slots[i]);
+	uchar *block = malloc(cap);
+	if (!block)
+		return ERR_MALLOC;
+
+	// A new journal starts with its header
+	if (!__journal.len)
 	{
-		char buf[STR_LINE_MAX];
-		// Read the information from the info file
-		while (fgets(buf, STR_LINE_MAX, infoFile) != NULL)
-		{
-			// Declare variables to store file information
-			char filePath[PATH_MAX];
-			time_t timeM = 0;
-			uint perm = 0;
-			char hash[11];
+		memset(block, 0, STAGE_JOURNAL_HEADER_SIZE);
+		memcpy(block, STAGE_JOURNAL_MAGIC, 4);
+		putLE32(block + 4, STAGE_JOURNAL_VERSION);
+		putLE32(block + 8, __journal.generation);
+		len = STAGE_JOURNAL_HEADER_SIZE;
+	}
+	for (size_t i = 0; i < __changedPaths.cap; i++)
+	{
+		constString changed = __changedPaths.slots[i];
+		if (!changed)
+			continue;
+		size_t pathLen = strlen(changed);
+		uchar *record = block + len;
+		__put_stage_entry(record + 4, getStagedFile(changed), pathLen);
+		memcpy(record + 4 + STAGE_INDEX_ENTRY_SIZE, changed, pathLen);
+		putLE32(record, (uint32_t)memHash(record + 4, STAGE_INDEX_ENTRY_SIZE + pathLen));
+		len += 4 + STAGE_INDEX_ENTRY_SIZE + pathLen;
+	}
 
-			// Parse the information from the buffer
-			sscanf(buf, "%[^:]:%ld:%u:%s", filePath, &timeM, &perm, hash);
+	char path[PATH_MAX];
+	bool ok = false;
+	with(journalFile, fopen(strcat_s(path, stagePath, "/journal"), __journal.len ? "ab" : "wb"), fclose(journalFile))
+		ok = fwrite(block, 1, len, journalFile) == len && fflush(journalFile) == 0;
+	free(block);
+	if (!ok)
+		return ERR_FILE_ERROR;
+	__journal.len += len;
+	__journal.records += __changedPaths.len;
+	return ERR_NOERR;
+}
 
-			// Get the StagedFile corresponding to the file path
-			GitObject *sf = getStagedFile(filePath);
+// Path of a snapshot of the staging area (old0 is the last one)
+static String __get_snapshot_path(String dest, int index)
+{
+	sprintf(dest, "%s/." PROGRAM_NAME "/stage/old%d", curRepository->absPath, index);
+	return dest;
+}
 
-			// If StagedFile does not exist, add it to the GitObjectArray
-			if (sf == NULL)
+void addSnapshotObjects(StringSet *dest)
+{
+	char path[PATH_MAX];
+	for (int i = 0; i <= 9; i++)
+	{
+		GitObjectArray snapshot;
+		if (readStageIndex(__get_snapshot_path(path, i), &snapshot) != ERR_NOERR)
+			continue;
+		for (uint j = 0; j < snapshot.len; j++)
+			stringSetAdd(dest, snapshot.arr[j].hashStr);
+		freeGitObjectArray(&snapshot);
+	}
+}
+
+int writeStagingArea()
+{
+	if (!curRepository || (!__changedPaths.len && !__releasedObjects.len))
+		return ERR_NOERR;
+
+	char stagePath[PATH_MAX], path[PATH_MAX];
+	strcat_s(stagePath, curRepository->absPath, "/." PROGRAM_NAME "/stage");
+	if (makeDirs(stagePath) != ERR_NOERR)
+		return ERR_FILE_ERROR;
+
+	// The journal is compacted when it has more records than the staging area has files (O(1) amortized per change)
+	GitObjectArray *stage = &curRepository->stagingArea;
+	uint limit = stage->len > STAGE_JOURNAL_COMPACT_MIN ? stage->len : STAGE_JOURNAL_COMPACT_MIN;
+	int error = __changedPaths.len ? ERR_FILE_ERROR : ERR_NOERR;
+	if (__changedPaths.len && !__journal.compact && __journal.records + __changedPaths.len <= limit)
+		error = __append_stage_journal(stagePath);
+	if (error != ERR_NOERR)
+	{
+		__journal.compact = true; // A failed append may leave a torn record, which is never replayed
+		if ((error = __write_stage_index(stagePath)) != ERR_NOERR)
+			return error;
+	}
+	stringSetFree(&__changedPaths);
+
+	// Remove the released objects which are not used by any staged file or snapshot (They are read only if it is needed)
+	if (__releasedObjects.len)
+	{
+		StringSet used;
+		stringSetInit(&used, stage->len);
+		for (uint i = 0; i < stage->len; i++)
+			stringSetAdd(&used, stage->arr[i].hashStr);
+		bool snapshotsRead = false;
+		for (size_t i = 0; i < __releasedObjects.cap; i++)
+		{
+			constString released = __releasedObjects.slots[i];
+			if (!released || stringSetContains(&used, released))
+				continue;
+			if (!snapshotsRead)
 			{
-				ADD_EMPTY(curRepository->stagingArea.arr, curRepository->stagingArea.len, GitObject);
-				sf = &(curRepository->stagingArea.arr[curRepository->stagingArea.len - 1]);
-				sf->file.path = strDup(filePath);
+				addSnapshotObjects(&used);
+				snapshotsRead = true;
+				if (stringSetContains(&used, released))
+					continue;
 			}
-
-			// Update the StagedFile information
-			strcpy(sf->hashStr, hash);
-			sf->file.dateModif = timeM;
-			sf->file.isDeleted = (strcmp("dddddddddd", hash) == 0);
-			sf->file.permission = perm;
+			remove(getStagedObjectPath(path, released));
 		}
-		rewind(infoFile);
+		stringSetFree(&used);
 	}
+	stringSetFree(&__releasedObjects);
 	return ERR_NOERR;
 }
 
+int backupStagingArea()
+{
+	char tmp[PATH_MAX], newer[PATH_MAX];
+
+	// Shift the snapshots to newer versions (the oldest one is removed, and its objects may be no longer used)
+	GitObjectArray oldest;
+	if (readStageIndex(__get_snapshot_path(tmp, 9), &oldest) == ERR_NOERR)
+	{
+		for (uint i = 0; i < oldest.len; i++)
+			__release_staged_object(oldest.arr[i].hashStr);
+		freeGitObjectArray(&oldest);
+	}
+	removeTree(tmp);
+	for (int i = 8; i >= 0; i--)
+		rename(__get_snapshot_path(tmp, i), __get_snapshot_path(newer, i + 1));
+
+	// The new snapshot is only an index of the current staging area; staged objects are never changed,
+	// and they are not removed while a snapshot refers to them (see writeStagingArea)
+	__get_snapshot_path(tmp, 0);
+	if (makeDirs(tmp) != ERR_NOERR)
+		return ERR_FILE_ERROR;
+	return __write_index_file(strcat(tmp, "/index"), 0);
+}
+
+int restoreStageingBackup()
+{
+	char snapshotPath[PATH_MAX], stagePath[PATH_MAX], src[PATH_MAX], dest[PATH_MAX];
+	__get_snapshot_path(snapshotPath, 0);
+	strcat_s(stagePath, curRepository->absPath, "/." PROGRAM_NAME "/stage");
+
+	// Check if the backup directory (old0) exists
+	if (access(snapshotPath, F_OK) == -1)
+		return ERR_NOT_EXIST;
+
+	// Snapshots of old versions have copies of the staged objects (and maybe a text info file instead of an index)
+	tryWith(DIR *, dir, opendir(snapshotPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+			if (entry->d_name[0] != '.' && strcmp(entry->d_name, "index"))
+				rename(strcat_s(src, snapshotPath, "/", entry->d_name), strcat_s(dest, stagePath, "/", entry->d_name));
+	}
+
+	// The index of the snapshot replaces the current one; it gets a new generation, so the current journal is stale
+	strcat_s(src, snapshotPath, "/index");
+	if (access(src, F_OK) == 0)
+	{
+		uchar generation[4];
+		putLE32(generation, __journal.generation + 1);
+		bool ok = false;
+		with(indexFile, fopen(src, "r+b"), fclose(indexFile))
+			ok = fseek(indexFile, 12, SEEK_SET) == 0 && fwrite(generation, 1, 4, indexFile) == 4 && fflush(indexFile) == 0;
+		if (!ok || rename(src, strcat_s(dest, stagePath, "/index")) != 0)
+			return ERR_FILE_ERROR;
+	}
+	else
+		remove(strcat_s(dest, stagePath, "/index"));
+	remove(strcat_s(dest, stagePath, "/journal"));
+	removeTree(snapshotPath);
+
+	// Shift other snapshots to fill the gap
+	for (int i = 1; i <= 9; i++)
+		if (rename(__get_snapshot_path(src, i), __get_snapshot_path(dest, i - 1)) != 0)
+			break;
+
+	// The changes of this command are replaced by the snapshot (The objects of the replaced files may be no longer used)
+	stringSetFree(&__changedPaths);
+	for (uint i = 0; i < curRepository->stagingArea.len; i++)
+		__release_staged_object(curRepository->stagingArea.arr[i].hashStr);
+	return fetchStagingArea();
+}
+
 ChangeStatus getChangesFromStaging(constString path)
 {
 	// Get the staged file entry
@@ -676,18 +1133,16 @@ ChangeStatus getChangesFromStaging(constString path)
 	{
 		// Both staged file and real file are present, compare them
 
-		// Get the absolute path of the staged object
-		char stagedObjAbsPath[PATH_MAX];
 		FileEntry realFile = getFileEntry(abspath, NULL);
 		freeFileEntry(&realFile, 1);
-		strcat_s(stagedObjAbsPath, curRepository->absPath, "/." PROGRAM_NAME "/stage/", stage->hashStr);
 
 		// Check if the staged file is marked as deleted
 		if (stage->file.isDeleted)
 			return ADDED;
 
 		// Check if the content of the real file and staged file are different
-		else if (!isFilesSame(abspath, stagedObjAbsPath))
+		// (The staged content may have been already stored in the object store)
+		else if (!isWorkingFileSame(path, stage->hashStr))
 			return MODIFIED;
 
 		// Check if the file permissions are different
@@ -767,6 +1222,143 @@ int processTree(FileEntry *root, uint curDepth, int (*listFunction)(FileEntry **
 	return processedEntries;
 }
 
+// A child of a directory of HEAD: a file, or a subdirectory with the first HEAD file under it
+typedef struct _head_child_t
+{
+	uint dir;	// Index of its directory in __headDirs
+	uint file;	// Index of the file in HEAD (of the first file under it for subdirectories)
+	bool isDir; // A subdirectory
+} HeadChild;
+
+// A directory of HEAD (relative to the repository; "" for the root) and its children (in the order of HEAD files)
+typedef struct _head_dir_t
+{
+	String path;
+	uint firstFile;	 // Index of the first HEAD file under it
+	uint firstChild; // Index of its first child in __headChildren
+	uint childCount;
+} HeadDir;
+
+// Directories of the HEAD files of the current repository (built once per HEAD, so lsWithHead does not loop over
+// all HEAD files for each directory)
+static HeadDir *__headDirs = NULL;
+static uint __headDirCount = 0, __headDirCap = 0;
+static HeadChild *__headChildren = NULL;
+static const GitObject *__headDirsArr = NULL;
+static uint __headDirsLen = 0;
+
+static const void *__head_dir_key(const void *ctx, uint index)
+{
+	return __headDirs[index].path;
+}
+
+static IndexMap __headDirTable = {NULL, 0, 0, __head_dir_key, NULL, 0}; // Index of __headDirs by path
+
+static void __head_dirs_clear()
+{
+	for (uint i = 0; i < __headDirCount; i++)
+		free(__headDirs[i].path);
+	free(__headChildren);
+	__headChildren = NULL;
+	__headDirCount = 0;
+	__headDirsArr = NULL;
+	indexMapClear(&__headDirTable);
+}
+
+// Add a directory of HEAD (Returns its index, or -1 on memory errors)
+static long __head_dir_add(constString path, uint firstFile)
+{
+	if (__headDirCount == __headDirCap)
+	{
+		uint newCap = __headDirCap ? __headDirCap * 2 : 64;
+		HeadDir *dirs = realloc(__headDirs, newCap * sizeof(HeadDir));
+		if (!dirs)
+			return -1;
+		__headDirs = dirs;
+		__headDirCap = newCap;
+	}
+	HeadDir *dir = &__headDirs[__headDirCount];
+	*dir = (HeadDir){strDup(path), firstFile, 0, 0};
+	if (!dir->path || !indexMapAdd(&__headDirTable, __headDirCount))
+	{
+		free(dir->path);
+		return -1;
+	}
+	return __headDirCount++;
+}
+
+// Add a child of a directory of HEAD to a growing array
+static bool __head_child_add(HeadChild **children, uint *count, uint *cap, HeadChild child)
+{
+	if (*count == *cap)
+	{
+		HeadChild *grown = realloc(*children, (*cap * 2 + 64) * sizeof(HeadChild));
+		if (!grown)
+			return false;
+		*children = grown;
+		*cap = *cap * 2 + 64;
+	}
+	(*children)[(*count)++] = child;
+	return true;
+}
+
+// Group the HEAD files by their directories (once per HEAD array)
+static bool __head_dirs_validate()
+{
+	GitObjectArray *head = &curRepository->head.headFiles;
+	if (__headChildren && __headDirsArr == head->arr && __headDirsLen == head->len)
+		return true;
+	__head_dirs_clear();
+
+	// Each file has one child in its directory, and each directory one in its parent (The root is the first one)
+	HeadChild *children = NULL;
+	uint childCount = 0, childCap = 0;
+	bool ok = __head_dir_add("", 0) == 0;
+	for (uint i = 0; ok && i < head->len; i++)
+	{
+		constString path = head->arr[i].file.path;
+		char dirPath[PATH_MAX];
+		long parent = 0;
+		for (constString slash = strchr(path, '/'); ok && slash; slash = strchr(slash + 1, '/'))
+		{
+			memcpy(dirPath, path, slash - path);
+			dirPath[slash - path] = '\0';
+			long index = indexMapFind(&__headDirTable, dirPath);
+			if (index < 0) // A new subdirectory of its parent
+				ok = (index = __head_dir_add(dirPath, i)) >= 0 && __head_child_add(&children, &childCount, &childCap, (HeadChild){parent, i, true});
+			parent = index;
+		}
+		ok = ok && __head_child_add(&children, &childCount, &childCap, (HeadChild){parent, i, false});
+	}
+
+	// Sort the children by their directories (stable, so they stay in the order of HEAD files)
+	if (ok && (__headChildren = malloc((childCount + 1) * sizeof(HeadChild))))
+	{
+		for (uint i = 0; i < childCount; i++)
+			__headDirs[children[i].dir].childCount++;
+		for (uint i = 0, pos = 0; i < __headDirCount; i++)
+		{
+			__headDirs[i].firstChild = pos;
+			pos += __headDirs[i].childCount;
+			__headDirs[i].childCount = 0;
+		}
+		for (uint i = 0; i < childCount; i++)
+		{
+			HeadDir *dir = &__headDirs[children[i].dir];
+			__headChildren[dir->firstChild + dir->childCount++] = children[i];
+		}
+	}
+	free(children);
+	if (!__headChildren)
+	{
+		__head_dirs_clear();
+		return false;
+	}
+	__headDirsArr = head->arr;
+	__headDirsLen = head->len;
+	return true;
+}
+
 int lsWithHead(FileEntry **buf, constString path)
 {
 	FileEntry *__buf;
@@ -776,112 +1368,411 @@ int lsWithHead(FileEntry **buf, constString path)
 	if (__entry_count == -2)
 		return -2;
 
-	// Iterate over files in the HEAD commit , check if that are not in the working directory
-	for (int i = 0; i < curRepository->head.headFiles.len; i++)
+	// Get the absolute path of the input directory, and its path relative to the repository
+	char inputAbsPath[PATH_MAX] = "", rootPath[PATH_MAX] = "";
+	withString(s, normalizePath(path, NULL))
+		strcpy(inputAbsPath, s);
+	withString(s, normalizePath(curRepository->absPath, NULL))
+		strcpy(rootPath, s);
+	size_t rootLen = strlen(rootPath);
+	if (!*inputAbsPath || !*rootPath || strncmp(inputAbsPath, rootPath, rootLen) || (inputAbsPath[rootLen] && inputAbsPath[rootLen] != '/'))
+	{
+		*buf = __buf;
+		return __entry_count; // Not in the repository (It has no HEAD files)
+	}
+	constString relPath = inputAbsPath[rootLen] ? inputAbsPath + rootLen + 1 : "";
+
+	// Check if it is a deleted file of HEAD
+	if (access(inputAbsPath, F_OK) != 0 && getHEADFile(relPath, curRepository->head.headFiles))
+		return -2; // It's File. Not folder!
+
+	// The children of the directory in HEAD which are not in the working directory
+	long dirIndex = __head_dirs_validate() ? indexMapFind(&__headDirTable, relPath) : -1;
+	const HeadDir *dir = dirIndex >= 0 ? &__headDirs[dirIndex] : NULL;
+	for (uint i = 0; dir && i < dir->childCount; i++)
 	{
-		FileEntry *entry = &(curRepository->head.headFiles.arr[i].file);
-		char gitEntryAbsPath[PATH_MAX], gitEntryAbsParent[PATH_MAX], inputAbsPath[PATH_MAX];
+		const HeadChild *child = &__headChildren[dir->firstChild + i];
+		FileEntry *entry = &(curRepository->head.headFiles.arr[child->file].file);
+		char gitEntryAbsPath[PATH_MAX];
 
 		// Get the absolute path of the file in the HEAD commit
 		strcat_s(gitEntryAbsPath, curRepository->absPath, "/", entry->path);
-		// Get the absolute parent path of the file in the HEAD commit
-		getParentName(gitEntryAbsParent, gitEntryAbsPath);
-		// Get the absolute path of the input directory
-		withString(s, normalizePath(path, NULL))
-			strcpy(inputAbsPath, s);
+
+		if (child->isDir)
+		{
+			// The name of the subdirectory
+			char name[PATH_MAX];
+			constString start = entry->path + (*relPath ? strlen(relPath) + 1 : 0);
+			String end = strchr(strcpy(name, start), '/');
+			if (end)
+				*end = '\0';
+
+			// Check if it exists in the working directory (or is added before)
+			bool found = false;
+			for (int i = 0; i < __entry_count; i++)
+			{
+				if (!strcmp(getFileName(__buf[i].path), name))
+				{
+					found = true;
+					break;
+				}
+			}
+			if (!found)
+			{
+				// Add that deleted folder to the list
+				ADD_EMPTY(__buf, __entry_count, FileEntry);
+				__buf[__entry_count - 1].isDeleted = 1;
+				__buf[__entry_count - 1].isDir = 1;
+				__buf[__entry_count - 1].path = strcat_d(inputAbsPath, "/", name);
+				__buf[__entry_count - 1].permission = 0777;
+			}
+			continue;
+		}
 
 		// Check if the file already exists in the working directory
 		if (access(gitEntryAbsPath, F_OK) == 0)
 			continue; // Already exists in __buf
 
-		// Check if the file is a directory
-		if (isMatch(gitEntryAbsPath, inputAbsPath))
-			return -2; // It's File. Not folder!
+		// Add the entry to the list
+		ADD_EMPTY(__buf, __entry_count, FileEntry);
+		__buf[__entry_count - 1] = *entry;
+		__buf[__entry_count - 1].path = strDup(gitEntryAbsPath);
+		__buf[__entry_count - 1].isDeleted = true; // because it is not in the working tree now
+	}
+	*buf = __buf;
+	return __entry_count;
+}
+
+// Changed entries of the directories of the working tree (computed bottom-up once, and reused by lsChangedFiles)
+typedef struct _changed_dir_t
+{
+	String path;		// Absolute path of the directory
+	FileEntry *entries; // Changed entries (absolute paths)
+	int count;			// Number of changed entries (or the error of lsWithHead)
+} ChangedDir;
+
+static ChangedDir *__changedDirs = NULL;
+static uint __changedDirCount = 0, __changedDirCap = 0;
+static uint __changedDirsGeneration = 0; // __changesGeneration of the cached directories
+static bool __changedDirsHead = false;	 // _ls_head_changed_files of the cached directories
+
+static const void *__changed_dir_key(const void *ctx, uint index)
+{
+	return __changedDirs[index].path;
+}
+
+static IndexMap __changedDirTable = {NULL, 0, 0, __changed_dir_key, NULL, 0}; // Index of __changedDirs by path
+
+static void __changed_dirs_clear()
+{
+	for (uint i = 0; i < __changedDirCount; i++)
+	{
+		free(__changedDirs[i].path);
+		freeFileEntry(__changedDirs[i].entries, __changedDirs[i].count > 0 ? __changedDirs[i].count : 0);
+		free(__changedDirs[i].entries);
+	}
+	__changedDirCount = 0;
+	indexMapClear(&__changedDirTable);
+}
+
+// Add the result of a directory
+static void __changed_dir_add(String path, FileEntry *entries, int count)
+{
+	if (__changedDirCount == __changedDirCap)
+	{
+		uint newCap = __changedDirCap ? __changedDirCap * 2 : 64;
+		ChangedDir *dirs = realloc(__changedDirs, newCap * sizeof(ChangedDir));
+		if (dirs)
+		{
+			__changedDirs = dirs;
+			__changedDirCap = newCap;
+		}
+	}
+	if (__changedDirCount < __changedDirCap)
+	{
+		__changedDirs[__changedDirCount] = (ChangedDir){path, entries, count};
+		if (indexMapAdd(&__changedDirTable, __changedDirCount))
+		{
+			__changedDirCount++;
+			return;
+		}
+	}
+	// It is only a cache
+	free(path);
+	freeFileEntry(entries, count > 0 ? count : 0);
+	free(entries);
+}
+
+bool _ls_head_changed_files = true;
+
+// Find the changed entries of a directory (absolute path) and its subdirectories; subdirectories are done first,
+// so each entry of the tree is visited once. Returns the cached result of the directory.
+static const ChangedDir *__collect_changed_dir(constString dirPath)
+{
+	long index = indexMapFind(&__changedDirTable, dirPath);
+	if (index >= 0)
+		return &__changedDirs[index];
+
+	FileEntry *mybuf = NULL, *changed = NULL;
+	int count = lsWithHead(&mybuf, dirPath);
+
+	// Iterate over entries in the directory
+	int newCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		FileEntry local = getFileEntry(mybuf[i].path, curRepository->absPath);
+		// Check if the entry is a directory with changed files or a changed file
+		if (mybuf[i].isDir || getChangesFromStaging(local.path) || (_ls_head_changed_files && getChangesFromHEAD(local.path, curRepository->head.headFiles))) // The entry is a changed file
+		{
+			// Check if the entry is ignored or .neogit folder
+			if (isGitIgnore(&local) || isMatch(local.path, "." PROGRAM_NAME))
+				goto _continue;
+
+			// continue if directory doesn't have any changed entry
+			const ChangedDir *child = mybuf[i].isDir ? __collect_changed_dir(mybuf[i].path) : NULL;
+			if (mybuf[i].isDir && (!child || child->count <= 0))
+				goto _continue;
+
+			// Keep the entry (its path is moved)
+			ADD_EMPTY(changed, newCount, FileEntry);
+			changed[newCount - 1] = mybuf[i];
+			mybuf[i].path = NULL;
+		}
+	_continue:
+		freeFileEntry(&local, 1);
+	}
+	if (count > 0)
+	{
+		freeFileEntry(mybuf, count);
+		free(mybuf);
+	}
+
+	__changed_dir_add(strDup(dirPath), changed, count < 0 ? count : newCount);
+	index = indexMapFind(&__changedDirTable, dirPath);
+	return index >= 0 ? &__changedDirs[index] : NULL;
+}
+
+// The cached directories are valid until the staging area or HEAD is changed
+static void __changed_dirs_validate()
+{
+	if (__changedDirsGeneration != __changesGeneration || __changedDirsHead != _ls_head_changed_files)
+	{
+		__changed_dirs_clear();
+		__changedDirsGeneration = __changesGeneration;
+		__changedDirsHead = _ls_head_changed_files;
+	}
+}
+
+int lsChangedFiles(FileEntry **buf, constString dest)
+{
+	__changed_dirs_validate();
+	int count = -1;
+	withString(dirPath, normalizePath(dest, NULL))
+	{
+		const ChangedDir *dir = __collect_changed_dir(dirPath);
+		count = dir ? dir->count : -1;
+		// Copy the entries if the buffer is provided
+		if (buf && dir && count > 0)
+		{
+			*buf = malloc(count * sizeof(FileEntry));
+			for (int i = 0; *buf && i < count; i++)
+			{
+				(*buf)[i] = dir->entries[i];
+				(*buf)[i].path = strDup(dir->entries[i].path);
+			}
+			if (!*buf)
+				count = -1;
+		}
+	}
+	return count;
+}
+
+// An entry of a seeded directory, with its order in lsWithHead (entries of the working tree first, then the deleted
+// entries of HEAD in the order of HEAD files)
+typedef struct _seeded_entry_t
+{
+	uint dir; // Index of its directory in __changedDirs
+	FileEntry entry;
+	uint order; // 0 for the entries of the working tree, (index of its first file in HEAD + 1) for deleted entries
+} SeededEntry;
+
+static int __seeded_entry_comparator(const void *a, const void *b)
+{
+	const SeededEntry *e1 = a, *e2 = b;
+	if (e1->dir != e2->dir)
+		return e1->dir < e2->dir ? -1 : 1;
+	if (e1->order != e2->order)
+		return e1->order < e2->order ? -1 : 1;
+	if (e1->entry.isDir != e2->entry.isDir) // The same as ls: Directory first, Name Ascending
+		return e1->entry.isDir ? -1 : 1;
+	return strcasecmp(getFileName(e1->entry.path), getFileName(e2->entry.path));
+}
+
+// Check if a path (relative to the repository) is never listed by lsChangedFiles (.neogit folder, or ignored directories)
+static bool __is_skipped_path(constString path)
+{
+	size_t len = strlen("." PROGRAM_NAME);
+	if (!strncmp(path, "." PROGRAM_NAME, len) && (!path[len] || path[len] == '/'))
+		return true;
+	char dirPath[PATH_MAX];
+	strcpy(dirPath, path);
+	for (String slash = strrchr(dirPath, '/'); slash; slash = strrchr(dirPath, '/'))
+	{
+		*slash = '\0';
+		FileEntry dir = {.path = dirPath, .isDir = 1};
+		if (isGitIgnore(&dir))
+			return true;
+	}
+	return false;
+}
+
+// Index of the first HEAD file under a deleted directory (relative to the repository)
+static uint __first_head_file_under(constString dirPath)
+{
+	long index = __head_dirs_validate() ? indexMapFind(&__headDirTable, dirPath) : -1;
+	return index >= 0 ? __headDirs[index].firstFile : curRepository->head.headFiles.len;
+}
+
+void setChangedFiles(constString *paths, uint count)
+{
+	__changed_dirs_validate();
+	__changed_dirs_clear();
+
+	String root = normalizePath(curRepository->absPath, NULL);
+	if (!root)
+		return;
+	__changed_dir_add(root, NULL, 0);
+	if (!__changedDirCount)
+		return;
+	size_t rootLen = strlen(root);
+
+	// Add each file and its parent directories to their directories (once)
+	SeededEntry *seeded = NULL;
+	uint seededCount = 0;
+	StringSet added;
+	stringSetInit(&added, count * 2);
+	for (uint i = 0; i < count; i++)
+	{
+		// Only the entries which lsWithHead lists are added (existing files, or deleted files of HEAD)
+		constString path = paths[i];
+		char absPath[PATH_MAX];
+		strcat_s(absPath, __changedDirs[0].path, "/", path);
+		GitObject *headFile = NULL;
+		bool exists = access(absPath, F_OK) == 0;
+		if (__is_skipped_path(path) || (!exists && !(headFile = getHEADFile(path, curRepository->head.headFiles))))
+			continue;
 
-		// Check if the file belongs to the requested path
-		if (!isMatch(gitEntryAbsParent, inputAbsPath))
+		uint parent = 0;
+		for (String slash = absPath + rootLen; slash; slash = strchr(slash + 1, '/'))
 		{
-			// it's probable that this file belongs to subchilds of this root! (a deleted folder!!)
-			String s = normalizePath(gitEntryAbsPath, inputAbsPath);
+			String next = strchr(slash + 1, '/');
+			if (next)
+				*next = '\0';
+			long index = indexMapFind(&__changedDirTable, absPath);
+			if (!stringSetAdd(&added, absPath))
+			{
+				// Already added (It is a directory, unless the same file is given twice)
+				if (!next || index < 0)
+					break;
+				parent = index;
+				*next = '/';
+				continue;
+			}
 
-			if (s != NULL) // Yes!! it's under a deleted folder!
+			// The entry of the working tree, or of HEAD if it is deleted
+			ADD_EMPTY(seeded, seededCount, SeededEntry);
+			SeededEntry *entry = &seeded[seededCount - 1];
+			entry->dir = parent;
+			entry->order = 0;
+			if (access(absPath, F_OK) == 0)
+				entry->entry = getFileEntry(absPath, NULL);
+			else if (next) // Deleted directory
 			{
-				// if the entry has been added  before, don't add again
-				bool found = false;
-				for (int i = 0; i < __entry_count; i++)
-				{
-					if (!strcmp(getFileName(__buf[i].path), strtok(s, "/")))
-					{
-						found = true;
-						break;
-					}
-				}
-				if (!found)
-				{
-					// Add that deleted folder to the list
-					ADD_EMPTY(__buf, __entry_count, FileEntry);
-					__buf[__entry_count - 1].isDeleted = 1;
-					__buf[__entry_count - 1].isDir = 1;
-					__buf[__entry_count - 1].path = strcat_d(inputAbsPath, "/", strtok(s, "/"));
-					__buf[__entry_count - 1].permission = 0777;
-				}
-				free(s);
+				entry->entry = (FileEntry){.path = strDup(absPath), .isDir = 1, .isDeleted = 1, .permission = 0777};
+				entry->order = __first_head_file_under(absPath + rootLen + 1) + 1;
 			}
-			continue;
+			else if (headFile) // Deleted file
+			{
+				entry->entry = headFile->file;
+				entry->entry.path = strDup(absPath);
+				entry->entry.isDeleted = true;
+				entry->order = headFile - curRepository->head.headFiles.arr + 1;
+			}
+			else // Deleted just now
+			{
+				seededCount--;
+				break;
+			}
+			if (!next)
+				break;
+
+			// Its directory
+			if (index < 0)
+			{
+				__changed_dir_add(strDup(absPath), NULL, 0);
+				if ((index = indexMapFind(&__changedDirTable, absPath)) < 0)
+					break;
+			}
+			parent = index;
+			*next = '/';
 		}
+	}
+	stringSetFree(&added);
 
-		// Add the entry to the list
-		ADD_EMPTY(__buf, __entry_count, FileEntry);
-		__buf[__entry_count - 1] = *entry;
-		__buf[__entry_count - 1].path = strDup(gitEntryAbsPath);
-		__buf[__entry_count - 1].isDeleted = true; // because it is not in the working tree now
+	// Sort the entries of each directory, and move them to the directories
+	qsort(seeded, seededCount, sizeof(SeededEntry), __seeded_entry_comparator);
+	for (uint i = 0; i < seededCount;)
+	{
+		uint end = i;
+		while (end < seededCount && seeded[end].dir == seeded[i].dir)
+			end++;
+		ChangedDir *dir = &__changedDirs[seeded[i].dir];
+		if ((dir->entries = malloc((end - i) * sizeof(FileEntry))))
+			for (dir->count = 0; i < end; i++)
+				dir->entries[dir->count++] = seeded[i].entry;
+		else
+			for (; i < end; i++)
+				free(seeded[i].entry.path);
 	}
-	*buf = __buf;
-	return __entry_count;
+	free(seeded);
 }
 
-bool _ls_head_changed_files = true;
-int lsChangedFiles(FileEntry **buf, constString dest)
+uint listChangedFiles(String **dest)
 {
-	FileEntry *mybuf = NULL;
-	int count = lsWithHead(&mybuf, dest);
-
-	// Check if there are no entries in the destination directory
-	if (count <= 0)
-		return count;
+	*dest = NULL;
+	uint count = 0;
+	if (lsChangedFiles(NULL, curRepository->absPath) < 0 || !__changedDirCount)
+		return 0;
 
-	// Iterate over entries in the destination directory
-	int newCount = 0;
-	for (int i = 0; i < count; i++)
+	// The changed files of the walk (relative to the repository)
+	withString(root, normalizePath(curRepository->absPath, NULL))
 	{
-		FileEntry local = getFileEntry(mybuf[i].path, curRepository->absPath);
-		// Check if the entry is a directory with changed files or a changed file
-		if (mybuf[i].isDir || getChangesFromStaging(local.path) || (_ls_head_changed_files && getChangesFromHEAD(local.path, curRepository->head.headFiles))) // The entry is a changed file
-		{
-			// Check if the entry is ignored or .neogit folder
-			if (isGitIgnore(&local) || isMatch(local.path, "." PROGRAM_NAME))
-				goto _continue;
-
-			// continue if directory doesn't have any changed entry
-			if (mybuf[i].isDir && !lsChangedFiles(NULL, mybuf[i].path))
-				goto _continue;
-
-			// Check if the buffer is provided, and add the entry to the buffer
-			if (buf)
+		size_t rootLen = strlen(root);
+		for (uint i = 0; i < __changedDirCount; i++)
+			for (int j = 0; j < __changedDirs[i].count; j++)
 			{
-				ADD_EMPTY(*buf, newCount, FileEntry);
-				(*buf)[newCount - 1] = mybuf[i];
-				((*buf)[newCount - 1]).path = strDup(mybuf[i].path);
+				constString path = __changedDirs[i].entries[j].path;
+				if (__changedDirs[i].entries[j].isDir || strncmp(path, root, rootLen) || path[rootLen] != '/')
+					continue;
+				ADD_EMPTY(*dest, count, String);
+				(*dest)[count - 1] = strDup(path + rootLen + 1);
 			}
-			else // else , just increament the counter
-				newCount++;
+	}
+
+	// Staged files which are deleted from the working tree are not listed if they are not in HEAD
+	GitObjectArray *stage = &curRepository->stagingArea;
+	for (uint i = 0; i < stage->len; i++)
+	{
+		char absPath[PATH_MAX];
+		constString path = stage->arr[i].file.path;
+		if (!stage->arr[i].file.isDeleted && access(strcat_s(absPath, curRepository->absPath, "/", path), F_OK) != 0 &&
+			!getHEADFile(path, curRepository->head.headFiles))
+		{
+			ADD_EMPTY(*dest, count, String);
+			(*dest)[count - 1] = strDup(path);
 		}
-	_continue:
-		freeFileEntry(&local, 1);
 	}
-	freeFileEntry(mybuf, count);
-	free(mybuf);
-	return newCount;
+	return count;
 }
 
 ///////////////////// FUNCTIONS RELATED TO COMMITS/BRANCH/CHECKOUT/... ////////////////////////
@@ -911,14 +1802,27 @@ void freeGitObjectArray(GitObjectArray *array)
 	}
 }
 
+static bool __is_commit_exist(uint64_t hash)
+{
+	FILE *commitFile = openCommitFile(hash);
+	if (commitFile)
+		fclose(commitFile);
+	return commitFile != NULL;
+}
+
 Commit *createCommit(GitObjectArray *filesToCommit, constString username, constString email, constString message, uint64_t mergedHash)
 {
 	if (curRepository->deatachedHead)
 		return NULL;
 
 	HEAD *head = &(curRepository->head);
-	Commit *newCommit = malloc(sizeof(Commit));
-	newCommit->hash = generateUniqueId(6);
+	Commit *newCommit = calloc(1, sizeof(Commit));
+	// The ID depends on the time, so two commits in the same second may get the same one
+	char commitPath[PATH_MAX], commitDir[PATH_MAX];
+	do
+		newCommit->hash = generateUniqueId(6);
+	while (newCommit->hash == 0 || newCommit->hash == 0xFFFFFF || __is_commit_exist(newCommit->hash));
+	getCommitPath(commitPath, newCommit->hash);
 	newCommit->prev = head->hash;
 	newCommit->branch = strDup(head->branch);
 	newCommit->message = strDup(message);
@@ -927,6 +1831,8 @@ Commit *createCommit(GitObjectArray *filesToCommit, constString username, constS
 	newCommit->time = time(NULL);
 	newCommit->mergedCommit = mergedHash;
 	copyGitObjectArray(&newCommit->commitedFiles, filesToCommit);
+	newCommit->commitedCount = newCommit->commitedFiles.len;
+	newCommit->commitedFilesLoaded = newCommit->headFilesLoaded = true;
 
 	// Update head files
 	copyGitObjectArray(&newCommit->headFiles, &curRepository->head.headFiles);
@@ -953,14 +1859,20 @@ Commit *createCommit(GitObjectArray *filesToCommit, constString username, constS
 		}
 	}
 
-	// Create commit file path
-	char commitPath[PATH_MAX];
-	sprintf(commitPath, "%s/." PROGRAM_NAME "/commits/%06lx", curRepository->absPath, newCommit->hash);
-	systemf("mkdir -p \"%s/." PROGRAM_NAME "/commits\"", curRepository->absPath);
-	systemf("touch \"%s\"", commitPath);
+	// Write the trees of the changed directories (others are shared with the previous commit)
+	int treeError = *head->treeHash ? writeTree(head->treeHash, &newCommit->commitedFiles, newCommit->treeHash)
+									: writeTree(NULL, &newCommit->headFiles, newCommit->treeHash);
+	if (treeError != ERR_NOERR)
+	{
+		freeCommitStruct(newCommit);
+		return NULL;
+	}
+
+	// Create commit directory
+	makeDirs(getParentName(commitDir, commitPath));
 
 	// Open and write to the commit file
-	tryWithFile(commitFile, commitPath, ({ return NULL; }), ({ return NULL; }))
+	tryWith(FILE *, commitFile, fopen(commitPath, "w"), ({ return NULL; }), ({ return NULL; }), fclose(commitFile))
 	{
 		// Commit File Structure:
 		// Line 1 : "<username>:<email>:<time>:<branch>"
@@ -969,7 +1881,8 @@ Commit *createCommit(GitObjectArray *filesToCommit, constString username, constS
 		// Line 4 : "[<a>]:[<b>]"   // a : number of commit files , b : number of head files
 		// Line 5 -> 4+a : Commited files (same format with staging info)
 		// Line 5+a : \n
-		// Line 6+a -> 5+a+b : HEAD files (same format with staging info)
+		// Line 6+a : "[tree]:<root-tree-hash>" (HEAD files are in the tree objects; see trees.h)
+		// (Old commits have the HEAD files in lines 6+a -> 5+a+b, in the same format with staging info)
 		fprintf(commitFile, "%s:%s:%ld:%s\n", newCommit->username, newCommit->useremail, newCommit->time, newCommit->branch);
 		if (newCommit->mergedCommit)
 			fprintf(commitFile, "[perv]:%06lx:[merged]:%06lx\n", newCommit->prev, newCommit->mergedCommit);
@@ -984,122 +1897,436 @@ Commit *createCommit(GitObjectArray *filesToCommit, constString username, constS
 			fprintf(commitFile, "%s:%ld:%u:%s\n", sf->file.path, sf->file.dateModif, sf->file.permission, sf->hashStr);
 		}
 		fputs("\n", commitFile);
-		for (int i = 0; i < newCommit->headFiles.len; i++)
-		{
-			GitObject *sf = &(newCommit->headFiles.arr[i]);
-			// <path>:<timeModif>:<perm>:<10digitHash>
-			fprintf(commitFile, "%s:%ld:%u:%s\n", sf->file.path, sf->file.dateModif, sf->file.permission, sf->hashStr);
-		}
+		fprintf(commitFile, "[tree]:%s\n", newCommit->treeHash);
 	}
+	addCommitToGraph(newCommit); // A failure is fixed by rebuilding the graph on the next lookup
 
 	// Update head hash
 	curRepository->head.hash = newCommit->hash;
+	strcpy(curRepository->head.treeHash, newCommit->treeHash);
 	// Update current branch head
 	setBranchHead(newCommit->branch, newCommit->hash);
 
 	return newCommit;
 }
 
-Commit *getCommit(uint64_t hash)
+String getCommitPath(String dest, uint64_t hash)
+{
+	char commitsPath[PATH_MAX], name[20];
+	strcat_s(commitsPath, curRepository->absPath, "/." PROGRAM_NAME "/commits");
+	sprintf(name, "%06lx", hash);
+	return getShardedPath(dest, commitsPath, name);
+}
+
+uint listCommitHashes(uint64_t **dest)
+{
+	uint64_t *hashes = NULL;
+	uint count = 0;
+	char commitsPath[PATH_MAX];
+	strcat_s(commitsPath, curRepository->absPath, "/." PROGRAM_NAME "/commits");
+
+	// Commit files are in shard directories (or directly in commits/ in repositories which are not migrated yet)
+	tryWith(DIR *, dir, opendir(commitsPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (entry->d_name[0] == '.')
+				continue;
+			uint64_t hash;
+			if (strlen(entry->d_name) == SHARD_PREFIX_LEN)
+			{
+				char shardPath[PATH_MAX];
+				tryWith(DIR *, shard, opendir(strcat_s(shardPath, commitsPath, "/", entry->d_name)), {}, {}, closedir(shard))
+				{
+					struct dirent *shardEntry;
+					while ((shardEntry = readdir(shard)) != NULL)
+						if (shardEntry->d_name[0] != '.' && sscanf(shardEntry->d_name, "%lx", &hash) == 1)
+						{
+							ADD_EMPTY(hashes, count, uint64_t);
+							hashes[count - 1] = hash;
+						}
+				}
+			}
+			else if (sscanf(entry->d_name, "%lx", &hash) == 1)
+			{
+				ADD_EMPTY(hashes, count, uint64_t);
+				hashes[count - 1] = hash;
+			}
+		}
+	}
+	*dest = hashes;
+	return count;
+}
+
+// Get the path of a commit file (sharded, or in the flat layout if not migrated)
+static String __find_commit_path(String dest, uint64_t hash)
+{
+	if (access(getCommitPath(dest, hash), F_OK) != 0) // not migrated to the sharded layout
+		sprintf(dest, "%s/." PROGRAM_NAME "/commits/%06lx", curRepository->absPath, hash);
+	return dest;
+}
+
+FILE *openCommitFile(uint64_t hash)
+{
+	char commitPath[PATH_MAX];
+	return fopen(__find_commit_path(commitPath, hash), "rb");
+}
+
+static bool __open_commit_tokenizer(uint64_t hash, Tokenizer *tokenizer)
 {
-	Commit *dynamic_allocated_commit = NULL;
 	char commitPath[PATH_MAX];
-	sprintf(commitPath, "%s/." PROGRAM_NAME "/commits/%06lx", curRepository->absPath, hash);
-	tryWithFile(commitFile, commitPath, ({ return NULL; }), ({ return NULL; }))
+	return openTokenizer(tokenizer, __find_commit_path(commitPath, hash));
+}
+
+// Commit File Structure:
+// Line 1 : "<username>:<email>:<time>:<branch>"
+// Line 2 : "[perv]:<pervHash>" or  "[perv]:<pervHash>:[merged]:<mergedHash>"
+// Line 3 : "[message]:[<message>]"
+// Line 4 : "[<a>]:[<b>]"   // a : number of commit files , b : number of head files
+// Line 5 -> 4+a : Commited files (same format with staging info)
+// Line 5+a : \n
+// Line 6+a : "[tree]:<root-tree-hash>" (or the HEAD files in lines 6+a -> 5+a+b in old commits)
+
+// Parse the first 4 lines of a commit file (commit is NULL for only skipping them)
+static bool __read_commit_header_lines(Tokenizer *tokenizer, Commit *commit, uint *commitedCountDest, uint *headCountDest)
+{
+	StrView line, name, email, time, branch, prev, field, merged = {NULL, 0}, message, commitedCount, headCount;
+	uint64_t timeValue, prevValue, mergedValue = 0, commitedValue, headValue;
+
+	// The branch is the rest of the first line
+	if (!nextLine(tokenizer, &line) || !nextField(&line, ":", &name) || !nextField(&line, ":", &email) || !nextField(&line, ":", &time) ||
+		!nextField(&line, "\n", &branch) || !name.len || !email.len || !branch.len || !viewToU64(time, 10, &timeValue) || !timeValue)
+		return false;
+	if (!nextLine(tokenizer, &line) || !nextField(&line, ":", &field) || !viewEquals(field, "[perv]") || !nextField(&line, ":", &prev) ||
+		!viewToU64(prev, 16, &prevValue) || !prevValue)
+		return false;
+	if (nextField(&line, ":", &field) && (!viewEquals(field, "[merged]") || !nextField(&line, ":", &merged) || !viewToU64(merged, 16, &mergedValue)))
+		return false;
+	if (!nextLine(tokenizer, &message) || !viewSkipPrefix(&message, "[message]:[") || !message.len || message.str[message.len - 1] != ']' || !--message.len)
+		return false;
+	if (!nextLine(tokenizer, &line) || !viewSkipPrefix(&line, "[") || !nextField(&line, "]:[", &commitedCount) || !nextField(&line, "]", &headCount) ||
+		!viewToU64(commitedCount, 10, &commitedValue) || !viewToU64(headCount, 10, &headValue))
+		return false;
+
+	*commitedCountDest = commitedValue;
+	*headCountDest = headValue;
+	if (commit)
 	{
-		char name[STR_MAX] = {0}, email[STR_MAX] = {0}, branch[STR_MAX] = {0};
-		char message[COMMIT_MSG_LEN_MAX] = {0};
-		Commit commit = {0, NULL, NULL, 0, NULL, NULL, {NULL, 0}, {NULL, 0}, 0, 0};
-		// Commit File Structure:
-		// Line 1 : "<username>:<email>:<time>:<branch>"
-		// Line 2 : "[perv]:<pervHash>" or  "[perv]:<pervHash>:[merged]:<mergedHash>"
-		// Line 3 : "[message]:[<message>]"
-		// Line 4 : "[<a>]:[<b>]"   // a : number of commit files , b : number of head files
-		// Line 5 -> 4+a : Commited files (same format with staging info)
-		// Line 5+a : \n
-		// Line 6+a -> 5+a+b : HEAD files (same format with staging info)
-		fscanf(commitFile, "%[^:]:%[^:]:%ld:%[^\n]\n", name, email, &(commit.time), branch);
-		if (!*name || !*email || !commit.time || !*branch)
-			throw(0);
-		char str[STR_LINE_MAX];
-		fgets(str, STR_LINE_MAX, commitFile);
-		commit.prev = 0xFFFFFF;
-		commit.mergedCommit = 0;
-		sscanf(str, "[perv]:%lx:[merged]:%lx\n", &(commit.prev), &(commit.mergedCommit));
-		sscanf(str, "[perv]:%lx", &(commit.prev));
-		if (!commit.prev)
-			throw(0);
-		fscanf(commitFile, "[message]:[%[^]]]\n", message);
-		if (!*message)
-			throw(0);
-		if (fscanf(commitFile, "[%u]:[%u]\n", &(commit.commitedFiles.len), &(commit.headFiles.len)) != 2)
-			throw(0);
-
-		commit.hash = hash;
-		commit.username = strDup(name);
-		commit.useremail = strDup(email);
-		commit.branch = strDup(branch);
-		commit.message = strDup(message);
-
-		commit.commitedFiles.arr = malloc(sizeof(GitObject) * commit.commitedFiles.len);
-		commit.headFiles.arr = malloc(sizeof(GitObject) * commit.headFiles.len);
-
-		for (int i = 0; i < commit.commitedFiles.len; i++)
+		commit->time = timeValue;
+		commit->prev = prevValue;
+		commit->mergedCommit = mergedValue;
+		commit->username = viewDup(name);
+		commit->useremail = viewDup(email);
+		commit->branch = viewDup(branch);
+		commit->message = viewDup(message);
+		commit->commitedCount = commitedValue;
+	}
+	return true;
+}
+
+// Parse (or skip if dest is NULL) a list of files in the format of staging info
+static bool __read_commit_file_lines(Tokenizer *tokenizer, uint count, GitObjectArray *dest)
+{
+	if (dest)
+	{
+		dest->arr = calloc(count + 1, sizeof(GitObject));
+		dest->len = 0;
+		if (!dest->arr)
+			return false;
+	}
+	StrView line;
+	for (uint i = 0; i < count; i++)
+	{
+		// Empty lines are skipped (e.g. the one before the HEAD files of old commits)
+		bool found;
+		while ((found = nextLine(tokenizer, &line)) && !line.len)
+			;
+		if (!found)
+			return false;
+		if (!dest)
+			continue;
+		if (!__parse_object_line(line, &dest->arr[i]))
+			return false;
+		dest->len++;
+	}
+	return true;
+}
+
+// Parse the header of a commit file (see getCommitHeader)
+static bool __read_commit_header(uint64_t hash, Commit *dest)
+{
+	Tokenizer tokenizer;
+	if (!__open_commit_tokenizer(hash, &tokenizer))
+		return false;
+	uint commitedCount = 0, headCount = 0;
+	bool ok = __read_commit_header_lines(&tokenizer, dest, &commitedCount, &headCount) && __read_commit_file_lines(&tokenizer, commitedCount, NULL);
+	if (ok)
+	{
+		dest->hash = hash;
+
+		// The tree hash follows the committed files and an empty line (old commits have no tree)
+		StrView line = {NULL, 0};
+		while (nextLine(&tokenizer, &line) && !line.len)
+			;
+		if (!viewSkipPrefix(&line, "[tree]:") || line.len != OBJ_HASH_LEN || !viewCopy(dest->treeHash, sizeof(dest->treeHash), line))
+			*dest->treeHash = '\0';
+	}
+	closeTokenizer(&tokenizer);
+	return ok;
+}
+
+///////////////////// Commit cache ////////////////////////
+
+// An entry of the commit cache (the commit is the first member, so a cached commit is its entry)
+typedef struct _commit_cache_entry_t
+{
+	Commit commit;
+	size_t size;								/**< Estimated memory of the commit (updated when it is released). */
+	struct _commit_cache_entry_t *next;			/**< Next entry in the same bucket. */
+	struct _commit_cache_entry_t *lruPrev;		/**< More recently used entry. */
+	struct _commit_cache_entry_t *lruNext;		/**< Less recently used entry. */
+} CommitCacheEntry;
+
+static CommitCacheEntry **__cacheBuckets = NULL;
+static uint __cacheBucketCount = 0, __cacheCount = 0;
+static CommitCacheEntry *__cacheLruHead = NULL, *__cacheLruTail = NULL;
+static size_t __cacheSize = 0, __cacheLimit = 0;
+static uint64_t __cacheHits = 0, __cacheMisses = 0, __cacheEvictions = 0;
+
+static void __free_commit_fields(Commit *object)
+{
+	if (object->branch)
+		free(object->branch);
+	if (object->username)
+		free(object->username);
+	if (object->useremail)
+		free(object->useremail);
+	if (object->message)
+		free(object->message);
+	freeGitObjectArray(&object->commitedFiles);
+	freeGitObjectArray(&object->headFiles);
+}
+
+static size_t __commit_memory_size(const Commit *commit)
+{
+	size_t size = sizeof(CommitCacheEntry) + strlen(commit->branch) + strlen(commit->username) + strlen(commit->useremail) + strlen(commit->message);
+	const GitObjectArray *arrays[2] = {&commit->commitedFiles, &commit->headFiles};
+	for (int i = 0; i < 2; i++)
+		for (uint j = 0; arrays[i]->arr && j < arrays[i]->len; j++)
+			size += sizeof(GitObject) + strlen(arrays[i]->arr[j].file.path) + 1;
+	return size;
+}
+
+// Report the counters of the cache (NEOGIT_TRACE=1)
+static void __trace_commit_cache()
+{
+	fprintf(stderr, "[trace] commit cache : %lu hit(s), %lu miss(es), %lu eviction(s), %u commit(s) / %zu bytes cached\n",
+			__cacheHits, __cacheMisses, __cacheEvictions, __cacheCount, __cacheSize);
+}
+
+static void __init_commit_cache()
+{
+	uint64_t limit = COMMIT_CACHE_SIZE_DEFAULT;
+	withString(value, getConfig(COMMIT_CACHE_SIZE_CONFIG))
+		parseSize(value, &limit);
+	__cacheLimit = limit;
+	__cacheBucketCount = 256;
+	__cacheBuckets = calloc(__cacheBucketCount, sizeof(CommitCacheEntry *));
+	if (getenv(TRACE_ENV))
+		atexit(__trace_commit_cache);
+}
+
+static uint __cache_bucket(uint64_t hash)
+{
+	return (uint)((hash * 0x9E3779B97F4A7C15ULL) >> 32) & (__cacheBucketCount - 1);
+}
+
+static void __cache_lru_unlink(CommitCacheEntry *entry)
+{
+	if (entry->lruPrev)
+		entry->lruPrev->lruNext = entry->lruNext;
+	else
+		__cacheLruHead = entry->lruNext;
+	if (entry->lruNext)
+		entry->lruNext->lruPrev = entry->lruPrev;
+	else
+		__cacheLruTail = entry->lruPrev;
+	entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void __cache_lru_push_front(CommitCacheEntry *entry)
+{
+	entry->lruPrev = NULL;
+	entry->lruNext = __cacheLruHead;
+	if (__cacheLruHead)
+		__cacheLruHead->lruPrev = entry;
+	__cacheLruHead = entry;
+	if (!__cacheLruTail)
+		__cacheLruTail = entry;
+}
+
+// Double the buckets when there are more entries than buckets
+static void __cache_grow()
+{
+	CommitCacheEntry **buckets = calloc(__cacheBucketCount * 2, sizeof(CommitCacheEntry *));
+	if (!buckets)
+		return;
+	CommitCacheEntry **old = __cacheBuckets;
+	uint oldCount = __cacheBucketCount;
+	__cacheBuckets = buckets;
+	__cacheBucketCount *= 2;
+	for (uint i = 0; i < oldCount; i++)
+		for (CommitCacheEntry *entry = old[i], *next; entry; entry = next)
+		{
+			next = entry->next;
+			uint b = __cache_bucket(entry->commit.hash);
+			entry->next = __cacheBuckets[b];
+			__cacheBuckets[b] = entry;
+		}
+	free(old);
+}
+
+// Evict the least recently used commits which are not in use, until the cache fits in its limit
+static void __cache_evict()
+{
+	for (CommitCacheEntry *entry = __cacheLruTail, *prev; entry && __cacheSize > __cacheLimit; entry = prev)
+	{
+		prev = entry->lruPrev;
+		if (entry->commit.refCount)
+			continue;
+		CommitCacheEntry **link = &__cacheBuckets[__cache_bucket(entry->commit.hash)];
+		while (*link != entry)
+			link = &(*link)->next;
+		*link = entry->next;
+		__cache_lru_unlink(entry);
+		__cacheSize -= entry->size;
+		__cacheCount--;
+		__cacheEvictions++;
+		__free_commit_fields(&entry->commit);
+		free(entry);
+	}
+}
+
+Commit *getCommitHeader(uint64_t hash)
+{
+	if (!__cacheBuckets)
+		__init_commit_cache();
+
+	for (CommitCacheEntry *entry = __cacheBuckets ? __cacheBuckets[__cache_bucket(hash)] : NULL; entry; entry = entry->next)
+		if (entry->commit.hash == hash)
 		{
-			char filePath[PATH_MAX];
-			time_t timeM = 0;
-			uint perm = 0;
-			char hash[11];
-			fscanf(commitFile, "%[^:]:%ld:%u:%s\n", filePath, &timeM, &perm, hash);
-
-			GitObject *sf = &(commit.commitedFiles.arr[i]);
-			sf->file.path = strDup(filePath);
-			strcpy(sf->hashStr, hash);
-			sf->file.dateModif = timeM;
-			sf->file.isDeleted = (strcmp("dddddddddd", hash) == 0);
-			sf->file.isDir = (strcmp("dirdirdird", hash) == 0);
-			sf->file.permission = perm;
+			__cacheHits++;
+			entry->commit.refCount++;
+			__cache_lru_unlink(entry);
+			__cache_lru_push_front(entry);
+			return &entry->commit;
 		}
 
-		for (int i = 0; i < commit.headFiles.len; i++)
+	__cacheMisses++;
+	CommitCacheEntry *entry = calloc(1, sizeof(CommitCacheEntry));
+	if (!entry)
+		return NULL;
+	if (!__read_commit_header(hash, &entry->commit) || !__cacheBuckets)
+	{
+		__free_commit_fields(&entry->commit);
+		free(entry);
+		return NULL;
+	}
+	entry->commit.cached = true;
+	entry->commit.refCount = 1;
+	entry->size = __commit_memory_size(&entry->commit);
+	if (__cacheCount >= __cacheBucketCount)
+		__cache_grow();
+	uint b = __cache_bucket(hash);
+	entry->next = __cacheBuckets[b];
+	__cacheBuckets[b] = entry;
+	__cache_lru_push_front(entry);
+	__cacheCount++;
+	__cacheSize += entry->size;
+	return &entry->commit;
+}
+
+GitObjectArray *getCommitedFiles(Commit *commit)
+{
+	if (commit->commitedFilesLoaded)
+		return &commit->commitedFiles;
+	bool loaded = false;
+	Tokenizer tokenizer;
+	if (__open_commit_tokenizer(commit->hash, &tokenizer))
+	{
+		uint commitedCount = 0, headCount = 0;
+		loaded = __read_commit_header_lines(&tokenizer, NULL, &commitedCount, &headCount) &&
+				 __read_commit_file_lines(&tokenizer, commitedCount, &commit->commitedFiles);
+		closeTokenizer(&tokenizer);
+	}
+	if (!loaded)
+	{
+		freeGitObjectArray(&commit->commitedFiles);
+		commit->commitedFiles = (GitObjectArray){NULL, 0};
+		return NULL;
+	}
+	commit->commitedFilesLoaded = true;
+	return &commit->commitedFiles;
+}
+
+GitObjectArray *getCommitHeadFiles(Commit *commit)
+{
+	if (commit->headFilesLoaded)
+		return &commit->headFiles;
+	bool loaded = false;
+	Tokenizer tokenizer;
+	if (__open_commit_tokenizer(commit->hash, &tokenizer))
+	{
+		uint commitedCount = 0, headCount = 0;
+		if (__read_commit_header_lines(&tokenizer, NULL, &commitedCount, &headCount) && __read_commit_file_lines(&tokenizer, commitedCount, NULL))
 		{
-			char filePath[PATH_MAX];
-			time_t timeM = 0;
-			uint perm = 0;
-			char hash[11];
-			fscanf(commitFile, "\n%[^:]:%ld:%u:%s\n", filePath, &timeM, &perm, hash);
-
-			GitObject *sf = &(commit.headFiles.arr[i]);
-			sf->file.path = strDup(filePath);
-			strcpy(sf->hashStr, hash);
-			sf->file.dateModif = timeM;
-			sf->file.isDeleted = (strcmp("dddddddddd", hash) == 0);
-			sf->file.isDir = (strcmp("dirdirdird", hash) == 0);
-			sf->file.permission = perm;
+			// HEAD files are loaded from the tree
+			if (*commit->treeHash)
+				loaded = loadTreeFiles(commit->treeHash, &commit->headFiles) == ERR_NOERR && commit->headFiles.len == headCount;
+			else
+				loaded = __read_commit_file_lines(&tokenizer, headCount, &commit->headFiles);
 		}
-		if (ferror(commitFile))
-			throw(0);
+		closeTokenizer(&tokenizer);
+	}
+	// A commit with a missing (or corrupted) tree must not be used as if it had no files
+	if (!loaded)
+	{
+		freeGitObjectArray(&commit->headFiles);
+		commit->headFiles = (GitObjectArray){NULL, 0};
+		return NULL;
+	}
+	commit->headFilesLoaded = true;
+	return &commit->headFiles;
+}
 
-		dynamic_allocated_commit = malloc(sizeof(Commit));
-		*dynamic_allocated_commit = commit;
+Commit *getCommit(uint64_t hash)
+{
+	Commit *commit = getCommitHeader(hash);
+	if (commit && (!getCommitedFiles(commit) || !getCommitHeadFiles(commit)))
+	{
+		freeCommitStruct(commit);
+		return NULL;
 	}
-	return dynamic_allocated_commit;
+	return commit;
 }
 
 void freeCommitStruct(Commit *object)
 {
-	if (object)
-	{
-		if (object->branch)
-			free(object->branch);
-		if (object->username)
-			free(object->username);
-		if (object->useremail)
-			free(object->useremail);
-		if (object->message)
-			free(object->message);
-		freeGitObjectArray(&object->commitedFiles);
-		freeGitObjectArray(&object->headFiles);
+	if (object && object->cached)
+	{
+		// Release the commit; its memory may be grown by lazily loaded files
+		CommitCacheEntry *entry = (CommitCacheEntry *)object;
+		if (object->refCount)
+			object->refCount--;
+		__cacheSize -= entry->size;
+		entry->size = __commit_memory_size(object);
+		__cacheSize += entry->size;
+		__cache_evict();
+	}
+	else if (object)
+	{
+		__free_commit_fields(object);
 		free(object);
 	}
 }
@@ -1111,7 +2338,7 @@ int listBranches(String *namesDest, uint64_t *hashesDest)
 	// Construct the path for the branches file
 	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/branches");
 	// Ensure the branches file exists
-	systemf("touch \"%s\"", path);
+	ensureFile(path);
 	tryWithFile(branchesFile, path, ({ return -1; }), __retTry)
 	{
 		// Loop through branches file lines and read names and hashes
@@ -1131,7 +2358,7 @@ int setBranchHead(constString branchName, uint64_t commitHash)
 	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/branches");
 
 	// Ensure the branches file exists
-	systemf("touch \"%s\"", path);
+	ensureFile(path);
 	tryWithFile(branchesFile, path, ({ return ERR_FILE_ERROR; }), __retTry)
 	{
 		char content[STR_LINE_MAX];
@@ -1157,7 +2384,7 @@ uint64_t getBranchHead(constString branchName)
 {
 	char path[PATH_MAX];
 	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/branches");
-	systemf("touch \"%s\"", path);
+	ensureFile(path);
 	tryWithFile(branchesFile, path, ({ return ERR_FILE_ERROR; }), __retTry)
 	{
 		char pattern[STR_LINE_MAX];
@@ -1184,30 +2411,57 @@ uint64_t getBrachHeadPrev(constString branchName, uint order)
 	// Get the current commit hash of the branch head
 	uint64_t curHash = getBranchHead(branchName);
 
-	// Iterate through previous commits based on the order parameter
+	// Iterate through previous commits based on the order parameter (using the commit graph)
 	for (int i = 0; i < order; i++)
 	{
-		// Retrieve the commit information for the current hash
-		Commit *commit = getCommit(curHash);
-
+		CommitInfo commit;
 		// If the commit is not found, set the hash to 0xFFFFFF and break the loop
-		if (commit == NULL)
+		if (!getCommitInfo(curHash, &commit))
 		{
 			curHash = 0xFFFFFF;
 			break;
 		}
 
 		// Update the current hash to the previous commit's hash
-		curHash = commit->prev;
-
-		// free
-		freeCommitStruct(commit);
+		curHash = commit.prev;
 	}
 	return curHash;
 }
 
+// Index of the HEAD files of the current repository by path (built on the first lookup; fetchHEAD replaces the array)
+static IndexMap __headTable = {NULL};
+static const GitObject *__headTableArr = NULL;
+static uint __headTableLen = 0;
+
+static const void *__head_path_key(const void *ctx, uint index)
+{
+	return ((const GitObject *)ctx)[index].file.path;
+}
+
+// Build the HEAD table for an array (The first one of the same paths is found, like a linear search)
+static bool __head_table_rebuild(GitObjectArray head)
+{
+	indexMapFree(&__headTable);
+	indexMapInit(&__headTable, __head_path_key, head.arr, 0);
+	__headTableArr = NULL;
+	if (!indexMapReserve(&__headTable, head.len))
+		return false;
+	for (uint i = 0; i < head.len; i++)
+		indexMapAdd(&__headTable, i);
+	__headTableArr = head.arr;
+	__headTableLen = head.len;
+	return true;
+}
+
 GitObject *getHEADFile(constString path, GitObjectArray head)
 {
+	// The HEAD files of the current repository are indexed; other (or small) arrays are searched linearly
+	if (curRepository && head.arr == curRepository->head.headFiles.arr && head.len >= 16 &&
+		((__headTableArr == head.arr && __headTableLen == head.len) || __head_table_rebuild(head)))
+	{
+		long index = indexMapFind(&__headTable, path);
+		return index >= 0 ? &(head.arr[index]) : NULL;
+	}
 	for (int i = 0; i < head.len; i++)
 		if (!strcmp(head.arr[i].file.path, path))
 			return &(head.arr[i]);
@@ -1222,9 +2476,13 @@ int fetchHEAD()
 	curRepository->head.hash = 0xFFFFFF;
 	curRepository->head.headFiles.arr = NULL;
 	curRepository->head.headFiles.len = 0;
+	*curRepository->head.treeHash = '\0';
+	__headTableArr = NULL; // The array is replaced
+	__headDirsArr = NULL;
+	__changesGeneration++;
 
 	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/HEAD");
-	systemf("touch \"%s\"", path);
+	ensureFile(path);
 
 	char HEAD_content[STR_LINE_MAX] = {0};
 	tryWithFile(HEADfile, path, ({ return ERR_FILE_ERROR; }), __retTry)
@@ -1248,11 +2506,12 @@ int fetchHEAD()
 			curRepository->head.branch = strDup(branch);
 	}
 	else
-		systemf("echo branch/master>\"%s/." PROGRAM_NAME "/HEAD\"", curRepository->absPath);
+		atomicReplace(path, "branch/master\n", strlen("branch/master\n"));
 
 	if (head)
 	{
 		// obtain head files
+		strcpy(curRepository->head.treeHash, head->treeHash);
 		curRepository->head.headFiles.arr = malloc(sizeof(GitObject) * head->headFiles.len);
 		curRepository->head.headFiles.len = head->headFiles.len;
 		for (int i = 0; i < head->headFiles.len; i++)
@@ -1288,14 +2547,12 @@ ChangeStatus getChangesFromHEAD(constString path, GitObjectArray head)
 	{
 		// Committed file and real file are present, compare them
 		// absolute
-		char headObjAbsPath[PATH_MAX];
 		FileEntry realFile = getFileEntry(abspath, NULL);
 		freeFileEntry(&realFile, 1);
-		strcat_s(headObjAbsPath, curRepository->absPath, "/." PROGRAM_NAME "/objects/", headFile->hashStr);
 
 		if (headFile->file.isDeleted)
 			return ADDED;
-		else if (!isFilesSame(abspath, headObjAbsPath))
+		else if (!isWorkingFileSame(path, headFile->hashStr))
 			return MODIFIED;
 		else if (realFile.permission != headFile->file.permission)
 			return PERM_CHANGED;
@@ -1306,64 +2563,49 @@ ChangeStatus getChangesFromHEAD(constString path, GitObjectArray head)
 
 bool isWorkingTreeModified()
 {
-	char manifestFilePath[PATH_MAX];
-	strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked");
-	systemf("touch \"%s\"", manifestFilePath);
-	tryWithFile(manifestFile, manifestFilePath, ({ return false; }), __retTry)
-	{
-		// Path of tracking file (relative to repo)
-		char buf[PATH_MAX];
-		bool flag = false;
-		// Iterate over tracked files
-		while (fgets(buf, sizeof(buf), manifestFile) != NULL)
-		{
-			strtrim(buf);
-			if (getChangesFromHEAD(buf, curRepository->head.headFiles))
-			{
-				flag = true;
-				break;
-			}
-		}
-		throw(flag);
-	}
+	// Iterate over tracked files (relative to repo); with the file system monitor, only the ones which may be changed
+	constString *tracked = NULL, *candidates = NULL;
+	uint count = listTrackedFiles(&tracked);
+	bool monitored = getFsmonitorCandidates(&candidates) >= 0;
+	for (uint i = 0; i < count; i++)
+		if ((!monitored || isFsmonitorCandidate(tracked[i])) && getChangesFromHEAD(tracked[i], curRepository->head.headFiles))
+			return true;
 	return false;
 }
 
 int applyToWorkingDir(GitObjectArray head)
 {
-	char manifestFilePath[PATH_MAX];
-	strcat_s(manifestFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked");
-	systemf("touch \"%s\"", manifestFilePath);
-	tryWithFile(manifestFile, manifestFilePath, ({ return ERR_FILE_ERROR; }), __retTry)
-	{
-		// Path of tracking file (relative to repo)
-		char buf[PATH_MAX];
-		// Iterate over tracked files
-		while (fgets(buf, sizeof(buf), manifestFile) != NULL)
+	// Iterate over tracked files (relative to repo)
+	constString *tracked = NULL;
+	uint count = listTrackedFiles(&tracked);
+	for (uint i = 0; i < count; i++)
+	{
+		char absPath[PATH_MAX];
+		strcat_s(absPath, curRepository->absPath, "/", tracked[i]);
+		ChangeStatus state = getChangesFromHEAD(tracked[i], head);
+		GitObject *sf = getHEADFile(tracked[i], head);
+		switch (state)
 		{
-			char absPath[PATH_MAX];
-			strtrim(buf);
-			strcat_s(absPath, curRepository->absPath, "/", buf);
-			ChangeStatus state = getChangesFromHEAD(buf, head);
-			GitObject *sf = getHEADFile(buf, head);
-			switch (state)
+		case ADDED:			 // We have to remove this file from working tree
+			remove(absPath); // DELETE THE FILE IN WORKING TREE !!
+			break;
+		case DELETED:  // We have to add this file to working tree
+		case MODIFIED: // We have to update this file at working tree
+			if (restoreObject(sf->hashStr, absPath) == ERR_NOERR) // REPLACE THE FILE IN WORKING TREE WITH HEAD ONE !!
 			{
-			case ADDED:			 // We have to remove this file from working tree
-				remove(absPath); // DELETE THE FILE IN WORKING TREE !!
-				break;
-			case DELETED:  // We have to add this file to working tree
-			case MODIFIED: // We have to update this file at working tree
-				char objAbsPath[PATH_MAX];
-				strcat_s(objAbsPath, curRepository->absPath, "/." PROGRAM_NAME "/objects/", sf->hashStr);
-				copyFile(objAbsPath, absPath, NULL); // REPLACE THE FILE IN WORKING TREE WITH HEAD ONE !!
 				struct utimbuf newTime;
 				newTime.actime = time(NULL);		  // Access time set to now
 				newTime.modtime = sf->file.dateModif; // Modification time is set to the original timestamp
 				utime(absPath, &newTime);
-			case PERM_CHANGED:
 				chmod(absPath, sf->file.permission);
-				break;
+				struct stat st;
+				if (stat(absPath, &st) == 0) // The restored content is known without reading it again
+					recordStatCache(tracked[i], &st, sf->hashStr);
 			}
+			break;
+		case PERM_CHANGED:
+			chmod(absPath, sf->file.permission);
+			break;
 		}
 	}
 	return ERR_NOERR;
@@ -1373,16 +2615,17 @@ int applyToWorkingDir(GitObjectArray head)
 
 String getMergeDestination(constString branch)
 {
-	uint64_t hash = getBranchHead(branch);
-	Commit *c = getCommit(hash);
-	if (c == NULL)
-		return false;
-	Commit *mergedCommit = getCommit(c->mergedCommit);
-	bool isMerged = mergedCommit && (strcmp(mergedCommit->branch, branch) == 0);
-	freeCommitStruct(mergedCommit);
-	String res = isMerged ? strDup(c->branch) : NULL;
-	freeCommitStruct(c);
-	return res;
+	CommitInfo c, mergedCommit;
+	if (!getCommitInfo(getBranchHead(branch), &c) || !c.mergedCommit)
+		return NULL;
+	// The next lookup may rebuild the graph, which invalidates c.branch
+	String destination = strDup(c.branch);
+	if (!getCommitInfo(c.mergedCommit, &mergedCommit) || strcmp(mergedCommit.branch, branch) != 0)
+	{
+		free(destination);
+		return NULL;
+	}
+	return destination;
 }
 
 void printDiff(Diff *diff, constString f1PathToShow, constString f2PathToShow)
@@ -1432,14 +2675,20 @@ ConflictingStatus getConflictingStatus(GitObject *targetObj, GitObjectArray base
 		return REMOVED_IN_BASE;
 	else // the file is persent on  both branches but with different object ref
 	{
-		char baseObjPath[PATH_MAX], targetObjPath[PATH_MAX];
-		strcat_s(baseObjPath, curRepository->absPath, "/." PROGRAM_NAME "/objects/", baseObj->hashStr);
-		strcat_s(targetObjPath, curRepository->absPath, "/." PROGRAM_NAME "/objects/", targetObj->hashStr);
-		if (isFilesSame(baseObjPath, targetObjPath))
+		// Different content hashes mean different content; only old random IDs need a byte compare
+		if ((!isContentHash(baseObj->hashStr) || !isContentHash(targetObj->hashStr)) && isObjectsSame(baseObj->hashStr, targetObj->hashStr))
 			return SAME_BINARY;
 		else
 		{
-			Diff diff = getDiff(baseObjPath, targetObjPath, 1, -1, 1, -1);
+			// Objects are compressed; diff their decompressed contents
+			Diff diff = {NULL, NULL, 0, NULL, NULL, 0};
+			FILE *baseFile = openObjectAsFile(baseObj->hashStr), *targetFile = openObjectAsFile(targetObj->hashStr);
+			if (baseFile && targetFile)
+				diff = getDiffStreams(baseFile, targetFile, 1, -1, 1, -1);
+			if (baseFile)
+				fclose(baseFile);
+			if (targetFile)
+				fclose(targetFile);
 			if (diff.addedCount == 0 && diff.linesRemoved == 0)
 			{
 				freeDiffStruct(&diff);
@@ -1460,44 +2709,64 @@ int __tag_sort_comparator(const void *a, const void *b)
 	return strcasecmp((((Tag *)a)->tagname), ((Tag *)b)->tagname);
 }
 
+static void __free_tag_fields(Tag *tag)
+{
+	free(tag->tagname);
+	free(tag->message);
+	free(tag->authorName);
+	free(tag->authorEmail);
+}
+
+// Parse a line of the tags file: "[<name>]:[<message>]:<hash>:<author>:<email>:<time>"
+static bool __parse_tag_line(StrView line, Tag *dest)
+{
+	StrView name, message, hash, author, email, time;
+	uint64_t hashValue, timeValue;
+	if (!viewSkipPrefix(&line, "[") || !nextField(&line, "]:[", &name) || !nextField(&line, "]:", &message) || !nextField(&line, ":", &hash) ||
+		!lastField(&line, ':', &time) || !lastField(&line, ':', &email) || !line.str || !name.len || !message.len || !line.len || !email.len ||
+		!viewToU64(hash, 16, &hashValue) || !viewToU64(time, 10, &timeValue))
+		return false;
+	author = line;
+	dest->tagname = viewDup(name);
+	dest->message = viewDup(message);
+	dest->authorName = viewDup(author);
+	dest->authorEmail = viewDup(email);
+	dest->commitHash = hashValue;
+	dest->tagTime = timeValue;
+	return true;
+}
+
 int listTags(Tag **destBuf, uint64_t commitHash)
 {
 	Tag *result = NULL;
 	uint count = 0;
 	char tagManifestPath[PATH_MAX];
-	strcat_s(tagManifestPath, curRepository->absPath, "/.neogit/tags");
-	systemf("touch \"%s\"", tagManifestPath);
-	tryWithFile(tagManifest, tagManifestPath, ({ return 0; }), ({ return count; }))
+	Tokenizer tokenizer;
+	if (openTokenizer(&tokenizer, strcat_s(tagManifestPath, curRepository->absPath, "/.neogit/tags"))) // no tags file, no tags
 	{
-		char buf[STR_LINE_MAX];
-		while (fgets(buf, STR_LINE_MAX, tagManifest))
+		StrView line;
+		while (nextLine(&tokenizer, &line))
 		{
-			strtrim(buf);
-			char tag_name[100], message[STR_LINE_MAX], authorName[STR_LINE_MAX], authorEmail[STR_LINE_MAX];
-			uint64_t hash = 0;
-			time_t time = 0;
-
-			if (sscanf(buf, "[%[^]]]:[%[^]]]:%lx:%[^:]:%[^:]:%ld", tag_name, message, &hash, authorName, authorEmail, &time) != 6)
+			Tag tag = {0};
+			if (!__parse_tag_line(line, &tag))
 				continue;
 
-			if (commitHash && (hash != commitHash)) // if commithash filter provided, check the hash
+			if (commitHash && (tag.commitHash != commitHash)) // if commithash filter provided, check the hash
+			{
+				__free_tag_fields(&tag);
 				continue;
+			}
 
 			ADD_EMPTY(result, count, Tag);
-			result[count - 1].tagname = strDup(tag_name);
-			result[count - 1].message = strDup(message);
-			result[count - 1].authorName = strDup(authorName);
-			result[count - 1].authorEmail = strDup(authorEmail);
-			result[count - 1].tagTime = time;
-			result[count - 1].commitHash = hash;
+			result[count - 1] = tag;
 		}
-		qsort(result, count, sizeof(Tag), __tag_sort_comparator); // sort by name ascending
-		if (destBuf)
-			*destBuf = result;
-		else
-			freeTagStruct(result, count);
-		throw(0);
+		closeTokenizer(&tokenizer);
 	}
+	qsort(result, count, sizeof(Tag), __tag_sort_comparator); // sort by name ascending
+	if (destBuf)
+		*destBuf = result;
+	else
+		freeTagStruct(result, count);
 	return count;
 }
 
@@ -1505,39 +2774,24 @@ Tag *getTag(constString tag_name)
 {
 	Tag *result = NULL;
 	char tagManifestPath[PATH_MAX];
-	strcat_s(tagManifestPath, curRepository->absPath, "/.neogit/tags");
-	systemf("touch \"%s\"", tagManifestPath);
-	tryWithFile(tagManifest, tagManifestPath, ({ return NULL; }), ({ return result; }))
-	{
-		char pattern[STR_LINE_MAX], format[STR_LINE_MAX];
-		sprintf(pattern, "[%s]:[*]:*:*:*:*", tag_name);
-		strcat_s(format, "[", tag_name, "]:[%[^]]]:%lx:%[^:]:%[^:]:%ld");
-		int res = searchLine(tagManifest, pattern);
-		if (res == -1) // if not found
-			throw(0);
-		else // if found
+	Tokenizer tokenizer;
+	if (!openTokenizer(&tokenizer, strcat_s(tagManifestPath, curRepository->absPath, "/.neogit/tags")))
+		return NULL;
+	StrView line;
+	while (!result && nextLine(&tokenizer, &line))
+	{
+		Tag tag = {0};
+		if (!__parse_tag_line(line, &tag))
+			continue;
+		if (!strcmp(tag.tagname, tag_name))
 		{
-			SEEK_TO_LINE(tagManifest, res);
-			char buf[STR_LINE_MAX];
-			if (!fgets(buf, STR_LINE_MAX, tagManifest))
-				throw(0); // return NULL
-			char message[STR_LINE_MAX], authorName[STR_LINE_MAX], authorEmail[STR_LINE_MAX];
-			uint64_t hash = 0;
-			time_t time = 0;
-			if (sscanf(buf, format, message, &hash, authorName, authorEmail, &time) != 5)
-				throw(0); // return NULL
-
 			result = malloc(sizeof(Tag));
-			result->tagname = strDup(tag_name);
-			result->message = strDup(message);
-			result->commitHash = hash;
-			result->tagTime = time;
-			result->authorName = strDup(authorName);
-			result->authorEmail = strDup(authorEmail);
+			*result = tag;
 		}
-
-		throw(0);
+		else
+			__free_tag_fields(&tag);
 	}
+	closeTokenizer(&tokenizer);
 	return result;
 }
 
@@ -1545,7 +2799,7 @@ int setTag(constString tag_name, constString message, uint64_t commitHash, const
 {
 	char tagManifestPath[PATH_MAX];
 	strcat_s(tagManifestPath, curRepository->absPath, "/.neogit/tags");
-	systemf("touch \"%s\"", tagManifestPath);
+	ensureFile(tagManifestPath);
 	tryWithFile(tagManifest, tagManifestPath, ({ return ERR_FILE_ERROR; }), __retTry)
 	{
 		char format[STR_LINE_MAX], lineStr[STR_LINE_MAX];
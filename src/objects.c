@@ -0,0 +1,722 @@
+/*******************************
+ *         objects.c           *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "neogit.h"
+#include <errno.h>
+
+extern Repository *curRepository; // Declared in neogit.c
+
+String getObjectPath(String dest, constString hash)
+{
+	char objectsPath[PATH_MAX];
+	strcat_s(objectsPath, curRepository->absPath, "/." PROGRAM_NAME "/objects");
+	return getShardedPath(dest, objectsPath, hash);
+}
+
+// Find a loose object in the object store (sharded, or flat in repositories which are not migrated yet)
+static String __find_loose_object(String dest, constString hash)
+{
+	if (access(getObjectPath(dest, hash), F_OK) == 0)
+		return dest;
+	if (access(strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/objects/", hash), F_OK) == 0)
+		return dest;
+	return NULL;
+}
+
+String getStagedObjectPath(String dest, constString hash)
+{
+	return strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/stage/", hash);
+}
+
+String findObject(String dest, constString hash)
+{
+	if (__find_loose_object(dest, hash))
+		return dest;
+	if (access(getStagedObjectPath(dest, hash), F_OK) == 0)
+		return dest;
+	return NULL;
+}
+
+// Make sure the parent directory of a file exists
+static void __ensure_parent_dir(constString path)
+{
+	char dir[PATH_MAX];
+	if (access(getParentName(dir, path), F_OK) != 0)
+		makeDirs(dir);
+}
+
+// Read the whole content of an object into memory (only for objects up to OBJ_DELTA_MAX_SIZE)
+static uchar *__read_whole_object(ObjectReader *reader)
+{
+	if (reader->size > OBJ_DELTA_MAX_SIZE)
+		return NULL;
+	uchar *content = malloc(reader->size + 1);
+	if (content && readObject(reader, content, reader->size) != reader->size)
+	{
+		free(content);
+		return NULL;
+	}
+	return content;
+}
+
+// Read the rest of a stored object as LZ blocks (delta instructions, chunk manifests) into memory
+static uchar *__read_lz_content(ObjectReader *reader, size_t *lenDest, size_t maxLen)
+{
+	char type = reader->type;
+	reader->type = OBJ_TYPE_LZ;
+	uchar *content = NULL;
+	size_t len = 0, n;
+	do
+	{
+		uchar *newContent = realloc(content, len + OBJ_BLOCK_SIZE);
+		if (!newContent)
+			break;
+		content = newContent;
+		len += (n = readObject(reader, content + len, OBJ_BLOCK_SIZE));
+	} while (n == OBJ_BLOCK_SIZE && len <= maxLen);
+	reader->type = type;
+
+	if (!content || reader->error || len > maxLen)
+	{
+		free(content);
+		return NULL;
+	}
+	*lenDest = len;
+	return content;
+}
+
+// Open the stored form of an object (Packed objects are read directly from the mapped pack)
+static FILE *__open_stored_object(constString hash)
+{
+	const uchar *data;
+	size_t len;
+	if (findPackedObject(hash, &data, &len))
+		return fmemopen((void *)data, len, "rb");
+
+	char objPath[PATH_MAX];
+	if (!findObject(objPath, hash))
+		return NULL;
+	return fopen(objPath, "rb");
+}
+
+// Read the length of the chain of bases of a stored object from its header (-1 if it can not be read)
+static int __read_stored_depth(constString hash)
+{
+	int depth = -1;
+	with(file, __open_stored_object(hash), fclose(file))
+	{
+		uchar header[OBJ_HEADER_SIZE];
+		if (fread(header, 1, OBJ_HEADER_SIZE, file) == OBJ_HEADER_SIZE && memcmp(header, OBJ_MAGIC, 4) == 0)
+			depth = header[5];
+		else
+			depth = 0; // Objects of old repositories are stored as they are
+	}
+	return depth;
+}
+
+// Rebuild the content of a delta object from its base (The whole content is kept as a single block)
+static bool __load_delta(ObjectReader *reader)
+{
+	char baseHash[OBJ_HASH_LEN + 1] = {0};
+	if (reader->depth == 0 || reader->size > OBJ_DELTA_MAX_SIZE || fread(baseHash, 1, OBJ_HASH_LEN, reader->file) != OBJ_HASH_LEN)
+		return false;
+
+	// The delta instructions are stored in LZ blocks after the base hash
+	size_t deltaLen = 0;
+	uchar *delta = __read_lz_content(reader, &deltaLen, OBJ_DELTA_MAX_SIZE);
+
+	// Bases always have a shorter chain; it is checked before the base is opened, so a corrupted chain can not loop
+	int baseDepth = __read_stored_depth(baseHash);
+	ObjectReader *base = baseDepth >= 0 && baseDepth < reader->depth ? openObject(baseHash) : NULL;
+	uchar *baseContent = NULL, *content = NULL;
+	bool ok = delta && base && base->depth < reader->depth &&
+			  (baseContent = __read_whole_object(base)) && (content = malloc(reader->size + 1)) &&
+			  deltaDecode(baseContent, base->size, delta, deltaLen, content, reader->size) == (long)reader->size;
+
+	free(delta);
+	free(baseContent);
+	closeObject(base);
+	if (!ok)
+	{
+		free(content);
+		return false;
+	}
+
+	free(reader->block);
+	reader->block = content;
+	reader->blockLen = reader->size;
+	reader->blockPos = 0;
+	return true;
+}
+
+// Load the manifest of a chunked object (The chunks are opened one by one while reading)
+static bool __load_manifest(ObjectReader *reader)
+{
+	size_t len = 0;
+	if (!(reader->manifest = __read_lz_content(reader, &len, SIZE_MAX / 2)) || len % OBJ_CHUNK_ENTRY_SIZE != 0)
+		return false;
+	reader->chunkCount = len / OBJ_CHUNK_ENTRY_SIZE;
+
+	// The chunks must add up to the size of the content
+	uint64_t size = 0;
+	for (uint64_t i = 0; i < reader->chunkCount; i++)
+		size += getLE64(reader->manifest + i * OBJ_CHUNK_ENTRY_SIZE + OBJ_HASH_LEN);
+	return size == reader->size;
+}
+
+// Open a reader on a stream of a stored object (loose file or a slice of a pack)
+static ObjectReader *__open_object_stream(FILE *file)
+{
+	if (!file)
+		return NULL;
+
+	ObjectReader *reader = calloc(1, sizeof(ObjectReader));
+	if (!reader)
+	{
+		fclose(file);
+		return NULL;
+	}
+	reader->file = file;
+
+	uchar header[OBJ_HEADER_SIZE];
+	if (fread(header, 1, OBJ_HEADER_SIZE, file) == OBJ_HEADER_SIZE && memcmp(header, OBJ_MAGIC, 4) == 0)
+	{
+		reader->type = header[4];
+		reader->depth = header[5];
+		reader->size = getLE64(header + 8);
+	}
+	else
+	{
+		// Objects of old repositories are stored as they are
+		reader->type = OBJ_TYPE_RAW;
+		reader->size = GET_FILE_SIZE(file);
+		rewind(file);
+	}
+
+	if ((reader->type != OBJ_TYPE_RAW && reader->type != OBJ_TYPE_LZ && reader->type != OBJ_TYPE_DELTA && reader->type != OBJ_TYPE_CHUNKED) ||
+		(reader->type == OBJ_TYPE_DELTA && !__load_delta(reader)) ||
+		(reader->type == OBJ_TYPE_CHUNKED && !__load_manifest(reader)))
+	{
+		closeObject(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+ObjectReader *openObjectFile(constString objPath)
+{
+	return __open_object_stream(fopen(objPath, "rb"));
+}
+
+ObjectReader *openObject(constString hash)
+{
+	return __open_object_stream(__open_stored_object(hash));
+}
+
+String getDeltaBase(String dest, constString hash)
+{
+	String result = NULL;
+	with(file, __open_stored_object(hash), fclose(file))
+	{
+		// Only the header is read; the content is not rebuilt
+		uchar header[OBJ_HEADER_SIZE];
+		if (fread(header, 1, OBJ_HEADER_SIZE, file) == OBJ_HEADER_SIZE && memcmp(header, OBJ_MAGIC, 4) == 0 &&
+			header[4] == OBJ_TYPE_DELTA && fread(dest, 1, OBJ_HASH_LEN, file) == OBJ_HASH_LEN)
+		{
+			dest[OBJ_HASH_LEN] = '\0';
+			result = dest;
+		}
+	}
+	return result;
+}
+
+uint listObjectChunks(constString hash, String **chunksDest)
+{
+	// Only the header is checked before loading the manifest (other objects are not decoded)
+	FILE *file = __open_stored_object(hash);
+	uchar header[OBJ_HEADER_SIZE];
+	if (!file)
+		return 0;
+	if (fread(header, 1, OBJ_HEADER_SIZE, file) != OBJ_HEADER_SIZE || memcmp(header, OBJ_MAGIC, 4) != 0 || header[4] != OBJ_TYPE_CHUNKED)
+	{
+		fclose(file);
+		return 0;
+	}
+	rewind(file);
+
+	uint count = 0;
+	ObjectReader *reader = __open_object_stream(file);
+	if (reader && (*chunksDest = malloc(reader->chunkCount * sizeof(String))))
+		for (; count < reader->chunkCount; count++)
+			(*chunksDest)[count] = strndup((String)reader->manifest + count * OBJ_CHUNK_ENTRY_SIZE, OBJ_HASH_LEN);
+	closeObject(reader);
+	return count;
+}
+
+bool isObjectExist(constString hash)
+{
+	char objPath[PATH_MAX];
+	return findPackedObject(hash, NULL, NULL) || findObject(objPath, hash);
+}
+
+// Read and decode the next block of a compressed object (returns false at the end or on errors)
+static bool __load_next_block(ObjectReader *reader)
+{
+	// Deltas are decoded at once
+	if (reader->type == OBJ_TYPE_DELTA)
+		return false;
+	reader->blockPos = reader->blockLen = 0;
+
+	uchar blockHeader[8];
+	size_t n = fread(blockHeader, 1, sizeof(blockHeader), reader->file);
+	if (n == 0 && feof(reader->file))
+		return false;
+	if (n != sizeof(blockHeader))
+		return !(reader->error = true);
+
+	uint32_t storedLen = getLE32(blockHeader), rawLen = getLE32(blockHeader + 4);
+	bool isStored = storedLen & OBJ_BLOCK_STORED;
+	storedLen &= ~OBJ_BLOCK_STORED;
+	if (rawLen == 0 || rawLen > OBJ_BLOCK_SIZE || storedLen > LZ_COMPRESS_BOUND(OBJ_BLOCK_SIZE) || (isStored && storedLen != rawLen))
+		return !(reader->error = true);
+
+	if (!reader->block && !(reader->block = malloc(OBJ_BLOCK_SIZE)))
+		return !(reader->error = true);
+
+	if (isStored)
+	{
+		if (fread(reader->block, 1, rawLen, reader->file) != rawLen)
+			return !(reader->error = true);
+	}
+	else
+	{
+		if (!reader->storedBuf && !(reader->storedBuf = malloc(LZ_COMPRESS_BOUND(OBJ_BLOCK_SIZE))))
+			return !(reader->error = true);
+		if (fread(reader->storedBuf, 1, storedLen, reader->file) != storedLen ||
+			lzDecompress(reader->storedBuf, storedLen, reader->block, rawLen) != rawLen)
+			return !(reader->error = true);
+	}
+
+	reader->blockLen = rawLen;
+	return true;
+}
+
+// Read the content of a chunked object from its chunks (in the order of the manifest)
+static size_t __read_chunks(ObjectReader *reader, uchar *buf, size_t len)
+{
+	size_t done = 0;
+	while (done < len && !reader->error)
+	{
+		if (!reader->chunk)
+		{
+			if (reader->chunkIndex == reader->chunkCount)
+				break;
+			const uchar *entry = reader->manifest + reader->chunkIndex++ * OBJ_CHUNK_ENTRY_SIZE;
+			char chunkHash[OBJ_HASH_LEN + 1] = {0};
+			memcpy(chunkHash, entry, OBJ_HASH_LEN);
+
+			// Chunks are plain objects; a chunked chunk would be a corrupted (possibly looping) manifest
+			reader->chunk = openObject(chunkHash);
+			if (!reader->chunk || reader->chunk->type == OBJ_TYPE_CHUNKED || reader->chunk->size != getLE64(entry + OBJ_HASH_LEN))
+			{
+				reader->error = true;
+				break;
+			}
+		}
+
+		size_t n = readObject(reader->chunk, buf + done, len - done);
+		if (reader->chunk->error)
+			reader->error = true;
+		else if (n < len - done) // End of the chunk
+		{
+			closeObject(reader->chunk);
+			reader->chunk = NULL;
+		}
+		done += n;
+	}
+	return done;
+}
+
+size_t readObject(ObjectReader *reader, void *_buf, size_t len)
+{
+	uchar *buf = _buf;
+	if (reader->type == OBJ_TYPE_CHUNKED)
+		return __read_chunks(reader, buf, len);
+	if (reader->type == OBJ_TYPE_RAW)
+	{
+		size_t n = fread(buf, 1, len, reader->file);
+		if (ferror(reader->file))
+			reader->error = true;
+		return n;
+	}
+
+	size_t done = 0;
+	while (done < len)
+	{
+		if (reader->blockPos == reader->blockLen && !__load_next_block(reader))
+			break;
+		size_t n = reader->blockLen - reader->blockPos;
+		if (n > len - done)
+			n = len - done;
+		memcpy(buf + done, reader->block + reader->blockPos, n);
+		reader->blockPos += n;
+		done += n;
+	}
+	return done;
+}
+
+void closeObject(ObjectReader *reader)
+{
+	if (!reader)
+		return;
+	fclose(reader->file);
+	closeObject(reader->chunk);
+	free(reader->block);
+	free(reader->storedBuf);
+	free(reader->manifest);
+	free(reader);
+}
+
+// Write a stored object from a stream: header, base hash of deltas, then the content in LZ blocks
+// (contentSize is used by deltas and chunk manifests; otherwise it is the number of bytes read from src)
+static int __write_object_stream(FILE *src, constString objPath, char type, uchar depth, constString baseHash, uint64_t contentSize)
+{
+	char tmpPath[PATH_MAX];
+	strcat_s(tmpPath, objPath, ".tmp");
+	__ensure_parent_dir(objPath);
+
+	uchar *raw = malloc(OBJ_BLOCK_SIZE), *stored = malloc(LZ_COMPRESS_BOUND(OBJ_BLOCK_SIZE));
+	int error = raw && stored ? ERR_FILE_ERROR : ERR_MALLOC;
+	if (raw && stored)
+		with(dest, fopen(tmpPath, "wb"), fclose(dest))
+		{
+			// Header (the size is written after the content is known)
+			uchar header[OBJ_HEADER_SIZE] = {0};
+			memcpy(header, OBJ_MAGIC, 4);
+			header[4] = type;
+			header[5] = depth;
+			fwrite(header, 1, OBJ_HEADER_SIZE, dest);
+			if (type == OBJ_TYPE_DELTA)
+				fwrite(baseHash, 1, OBJ_HASH_LEN, dest);
+
+			// Compress the content block by block (incompressible blocks are stored as they are)
+			uint64_t size = 0;
+			size_t n;
+			while ((n = fread(raw, 1, OBJ_BLOCK_SIZE, src)) > 0)
+			{
+				size_t storedLen = lzCompress(raw, n, stored, LZ_COMPRESS_BOUND(OBJ_BLOCK_SIZE));
+				uchar blockHeader[8];
+				putLE32(blockHeader + 4, n);
+				if (storedLen && storedLen < n)
+				{
+					putLE32(blockHeader, storedLen);
+					fwrite(blockHeader, 1, sizeof(blockHeader), dest);
+					fwrite(stored, 1, storedLen, dest);
+				}
+				else
+				{
+					putLE32(blockHeader, n | OBJ_BLOCK_STORED);
+					fwrite(blockHeader, 1, sizeof(blockHeader), dest);
+					fwrite(raw, 1, n, dest);
+				}
+				size += n;
+			}
+
+			putLE64(header + 8, type == OBJ_TYPE_LZ ? size : contentSize);
+			fseek(dest, 0, SEEK_SET);
+			fwrite(header, 1, OBJ_HEADER_SIZE, dest);
+			if (ferror(src) || ferror(dest))
+				throw(ERR_FILE_ERROR);
+			error = ERR_NOERR;
+		}
+	free(raw);
+	free(stored);
+
+	// Make the object visible only when it is completely written
+	if (error == ERR_NOERR && rename(tmpPath, objPath) != 0)
+		error = ERR_FILE_ERROR;
+	if (error != ERR_NOERR)
+		remove(tmpPath);
+	return error;
+}
+
+int writeObjectFile(constString srcPath, constString objPath)
+{
+	int error = ERR_FILE_ERROR;
+	with(src, fopen(srcPath, "rb"), fclose(src))
+		error = __write_object_stream(src, objPath, OBJ_TYPE_LZ, 0, NULL, 0);
+	return error;
+}
+
+int writeObjectBuffer(const void *data, size_t len, String hashDest)
+{
+	Sha256Context ctx;
+	uchar digest[SHA256_DIGEST_LEN];
+	sha256Init(&ctx);
+	sha256Update(&ctx, data, len);
+	sha256Final(&ctx, digest);
+	digestToHex(hashDest, digest, SHA256_DIGEST_LEN);
+	if (isObjectExist(hashDest))
+		return ERR_NOERR;
+
+	// fmemopen does not accept an empty buffer
+	char objPath[PATH_MAX];
+	FILE *src = len ? fmemopen((void *)data, len, "rb") : fopen("/dev/null", "rb");
+	if (!src)
+		return ERR_FILE_ERROR;
+	int error = __write_object_stream(src, getObjectPath(objPath, hashDest), OBJ_TYPE_LZ, 0, NULL, 0);
+	fclose(src);
+	return error;
+}
+
+// Split a file by content-defined chunking: new chunks go to the object store, the manifest to objPath
+static int __write_chunked_object(constString srcPath, constString objPath)
+{
+	uchar *buf = malloc(CDC_MAX_SIZE), *manifest = NULL;
+	size_t avail = 0, manifestLen = 0;
+	uint64_t size = 0;
+	int error = buf ? ERR_FILE_ERROR : ERR_MALLOC;
+	if (buf)
+		with(src, fopen(srcPath, "rb"), fclose(src))
+		{
+			// The buffer is always refilled, so chunks are cut the same way as if the whole file was in memory
+			error = ERR_NOERR;
+			while (error == ERR_NOERR && (avail += fread(buf + avail, 1, CDC_MAX_SIZE - avail, src)) > 0)
+			{
+				size_t len = cdcChunkLength(buf, avail);
+
+				// Chunks are named by their own content, so unchanged chunks of other versions are reused
+				char chunkHash[OBJ_HASH_LEN + 1];
+				error = writeObjectBuffer(buf, len, chunkHash);
+
+				uchar *newManifest = realloc(manifest, manifestLen + OBJ_CHUNK_ENTRY_SIZE);
+				if (!newManifest)
+					error = ERR_MALLOC;
+				else
+				{
+					manifest = newManifest;
+					memcpy(manifest + manifestLen, chunkHash, OBJ_HASH_LEN);
+					putLE64(manifest + manifestLen + OBJ_HASH_LEN, len);
+					manifestLen += OBJ_CHUNK_ENTRY_SIZE;
+				}
+
+				memmove(buf, buf + len, avail - len);
+				avail -= len;
+				size += len;
+			}
+			if (ferror(src))
+				error = ERR_FILE_ERROR;
+		}
+
+	if (error == ERR_NOERR)
+	{
+		FILE *manifestStream = manifestLen ? fmemopen(manifest, manifestLen, "rb") : NULL;
+		error = manifestStream ? __write_object_stream(manifestStream, objPath, OBJ_TYPE_CHUNKED, 0, NULL, size) : ERR_FILE_ERROR;
+		if (manifestStream)
+			fclose(manifestStream);
+	}
+	free(buf);
+	free(manifest);
+	return error;
+}
+
+// Get the size from which files are chunked (The config is only read once)
+static uint64_t __get_chunk_threshold()
+{
+	static bool loaded = false;
+	static uint64_t threshold = OBJ_CHUNK_THRESHOLD_DEFAULT;
+	if (!loaded)
+	{
+		loaded = true;
+		withString(value, getConfig(OBJ_CHUNK_THRESHOLD_CONFIG))
+			parseSize(value, &threshold);
+	}
+	return threshold;
+}
+
+int writeDeltaObject(constString hash, constString baseHash, constString objPath)
+{
+	if (!isContentHash(baseHash) || !strcmp(hash, baseHash))
+		return ERR_GENERAL;
+
+	ObjectReader *target = openObject(hash), *base = openObject(baseHash);
+	uchar *targetContent = NULL, *baseContent = NULL, *delta = NULL;
+	int error = ERR_GENERAL;
+
+	// Only small enough files with a short enough chain of bases are stored as deltas (manifests are small already)
+	if (target && base && target->type != OBJ_TYPE_CHUNKED && base->depth < OBJ_DELTA_MAX_DEPTH &&
+		(targetContent = __read_whole_object(target)) && (baseContent = __read_whole_object(base)) &&
+		(delta = malloc(target->size / 2 + 1)))
+	{
+		// A delta larger than half of the content is not worth it
+		size_t deltaLen = deltaEncode(baseContent, base->size, targetContent, target->size, delta, target->size / 2);
+		FILE *deltaStream = deltaLen ? fmemopen(delta, deltaLen, "rb") : NULL;
+		if (deltaStream)
+		{
+			error = __write_object_stream(deltaStream, objPath, OBJ_TYPE_DELTA, base->depth + 1, baseHash, target->size);
+			fclose(deltaStream);
+		}
+	}
+
+	free(targetContent);
+	free(baseContent);
+	free(delta);
+	closeObject(target);
+	closeObject(base);
+	return error;
+}
+
+int restoreObject(constString hash, constString destPath)
+{
+	ObjectReader *reader = openObject(hash);
+	if (!reader)
+		return ERR_NOT_EXIST;
+
+	__ensure_parent_dir(destPath);
+	remove(destPath);
+
+	int error = ERR_FILE_ERROR;
+	with(dest, fopen(destPath, "wb"), fclose(dest))
+	{
+		char buf[64 * 1024];
+		size_t n;
+		while ((n = readObject(reader, buf, sizeof(buf))) > 0)
+			fwrite(buf, 1, n, dest);
+		if (reader->error || ferror(dest))
+			throw(ERR_FILE_ERROR);
+		error = ERR_NOERR;
+	}
+	closeObject(reader);
+	return error;
+}
+
+bool isFileSameAsObject(constString filePath, constString hash)
+{
+	struct stat st;
+	if (stat(filePath, &st) != 0)
+		return false;
+
+	ObjectReader *reader = openObject(hash);
+	if (!reader)
+		return false;
+
+	// Different sizes -> no need to read the contents
+	bool same = (uint64_t)st.st_size == reader->size;
+	if (same)
+	{
+		same = false;
+		with(file, fopen(filePath, "rb"), fclose(file))
+		{
+			char buf1[16 * 1024], buf2[16 * 1024];
+			size_t n1, n2;
+			same = true;
+			do
+			{
+				n1 = readObject(reader, buf1, sizeof(buf1));
+				n2 = fread(buf2, 1, sizeof(buf2), file);
+				if (n1 != n2 || memcmp(buf1, buf2, n1))
+					same = false;
+			} while (same && n1 > 0);
+			same = same && !reader->error;
+		}
+	}
+	closeObject(reader);
+	return same;
+}
+
+bool isObjectsSame(constString hash1, constString hash2)
+{
+	ObjectReader *reader1 = openObject(hash1), *reader2 = openObject(hash2);
+	bool same = reader1 && reader2 && reader1->size == reader2->size;
+	if (same)
+	{
+		char buf1[16 * 1024], buf2[16 * 1024];
+		size_t n1, n2;
+		do
+		{
+			n1 = readObject(reader1, buf1, sizeof(buf1));
+			n2 = readObject(reader2, buf2, sizeof(buf2));
+			if (n1 != n2 || memcmp(buf1, buf2, n1))
+				same = false;
+		} while (same && n1 > 0);
+		same = same && !reader1->error && !reader2->error;
+	}
+	closeObject(reader1);
+	closeObject(reader2);
+	return same;
+}
+
+FILE *openObjectAsFile(constString hash)
+{
+	ObjectReader *reader = openObject(hash);
+	if (!reader)
+		return NULL;
+
+	FILE *file = tmpfile();
+	if (file)
+	{
+		char buf[64 * 1024];
+		size_t n;
+		while ((n = readObject(reader, buf, sizeof(buf))) > 0)
+			fwrite(buf, 1, n, file);
+		if (reader->error || ferror(file))
+		{
+			fclose(file);
+			file = NULL;
+		}
+		else
+			rewind(file);
+	}
+	closeObject(reader);
+	return file;
+}
+
+int writeStagedObject(constString filePath, String hashDest)
+{
+	char absPath[PATH_MAX], objPath[PATH_MAX];
+	strcat_s(absPath, curRepository->absPath, "/", filePath);
+
+	// Name the object by its content
+	if (sha256File(absPath, hashDest) != ERR_NOERR)
+		return ERR_FILE_ERROR;
+
+	// Same content is already stored (staged or committed) -> nothing to write
+	if (isObjectExist(hashDest))
+		return ERR_NOERR;
+
+	// Large files are stored in chunks
+	struct stat st;
+	uint64_t threshold = __get_chunk_threshold();
+	if (threshold && stat(absPath, &st) == 0 && (uint64_t)st.st_size >= threshold)
+		return __write_chunked_object(absPath, getStagedObjectPath(objPath, hashDest));
+	return writeObjectFile(absPath, getStagedObjectPath(objPath, hashDest));
+}
+
+int commitStagedObject(constString hash, constString baseHash)
+{
+	char stagedPath[PATH_MAX], objPath[PATH_MAX];
+
+	// The object store already has this content (loose or packed)
+	if (__find_loose_object(objPath, hash) || findPackedObject(hash, NULL, NULL))
+		return ERR_NOERR;
+	getObjectPath(objPath, hash);
+
+	// Store it as a delta against the previous version, if it is worth it
+	if (baseHash && writeDeltaObject(hash, baseHash, objPath) == ERR_NOERR)
+		return ERR_NOERR;
+
+	// Stored objects are already compressed; move them as they are (the stage is cleared after commit anyway)
+	getStagedObjectPath(stagedPath, hash);
+	__ensure_parent_dir(objPath);
+	if (rename(stagedPath, objPath) == 0)
+		return ERR_NOERR;
+
+	// The stage and the object store are on different file systems -> copy is unavoidable
+	if (errno == EXDEV)
+		return copyFile(stagedPath, objPath, NULL);
+	return ERR_FILE_ERROR;
+}
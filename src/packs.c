@@ -0,0 +1,390 @@
+/*******************************
+ *          packs.c            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "neogit.h"
+#include "packs.h"
+#include <pthread.h>
+
+extern Repository *curRepository; // Declared in neogit.c
+
+// Packs of the current repository (mapped on the first lookup)
+static Pack *__packs = NULL;
+static uint __packsCount = 0;
+static bool __packsLoaded = false;
+static pthread_mutex_t __packsLock = PTHREAD_MUTEX_INITIALIZER;
+
+String getPacksPath(String dest)
+{
+	return strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/packs");
+}
+
+// Map all packs which have a valid index
+static void __load_packs()
+{
+	char packsPath[PATH_MAX];
+	tryWith(DIR *, dir, opendir(getPacksPath(packsPath)), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			// Find indexes, then their packs
+			size_t nameLen = strlen(entry->d_name);
+			if (nameLen < 5 || strcmp(entry->d_name + nameLen - 4, ".idx") != 0)
+				continue;
+			char idxPath[PATH_MAX], dataPath[PATH_MAX];
+			strcat_s(idxPath, packsPath, "/", entry->d_name);
+			strcpy(dataPath, idxPath);
+			strcpy(dataPath + strlen(dataPath) - 4, ".pack");
+
+			Pack pack = {0};
+			if (!(pack.idx = mapFile(idxPath, &pack.idxLen)))
+				continue;
+			pack.count = pack.idxLen >= PACK_IDX_HEADER_SIZE ? getLE64(pack.idx + 8) : 0;
+			if (pack.idxLen < PACK_IDX_HEADER_SIZE || memcmp(pack.idx, PACK_IDX_MAGIC, 4) != 0 ||
+				getLE32(pack.idx + 4) != PACK_IDX_VERSION || pack.idxLen != PACK_IDX_HEADER_SIZE + pack.count * PACK_IDX_ENTRY_SIZE ||
+				!(pack.data = mapFile(dataPath, &pack.dataLen)))
+			{
+				unmapFile(pack.idx, pack.idxLen);
+				continue;
+			}
+
+			pack.idxPath = strDup(idxPath);
+			ADD_EMPTY(__packs, __packsCount, Pack);
+			__packs[__packsCount - 1] = pack;
+		}
+	}
+	__atomic_store_n(&__packsLoaded, true, __ATOMIC_RELEASE);
+}
+
+// Map the packs on the first lookup (Lookups may come from several threads, e.g. fsck)
+static void __ensure_packs_loaded()
+{
+	if (__atomic_load_n(&__packsLoaded, __ATOMIC_ACQUIRE))
+		return;
+	pthread_mutex_lock(&__packsLock);
+	if (!__packsLoaded)
+		__load_packs();
+	pthread_mutex_unlock(&__packsLock);
+}
+
+void closePacks()
+{
+	for (uint i = 0; i < __packsCount; i++)
+	{
+		unmapFile(__packs[i].idx, __packs[i].idxLen);
+		unmapFile(__packs[i].data, __packs[i].dataLen);
+		free(__packs[i].idxPath);
+	}
+	free(__packs);
+	__packs = NULL;
+	__packsCount = 0;
+	__packsLoaded = false;
+}
+
+bool findPackedObject(constString hash, const uchar **dataDest, size_t *lenDest)
+{
+	uchar digest[SHA256_DIGEST_LEN];
+	if (strlen(hash) != SHA256_HEX_LEN || !hexToDigest(digest, hash, SHA256_DIGEST_LEN))
+		return false;
+	__ensure_packs_loaded();
+
+	for (uint i = 0; i < __packsCount; i++)
+	{
+		// Binary search in the sorted index
+		const uchar *entries = __packs[i].idx + PACK_IDX_HEADER_SIZE;
+		uint64_t low = 0, high = __packs[i].count;
+		while (low < high)
+		{
+			uint64_t mid = low + (high - low) / 2;
+			const uchar *entry = entries + mid * PACK_IDX_ENTRY_SIZE;
+			int cmp = memcmp(entry, digest, SHA256_DIGEST_LEN);
+			if (cmp < 0)
+				low = mid + 1;
+			else if (cmp > 0)
+				high = mid;
+			else
+			{
+				uint64_t offset = getLE64(entry + SHA256_DIGEST_LEN), len = getLE64(entry + SHA256_DIGEST_LEN + 8);
+				if (offset > __packs[i].dataLen || len > __packs[i].dataLen - offset)
+					break; // Corrupted index
+				if (dataDest)
+					*dataDest = __packs[i].data + offset;
+				if (lenDest)
+					*lenDest = len;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// An object to be written into a new pack (a loose file, or a slice of a mapped pack)
+typedef struct _pack_source_t
+{
+	char name[SHA256_HEX_LEN + 1]; /**< Hash string of the object. */
+	String path;				   /**< Path of the loose file (NULL for packed objects). */
+	const uchar *data;			   /**< Stored object in a mapped pack (if path is NULL). */
+	size_t len;					   /**< Size of the stored object in the mapped pack. */
+} PackSource;
+
+// Comparator function for qsort pack sources (by object name)
+static int __pack_source_sort_comparator(const void *a, const void *b)
+{
+	return strcmp(((PackSource *)a)->name, ((PackSource *)b)->name);
+}
+
+// Add the loose objects in a directory which are named by their content hash
+static void __collect_loose_objects(constString dirPath, PackSource **sources, uint *count)
+{
+	tryWith(DIR *, dir, opendir(dirPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		uchar digest[SHA256_DIGEST_LEN];
+		while ((entry = readdir(dir)) != NULL)
+			if (strlen(entry->d_name) == SHA256_HEX_LEN && hexToDigest(digest, entry->d_name, SHA256_DIGEST_LEN))
+			{
+				ADD_EMPTY(*sources, *count, PackSource);
+				PackSource *source = &(*sources)[*count - 1];
+				strcpy(source->name, entry->d_name);
+				source->path = strcat_d(dirPath, "/", entry->d_name);
+				source->data = NULL;
+				source->len = 0;
+			}
+	}
+}
+
+// Free the sources of a pack
+static void __free_pack_sources(PackSource *sources, uint count)
+{
+	for (uint i = 0; i < count; i++)
+		free(sources[i].path);
+	free(sources);
+}
+
+// Write a pack of the given (sorted, unique) objects and its index (returns the pack id in idDest)
+static int __write_pack(PackSource *sources, uint count, String idDest, uint64_t *sizeDest)
+{
+	char packsPath[PATH_MAX], tmpDataPath[PATH_MAX], tmpIdxPath[PATH_MAX];
+	getPacksPath(packsPath);
+	mkdir(packsPath, 0775);
+	strcat_s(tmpDataPath, packsPath, "/pack.tmp");
+	strcat_s(tmpIdxPath, packsPath, "/idx.tmp");
+
+	uchar *idx = calloc(PACK_IDX_HEADER_SIZE + (size_t)count * PACK_IDX_ENTRY_SIZE, 1);
+	if (!idx)
+		return ERR_MALLOC;
+	memcpy(idx, PACK_IDX_MAGIC, 4);
+	putLE32(idx + 4, PACK_IDX_VERSION);
+	putLE64(idx + 8, count);
+
+	// Append the stored objects one after another (sources are sorted, so the index is sorted too)
+	int error = ERR_FILE_ERROR;
+	uint64_t offset = 0;
+	with(pack, fopen(tmpDataPath, "wb"), fclose(pack))
+	{
+		uint i;
+		for (i = 0; i < count; i++)
+		{
+			uint64_t len = 0;
+			if (sources[i].path)
+				with(obj, fopen(sources[i].path, "rb"), fclose(obj))
+				{
+					char buf[64 * 1024];
+					size_t n;
+					while ((n = fread(buf, 1, sizeof(buf), obj)) > 0)
+						len += fwrite(buf, 1, n, pack);
+				}
+			else
+				len = fwrite(sources[i].data, 1, sources[i].len, pack);
+			if (len == 0)
+				break;
+			uchar *entry = idx + PACK_IDX_HEADER_SIZE + (size_t)i * PACK_IDX_ENTRY_SIZE;
+			hexToDigest(entry, sources[i].name, SHA256_DIGEST_LEN);
+			putLE64(entry + SHA256_DIGEST_LEN, offset);
+			putLE64(entry + SHA256_DIGEST_LEN + 8, len);
+			offset += len;
+		}
+		if (i != count || ferror(pack))
+			throw(ERR_FILE_ERROR);
+		error = ERR_NOERR;
+	}
+
+	// The pack id is the hash of its index
+	if (error == ERR_NOERR)
+	{
+		Sha256Context ctx;
+		uchar digest[SHA256_DIGEST_LEN];
+		sha256Init(&ctx);
+		sha256Update(&ctx, idx, PACK_IDX_HEADER_SIZE + (size_t)count * PACK_IDX_ENTRY_SIZE);
+		sha256Final(&ctx, digest);
+		digestToHex(idDest, digest, SHA256_DIGEST_LEN);
+
+		error = ERR_FILE_ERROR;
+		with(idxFile, fopen(tmpIdxPath, "wb"), fclose(idxFile))
+			if (fwrite(idx, 1, PACK_IDX_HEADER_SIZE + (size_t)count * PACK_IDX_ENTRY_SIZE, idxFile) == PACK_IDX_HEADER_SIZE + (size_t)count * PACK_IDX_ENTRY_SIZE)
+				error = ERR_NOERR;
+	}
+	free(idx);
+
+	// Publish the pack first, then its index
+	if (error == ERR_NOERR)
+	{
+		char dataPath[PATH_MAX], idxPath[PATH_MAX];
+		strcat_s(dataPath, packsPath, "/pack-", idDest, ".pack");
+		strcat_s(idxPath, packsPath, "/pack-", idDest, ".idx");
+		if (rename(tmpDataPath, dataPath) != 0 || rename(tmpIdxPath, idxPath) != 0)
+			error = ERR_FILE_ERROR;
+	}
+	if (error != ERR_NOERR)
+	{
+		remove(tmpDataPath);
+		remove(tmpIdxPath);
+	}
+	else if (sizeDest)
+		*sizeDest = offset + PACK_IDX_HEADER_SIZE + (uint64_t)count * PACK_IDX_ENTRY_SIZE;
+	return error;
+}
+
+int packLooseObjects(uint *countDest)
+{
+	char objectsPath[PATH_MAX];
+	strcat_s(objectsPath, curRepository->absPath, "/." PROGRAM_NAME "/objects");
+
+	// Collect loose objects from shard directories (and the flat layout of repositories which are not migrated)
+	PackSource *sources = NULL;
+	uint count = 0;
+	__collect_loose_objects(objectsPath, &sources, &count);
+	tryWith(DIR *, dir, opendir(objectsPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+			if (strlen(entry->d_name) == SHARD_PREFIX_LEN && entry->d_name[0] != '.')
+				withString(shardPath, strcat_d(objectsPath, "/", entry->d_name))
+					__collect_loose_objects(shardPath, &sources, &count);
+	}
+	if (countDest)
+		*countDest = 0;
+	if (count == 0)
+		return ERR_NOERR;
+	qsort(sources, count, sizeof(PackSource), __pack_source_sort_comparator);
+
+	char packId[SHA256_HEX_LEN + 1];
+	int error = __write_pack(sources, count, packId, NULL);
+
+	// The objects are safely packed, remove the loose files
+	if (error == ERR_NOERR)
+	{
+		for (uint i = 0; i < count; i++)
+		{
+			remove(sources[i].path);
+			// Remove the shard directory after its last object (only if it became empty)
+			size_t dirLen = strrchr(sources[i].path, '/') - sources[i].path;
+			bool lastInDir = i + 1 == count || (size_t)(strrchr(sources[i + 1].path, '/') - sources[i + 1].path) != dirLen ||
+							 strncmp(sources[i + 1].path, sources[i].path, dirLen) != 0;
+			if (lastInDir && dirLen != strlen(objectsPath))
+			{
+				sources[i].path[dirLen] = '\0';
+				rmdir(sources[i].path);
+			}
+		}
+		if (countDest)
+			*countDest = count;
+		closePacks(); // The new pack is mapped on the next lookup
+	}
+
+	__free_pack_sources(sources, count);
+	return error;
+}
+
+uint64_t forEachPackedObject(void (*callback)(constString hash, void *arg), void *arg)
+{
+	__ensure_packs_loaded();
+	uint64_t count = 0;
+	for (uint i = 0; i < __packsCount; i++)
+		for (uint64_t j = 0; j < __packs[i].count; j++, count++)
+		{
+			char name[SHA256_HEX_LEN + 1];
+			callback(digestToHex(name, __packs[i].idx + PACK_IDX_HEADER_SIZE + j * PACK_IDX_ENTRY_SIZE, SHA256_DIGEST_LEN), arg);
+		}
+	return count;
+}
+
+int prunePacks(const StringSet *reachable, uint *removedDest, uint64_t *freedDest)
+{
+	__ensure_packs_loaded();
+
+	// Find packs which have unreachable objects, and collect their reachable objects
+	PackSource *sources = NULL;
+	uint count = 0, removed = 0;
+	bool *rewritten = calloc(__packsCount + 1, sizeof(bool));
+	uint64_t oldSize = 0;
+	for (uint i = 0; i < __packsCount; i++)
+	{
+		const uchar *entries = __packs[i].idx + PACK_IDX_HEADER_SIZE;
+		uint unreachable = 0;
+		char name[SHA256_HEX_LEN + 1];
+		for (uint64_t j = 0; j < __packs[i].count; j++)
+			if (!stringSetContains(reachable, digestToHex(name, entries + j * PACK_IDX_ENTRY_SIZE, SHA256_DIGEST_LEN)))
+				unreachable++;
+		if (!unreachable)
+			continue;
+
+		rewritten[i] = true;
+		removed += unreachable;
+		oldSize += __packs[i].idxLen + __packs[i].dataLen;
+		for (uint64_t j = 0; j < __packs[i].count; j++)
+		{
+			const uchar *entry = entries + j * PACK_IDX_ENTRY_SIZE;
+			uint64_t offset = getLE64(entry + SHA256_DIGEST_LEN), len = getLE64(entry + SHA256_DIGEST_LEN + 8);
+			if (!stringSetContains(reachable, digestToHex(name, entry, SHA256_DIGEST_LEN)) ||
+				offset > __packs[i].dataLen || len > __packs[i].dataLen - offset)
+				continue;
+			ADD_EMPTY(sources, count, PackSource);
+			strcpy(sources[count - 1].name, name);
+			sources[count - 1].path = NULL;
+			sources[count - 1].data = __packs[i].data + offset;
+			sources[count - 1].len = len;
+		}
+	}
+
+	// Write the reachable objects of those packs into a new pack (an object may be in more than one pack)
+	int error = ERR_NOERR;
+	uint64_t newSize = 0;
+	if (count)
+	{
+		qsort(sources, count, sizeof(PackSource), __pack_source_sort_comparator);
+		uint unique = 0;
+		for (uint i = 0; i < count; i++)
+			if (unique == 0 || strcmp(sources[unique - 1].name, sources[i].name) != 0)
+				sources[unique++] = sources[i];
+		char packId[SHA256_HEX_LEN + 1];
+		error = __write_pack(sources, unique, packId, &newSize);
+	}
+
+	// Remove the old packs (index first, so a pack is never used without its data)
+	if (error == ERR_NOERR && removed)
+	{
+		for (uint i = 0; i < __packsCount; i++)
+			if (rewritten[i])
+			{
+				char dataPath[PATH_MAX];
+				strcpy(dataPath, __packs[i].idxPath);
+				strcpy(dataPath + strlen(dataPath) - 4, ".pack");
+				remove(__packs[i].idxPath);
+				remove(dataPath);
+			}
+		closePacks(); // Packs are mapped again on the next lookup
+	}
+
+	free(rewritten);
+	free(sources);
+	if (removedDest)
+		*removedDest = error == ERR_NOERR ? removed : 0;
+	if (freedDest)
+		*freedDest = error == ERR_NOERR && oldSize > newSize ? oldSize - newSize : 0;
+	return error;
+}
@@ -66,8 +66,10 @@ void __status_print_func(FileEntry *element)
 // A comparator function for qsort -> sort commits by date deascending
 int __cmpCommitsByDateDescending(const void *a, const void *b)
 {
-	Commit *first = *((Commit **)a), *second = *((Commit **)b);
-	return second->time - first->time;
+	const CommitInfo *first = a, *second = b;
+	if (first->time != second->time)
+		return first->time < second->time ? 1 : -1;
+	return first->generation < second->generation ? 1 : first->generation > second->generation ? -1 : 0; // children first
 }
 
 // Parse log command options and put them in struct LogOption *dest
@@ -123,11 +125,11 @@ int command_init(int argc, constString argv[], bool performActions)
 		mkdir(strcat_s(tmpPath, neogitFolder, "/stage"), 0775);
 		mkdir(strcat_s(tmpPath, neogitFolder, "/objects"), 0775);
 		mkdir(strcat_s(tmpPath, neogitFolder, "/commits"), 0775);
-		systemf("touch ." PROGRAM_NAME "/config");
-		systemf("touch ." PROGRAM_NAME "/tracked");
-		systemf("touch ." PROGRAM_NAME "/HEAD");
-		systemf("touch ." PROGRAM_NAME "/branches");
-		systemf("touch ." PROGRAM_NAME "/tags");
+		ensureFile(strcat_s(tmpPath, neogitFolder, "/config"));
+		ensureFile(strcat_s(tmpPath, neogitFolder, "/tracked"));
+		ensureFile(strcat_s(tmpPath, neogitFolder, "/HEAD"));
+		ensureFile(strcat_s(tmpPath, neogitFolder, "/branches"));
+		ensureFile(strcat_s(tmpPath, neogitFolder, "/tags"));
 
 		int err = 0;
 		err = obtainRepository(curWorkingDir);
@@ -152,6 +154,8 @@ int command_config(int argc, constString argv[], bool performActions)
 	// Check if the command is related to alias or user configurations
 	bool isAlias = false;
 	uint keyArgIndex = checkAnyArgument("user.*");
+	if (!keyArgIndex)
+		keyArgIndex = checkAnyArgument("core.*");
 	if (!keyArgIndex)
 	{
 		if (keyArgIndex = checkAnyArgument("alias.*"))
@@ -233,6 +237,110 @@ int command_config(int argc, constString argv[], bool performActions)
 	return ERR_NOERR;
 }
 
+// State of a batch add (The staging index and the tracked files are written once at the end of the command)
+typedef struct _add_batch_t
+{
+	bool backup;		  // A snapshot of the staging area must be taken before the first change
+	constString *deleted; // Files of HEAD which are deleted from the working tree (NULL after they are processed)
+	uint deletedCount;
+} AddBatch;
+
+// Check if a path (relative to the repository) is a directory path or under it ("." is the root)
+static bool __is_under_path(constString path, constString dirPath)
+{
+	size_t len = strlen(dirPath);
+	return !strcmp(dirPath, ".") || (!strncmp(path, dirPath, len) && (!path[len] || path[len] == '/'));
+}
+
+// Stage a file (relative to the repository) if it is changed from the staging area
+static void __add_batch_file(AddBatch *batch, constString path)
+{
+	if (!getChangesFromStaging(path))
+		return;
+
+	// backup from old staged area (for undo actions)
+	if (batch->backup)
+	{
+		backupStagingArea();
+		batch->backup = false;
+	}
+	trackFile(path);
+	if (addToStage(path) == ERR_NOERR)
+		printf("File Added to stage: " _CYAN "%s " _RST "\n", path);
+	else
+		printError("Error! in adding file: " _BOLD "%s" _UNBOLD ".\n", path);
+}
+
+// Find the files of HEAD under a path (relative to the repository) which are deleted from the working tree
+// Returns false if HEAD has no file under the path
+static bool __add_batch_find_deleted(AddBatch *batch, constString path)
+{
+	bool found = false;
+	GitObjectArray *head = &curRepository->head.headFiles;
+	for (uint i = 0; i < head->len; i++)
+	{
+		constString filePath = head->arr[i].file.path;
+		if (!__is_under_path(filePath, path))
+			continue;
+		found = true;
+		char absPath[PATH_MAX];
+		if (access(strcat_s(absPath, curRepository->absPath, "/", filePath), F_OK) != 0)
+		{
+			ADD_EMPTY(batch->deleted, batch->deletedCount, constString);
+			batch->deleted[batch->deletedCount - 1] = filePath;
+		}
+	}
+	return found;
+}
+
+// Stage the found deleted files under a path which are not staged yet
+static void __add_batch_deleted(AddBatch *batch, constString path)
+{
+	for (uint i = 0; i < batch->deletedCount; i++)
+		if (batch->deleted[i] && __is_under_path(batch->deleted[i], path))
+		{
+			__add_batch_file(batch, batch->deleted[i]);
+			batch->deleted[i] = NULL;
+		}
+}
+
+// Stage the changed files of a directory (relative to the repository) and its subdirectories
+static void __add_batch_directory(AddBatch *batch, constString dirPath)
+{
+	ScanEntry *entries = NULL;
+	uint count = 0;
+	if (scanWorkingTree(dirPath, &entries, &count) != ERR_NOERR)
+	{
+		printError("Error while scanning " _BOLD "\"%s\"" _UNBOLD "!", dirPath);
+		return;
+	}
+
+	// The entries are in the order of a depth first walk; the deleted files of each directory are the last ones
+	constString *opened = NULL;
+	uint openedCount = 0;
+	ADD_EMPTY(opened, openedCount, constString);
+	opened[0] = dirPath;
+	for (uint i = 0; i < count; i++)
+	{
+		while (openedCount > 1 && !__is_under_path(entries[i].path, opened[openedCount - 1]))
+			__add_batch_deleted(batch, opened[--openedCount]);
+		if (!entries[i].isDir)
+			__add_batch_file(batch, entries[i].path);
+		else if (strcmp(getFileName(entries[i].path), "." PROGRAM_NAME)) // Don't Add .neogit folders!
+		{
+			ADD_EMPTY(opened, openedCount, constString);
+			opened[openedCount - 1] = entries[i].path;
+		}
+		else // Skip its entries
+			for (constString skipped = entries[i].path; i + 1 < count && __is_under_path(entries[i + 1].path, skipped);)
+				i++;
+	}
+	while (openedCount)
+		__add_batch_deleted(batch, opened[--openedCount]);
+	free(opened);
+	freeScanEntries(entries, count);
+}
+
 int command_add(int argc, constString argv[], bool performActions)
 {
 	if (checkArgument(1, "-n")) // List file and show staging state
@@ -263,22 +371,19 @@ int command_add(int argc, constString argv[], bool performActions)
 		else if (!performActions)
 			return ERR_NOERR;
 
-		char tracklistFilePath[PATH_MAX];
-		strcat_s(tracklistFilePath, curRepository->absPath, "/." PROGRAM_NAME "/tracked");
-		systemf("touch \"%s\"", tracklistFilePath);
-		tryWithFile(manifestFile, tracklistFilePath, ({ return ERR_FILE_ERROR; }), __retTry)
-		{
-			char buf[PATH_MAX];
-			while (fgets(buf, sizeof(buf), manifestFile) != NULL)
-				if (getChangesFromStaging(strtrim(buf)))
-				{
-					int res = addToStage(buf);
-					if (res == ERR_NOERR)
-						printf("Modified file restaged: " _CYAN "%s \n"_RST, buf);
-					else
-						printError("Error! in adding file: " _BOLD "%s" _UNBOLD ".\n", buf);
-				}
-		}
+		// With the file system monitor, only the files which may be changed are checked
+		constString *tracked = NULL, *candidates = NULL;
+		uint count = listTrackedFiles(&tracked);
+		bool monitored = getFsmonitorCandidates(&candidates) >= 0;
+		for (uint i = 0; i < count; i++)
+			if ((!monitored || isFsmonitorCandidate(tracked[i])) && getChangesFromStaging(tracked[i]))
+			{
+				int res = addToStage(tracked[i]);
+				if (res == ERR_NOERR)
+					printf("Modified file restaged: " _CYAN "%s \n"_RST, tracked[i]);
+				else
+					printError("Error! in adding file: " _BOLD "%s" _UNBOLD ".\n", tracked[i]);
+			}
 
 		return ERR_NOERR;
 	}
@@ -306,15 +411,8 @@ int command_add(int argc, constString argv[], bool performActions)
 	else if (!curRepository)
 		return ERR_NOREPO;
 
-	// backup from old staged area (for undo actions)
-	if (firstCall)
-	{
-		_LIST_FILES_CHANGED_FROM_STAGE;
-		if (lsChangedFiles(NULL, curRepository->absPath))
-			backupStagingArea();
-		_LIST_FILES_CHANGED_FROM_HEAD;
-	}
-
+	// One walk of the given paths (The snapshot for "reset -undo" is taken before the first change)
+	AddBatch batch = {.backup = firstCall};
 	while (argc--)
 	{
 		constString argument = *(argv++);
@@ -329,72 +427,25 @@ int command_add(int argc, constString argv[], bool performActions)
 			continue;
 		}
 
+		// relative to the repo
 		String relPath = normalizePath(dest, curRepository->absPath);
-
-		// entry paths will be absolute
-		int result = -1;
-		FileEntry *entries = NULL;
-		if (relPath)
+		struct stat st;
+		bool exists = relPath && stat(dest, &st) == 0;
+		if (exists && S_ISDIR(st.st_mode)) // add folders recursive (and the deleted files of HEAD in them)
 		{
-			result = lsWithHead(&entries, dest);
-			free(relPath);
+			__add_batch_find_deleted(&batch, relPath);
+			__add_batch_directory(&batch, relPath);
 		}
-		if (result == -1) // error
+		else if (exists) // add file
+			__add_batch_file(&batch, relPath);
+		else if (relPath && __add_batch_find_deleted(&batch, relPath)) // add deleted file (or folder)
+			__add_batch_deleted(&batch, relPath);
+		else // error
 			printError("Error! " _BOLD "\"%s\"" _UNBOLD " : No such file or directory!", argument);
-		else if (result == -2) // add file
-		{
-			// relative to the repo
-			FileEntry fileE = getFileEntry(dest, curRepository->absPath);
-
-			if (fileE.path == NULL)
-				printError("Error in adding File " _BOLD "\"%s\"" _UNBOLD, argument);
-			else
-			{
-				// .gitignore patterns are handled here.
-				if (isGitIgnore(&fileE))
-					continue;
-				int res = 0;
-				if (getChangesFromStaging(fileE.path))
-				{
-					trackFile(fileE.path);
-					res = addToStage(fileE.path);
-					if (res == ERR_NOERR)
-						printf("File Added to stage: " _CYAN "%s " _RST "\n", fileE.path);
-					else
-						printError("Error! in adding file: " _BOLD "%s" _UNBOLD ".\n", fileE.path);
-				}
-				else
-				{
-					//printf(_DIM "No changes : %s\n" _UNBOLD _RST, fileE.path);
-				}
-				freeFileEntry(&fileE, 1);
-			}
-		}
-		else // add folders recursive
-		{
-			String new_argv[result + 2];
-			new_argv[0] = "add";
-			new_argv[1] = "-ff";
-			int new_argc = 2;
-			for (int i = 0; i < result; i++)
-			{
-				// Don't Add .neogit folder!
-				if (entries[i].isDir && strcmp(getFileName(entries[i].path), "." PROGRAM_NAME) == 0)
-					continue;
-
-				// .gitignore patterns are handled here.
-				if (isGitIgnore(&entries[i]))
-					continue;
-
-				new_argv[new_argc++] = entries[i].path;
-			}
-
-			// Add childs recursive
-			command_add(new_argc, (constString *)new_argv, true);
-			freeFileEntry(entries, result);
-			if (result)
-				free(entries);
-		}
+		free(relPath);
+		free(batch.deleted);
+		batch.deleted = NULL;
+		batch.deletedCount = 0;
 	}
 	if (firstCall)
 		printf("\n\n");
@@ -533,6 +584,27 @@ int command_status(int argc, constString argv[], bool performActions)
 	else
 		printf(_YELB "YOU ARE IN DEATACHED HEAD MODE!! DONT CHANGE FILES!!!\n\n" _RST);
 
+	// With the file system monitor, only the files which may be changed since the last status are checked;
+	// otherwise the working tree is scanned in parallel (and the tree walk below uses only the changed files)
+	String *changed = NULL, *scanned = NULL;
+	uint changedCount = 0;
+	constString *candidates = NULL;
+	int candidateCount = getFsmonitorCandidates(&candidates);
+	bool monitored = candidateCount >= 0;
+	if (!monitored && (candidateCount = scanChangeCandidates(&scanned)) >= 0)
+		candidates = (constString *)scanned;
+	for (int i = 0; i < candidateCount; i++)
+		if (getChangesFromStaging(candidates[i]) || getChangesFromHEAD(candidates[i], curRepository->head.headFiles))
+		{
+			ADD_EMPTY(changed, changedCount, String);
+			changed[changedCount - 1] = strDup(candidates[i]);
+		}
+	if (candidateCount >= 0)
+		setChangedFiles((constString *)changed, changedCount);
+	for (int i = 0; scanned && i < candidateCount; i++)
+		free(scanned[i]);
+	free(scanned);
+
 	if (lsChangedFiles(NULL, curRepository->absPath))
 	{
 		FileEntry root = getFileEntry(curRepository->absPath, NULL);
@@ -543,6 +615,19 @@ int command_status(int argc, constString argv[], bool performActions)
 	else
 		printf(_CYAN "Working tree is clean! No modifications.\n\n" _RST);
 
+	// Remember the changed files for the next status (also the deleted staged files after a scan)
+	if (!monitored && isFsmonitorRunning())
+	{
+		for (uint i = 0; i < changedCount; i++)
+			free(changed[i]);
+		free(changed);
+		changedCount = listChangedFiles(&changed);
+	}
+	writeFsmonitorState((constString *)changed, changedCount);
+	for (uint i = 0; i < changedCount; i++)
+		free(changed[i]);
+	free(changed);
+
 	return ERR_NOERR;
 }
 
@@ -632,13 +717,29 @@ int command_commit(int argc, constString argv[], bool performActions)
 	}
 
 	// Perform the commit
-	// copy objects from .neogit/stage to .neogit/objects
+	// copy objects from .neogit/stage to .neogit/objects (already stored contents are skipped)
+	uint failed = 0;
 	for (int i = 0; i < curRepository->stagingArea.len; i++)
 	{
-		char p1[PATH_MAX], p2[PATH_MAX];
-		if (!curRepository->stagingArea.arr[i].file.isDeleted) //  if the file was deleted we don't need it in our object store
-			copyFile(strcat_s(p1, "." PROGRAM_NAME "/stage/", curRepository->stagingArea.arr[i].hashStr),
-					 strcat_s(p2, "." PROGRAM_NAME "/objects/", curRepository->stagingArea.arr[i].hashStr), curRepository->absPath);
+		GitObject *staged = &curRepository->stagingArea.arr[i];
+		if (staged->file.isDeleted) //  if the file was deleted we don't need it in our object store
+			continue;
+		// the previous version of the file (in HEAD) is the base of its delta
+		GitObject *prev = getHEADFile(staged->file.path, curRepository->head.headFiles);
+		if (commitStagedObject(staged->hashStr, (prev && !prev->file.isDeleted) ? prev->hashStr : NULL) != ERR_NOERR)
+		{
+			printError("Error! in storing the object of file: " _BOLD "%s" _UNBOLD ".", staged->file.path);
+			failed++;
+		}
+	}
+
+	// The commit must not refer to an object which is not stored (The stage is kept, so it can be committed again)
+	if (failed)
+	{
+		printError("Commit aborted! %u object(s) could not be stored.", failed);
+		free(name);
+		free(email);
+		return ERR_FILE_ERROR;
 	}
 
 	// submit the commit
@@ -649,7 +750,10 @@ int command_commit(int argc, constString argv[], bool performActions)
 	// if successful , print results
 	if (res)
 	{
-		systemf("rm -r \"%s/." PROGRAM_NAME "/stage\"/*", curRepository->absPath); // remove staged files
+		char stagePath[PATH_MAX]; // remove staged files
+		strcat_s(stagePath, curRepository->absPath, "/." PROGRAM_NAME "/stage");
+		removeTree(stagePath);
+		makeDirs(stagePath);
 		printf("Successfully performed the commit: " _CYANB "'%s'\n" _RST, message);
 		char datetime[DATETIME_STR_MAX];
 		strftime(datetime, DATETIME_STR_MAX, DEFAULT_DATETIME_FORMAT, localtime(&res->time));
@@ -761,86 +865,79 @@ int command_log(int argc, constString argv[], bool performActions)
 	if (!curRepository)
 		return ERR_NOREPO;
 
-	// obtain array of commits
-	char commitsPath[PATH_MAX];
-	strcat_s(commitsPath, curRepository->absPath, "/." PROGRAM_NAME "/commits");
-	FileEntry *buf = NULL;
-	int entryCount = ls(&buf, commitsPath); // list all entries in .neogit/commits/
-	Commit **commits = (Commit **)malloc(sizeof(Commit *) * entryCount);
-	uint commitCount = 0;
-	for (int i = 0; i < entryCount; ++i)
-	{
-		uint64_t hash = 0;
-		sscanf(getFileName(buf[i].path), "%lx", &hash); // find the hash from filename
-		commits[commitCount++] = getCommit(hash);		// parse the commit file
-		if (commits[commitCount - 1] == NULL)
-			commitCount--;
-	}
-	freeFileEntry(buf, entryCount);
-	if (buf)
-		free(buf);
-	qsort(commits, commitCount, sizeof(Commit *), __cmpCommitsByDateDescending); // Sort Commits
+	// obtain history of all commits from the commit graph (commit files are only parsed for printed commits)
+	CommitInfo *commits = NULL;
+	uint commitCount = listCommitInfos(&commits);
+	qsort(commits, commitCount, sizeof(CommitInfo), __cmpCommitsByDateDescending); // Sort Commits
 
 	// obtain list of branches
 	String _branches[20] = {NULL};
 	uint64_t _branchHeads[20] = {0};
 	int _branch_count = listBranches(_branches, _branchHeads);
 
+	// obtain list of all tags (once for all commits)
+	Tag *_tags = NULL;
+	uint _tag_count = listTags(&_tags, 0);
+
 	uint printedLogCount = 0;
 	for (uint i = 0; i < commitCount && printedLogCount < options.n; i++)
 	{
-		if (!isMatch(commits[i]->branch, options.branch))
+		if (!isMatch(commits[i].branch, options.branch))
 			continue;
-		else if (!isMatch(commits[i]->username, options.author))
+		else if (commits[i].time < options.since || commits[i].time > options.before)
 			continue;
-		else if (commits[i]->time < options.since || commits[i]->time > options.before)
+		Commit *commit = getCommitHeader(commits[i].hash); // parse the header of the commit file
+		if (commit == NULL)
 			continue;
-		else if (!strReplace(NULL, commits[i]->message, options.search, NULL)) // word pattern not found
+		else if (!isMatch(commit->username, options.author) || !strReplace(NULL, commit->message, options.search, NULL)) // word pattern not found
+		{
+			freeCommitStruct(commit);
 			continue;
+		}
 
-		printf(_REDB "\n*" _RST " Commit " _YELB "'%06lx'" _RST " : on branch " _YELB "'%s'" _RST, commits[i]->hash, commits[i]->branch);
+		printf(_REDB "\n*" _RST " Commit " _YELB "'%06lx'" _RST " : on branch " _YELB "'%s'" _RST, commit->hash, commit->branch);
 		for (int j = 0; j < _branch_count; j++)
-			if (_branchHeads[j] == commits[i]->hash)
+			if (_branchHeads[j] == commit->hash)
 				printf(_GRNB " (%s Head)" _RST, _branches[j]);
-		if (commits[i]->hash == curRepository->head.hash)
+		if (commit->hash == curRepository->head.hash)
 			printf(" " _REDB "-> HEAD" _RST);
 		printf("\n");
 
 		char datetime[DATETIME_STR_MAX];
-		strftime(datetime, DATETIME_STR_MAX, DEFAULT_DATETIME_FORMAT, localtime(&commits[i]->time));
+		strftime(datetime, DATETIME_STR_MAX, DEFAULT_DATETIME_FORMAT, localtime(&commit->time));
 		char boldedMsg[STR_MAX];
 		if (!strcmp(options.search, "*"))
-			strcat_s(boldedMsg, _BOLD, commits[i]->message, _UNBOLD);
+			strcat_s(boldedMsg, _BOLD, commit->message, _UNBOLD);
 		else
-			strReplace(boldedMsg, commits[i]->message, options.search, boldAndUnderlineText);
+			strReplace(boldedMsg, commit->message, options.search, boldAndUnderlineText);
 
 		printf("  Date and Time : " _BOLD "%s\n" _RST, datetime);
-		printf("  Author: " _CYANB "%s <%s>" _RST "\n", commits[i]->username, commits[i]->useremail);
+		printf("  Author: " _CYANB "%s <%s>" _RST "\n", commit->username, commit->useremail);
 		printf("  Commit Message: " _CYAN "'%s'\n" _RST, boldedMsg);
 
 		// list tags for this commit
-		Tag *_tags = NULL;
-		uint _tag_count = listTags(&_tags, commits[i]->hash);
+		uint _commit_tag_count = 0;
 		for (int j = 0; j < _tag_count; j++)
 		{
-			if (j == 0)
-				printf("  Associated Tags: " _MAGNTA _BOLD "%s " _RST, _tags[0].tagname);
+			if (_tags[j].commitHash != commit->hash)
+				continue;
+			if (_commit_tag_count++ == 0)
+				printf("  Associated Tags: " _MAGNTA _BOLD "%s " _RST, _tags[j].tagname);
 			else
 				printf("/ " _MAGNTA _BOLD "%s " _RST, _tags[j].tagname);
-			if (j == _tag_count - 1)
-				printf("\n");
 		}
-		freeTagStruct(_tags, _tag_count);
+		if (_commit_tag_count)
+			printf("\n");
 
-		printf("  " _DIM "[" _BOLD "%u" _UNBOLD _DIM " file(s) commited]\n" _UNBOLD _RST, commits[i]->commitedFiles.len);
+		printf("  " _DIM "[" _BOLD "%u" _UNBOLD _DIM " file(s) commited]\n" _UNBOLD _RST, commit->commitedCount);
 
 		printf("\n");
 		printedLogCount++;
+		freeCommitStruct(commit);
 	}
+	free(commits);
+	freeTagStruct(_tags, _tag_count);
 
-	for (uint i = 0; i < commitCount; i++)
-		freeCommitStruct(commits[i]);
-	
 	for (int j = 0; j <= _branch_count; j++)
 		if (_branches[j])
 			free(_branches[j]);
@@ -853,9 +950,6 @@ int command_log(int argc, constString argv[], bool performActions)
 			printWarning("There is no commit matching your options.");
 	}
 
-	if (entryCount)
-		free(commits);
-
 	return ERR_NOERR;
 }
 
@@ -965,7 +1059,7 @@ int command_checkout(int argc, constString argv[], bool performActions)
 	}
 	else if ((sscanf(targetStr = argv[1], "%lx", &hash) == 1) && hash) // try to scan commit hash
 	{
-		Commit *c = getCommit(hash);
+		Commit *c = getCommitHeader(hash);
 		if (c != NULL) // commit hash found!
 		{
 			hash = c->hash;
@@ -1032,10 +1126,18 @@ int command_checkout(int argc, constString argv[], bool performActions)
 	}
 
 	// change head
+	char headPath[PATH_MAX], headContent[STR_LINE_MAX + 32];
+	strcat_s(headPath, curRepository->absPath, "/." PROGRAM_NAME "/HEAD");
+	int headLen;
 	if (!deatched) // (checkout branch)
-		systemf("echo branch/%s>\"%s/." PROGRAM_NAME "/HEAD\"", branch, curRepository->absPath);
+		headLen = snprintf(headContent, sizeof(headContent), "branch/%s\n", branch);
 	else // checkout commit id
-		systemf("echo commit/%06lx:%s>\"%s/." PROGRAM_NAME "/HEAD\"", hash, branch, curRepository->absPath);
+		headLen = snprintf(headContent, sizeof(headContent), "commit/%06lx:%s\n", hash, branch);
+	if (headLen < 0 || headLen >= sizeof(headContent) || atomicReplace(headPath, headContent, headLen) != ERR_NOERR)
+	{
+		printError("Error while updating HEAD!");
+		return ERR_FILE_ERROR;
+	}
 	fetchHEAD(); // fetch the head to initialize the curRepository->head
 
 apply:
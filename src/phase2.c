@@ -65,26 +65,26 @@ int command_revert(int argc, constString argv[], bool performActions)
 	else if (!((sscanf(showingTarget = targetStr, "%lx", &targetHash) == 1) && targetHash))
 		return ERR_ARGS_MISSING;
 
-	// check if hash found in prev commits and there is no mereging action in history
+	// check if hash found in prev commits and there is no mereging action in history (using the commit graph)
+	CommitInfo target, tmpCommit;
+	bool targetFound = getCommitInfo(targetHash, &target);
 	uint64_t tmpHash = curRepository->head.hash;
 	while (tmpHash != targetHash)
 	{
-		Commit *tmpCommit = getCommit(tmpHash);
-		if (tmpCommit == NULL)
+		// The target can not be an ancestor of a commit with a lower (or the same) generation
+		if (!targetFound || !getCommitInfo(tmpHash, &tmpCommit) || tmpCommit.generation <= target.generation)
 		{
 			printWarning("ERROR in Revert : The requested target was not found in history of HEAD.\n");
 			return ERR_GENERAL;
 		}
 
-		if (tmpCommit->mergedCommit != 0)
+		if (tmpCommit.mergedCommit != 0)
 		{
 			printWarning("ERROR in Revert : Note that there is a merging action in the history of current HEAD.\n You Cannot revert this merging action!\n");
-			freeCommitStruct(tmpCommit);
 			return ERR_GENERAL;
 		}
 
-		tmpHash = tmpCommit->prev;
-		freeCommitStruct(tmpCommit);
+		tmpHash = tmpCommit.prev;
 	}
 
 	Commit *c = getCommit(targetHash);
@@ -241,7 +241,7 @@ int command_tag(int argc, constString argv[], bool performActions)
 		if (!curRepository)
 			return ERR_NOREPO;
 
-		Commit *commit = getCommit(commitHash);
+		Commit *commit = getCommitHeader(commitHash);
 		if (!commit)
 		{
 			printError("Error! Could not find the specified commit.\n");
@@ -326,6 +326,7 @@ int command_grep(int argc, constString argv[], bool performActions)
 		return ERR_NOREPO;
 
 	char absPath[PATH_MAX], relrepoPath[PATH_MAX];
+	FILE *objFile = NULL;
 	String relative_to_repo = normalizePath(filename, curRepository->absPath); // obtain file path relative to repo
 	if (relative_to_repo)
 		strcpy(relrepoPath, relative_to_repo);
@@ -350,8 +351,10 @@ int command_grep(int argc, constString argv[], bool performActions)
 			printError("The file is not available at the specified commit.\n");
 			return ERR_NOT_EXIST;
 		}
-		strcat_s(absPath, curRepository->absPath, "/.neogit/objects/", obj->hashStr); // path to related object
+		objFile = openObjectAsFile(obj->hashStr); // decompressed content of related object
 		freeCommitStruct(c);
+		if (!objFile)
+			return ERR_FILE_ERROR;
 	}
 	else
 	{
@@ -364,7 +367,7 @@ int command_grep(int argc, constString argv[], bool performActions)
 	}
 
 	printf("\n");
-	tryWithFile(file, absPath, ({ return ERR_FILE_ERROR; }), __retTry)
+	tryWith(FILE *, file, objFile ? objFile : fopen(absPath, "rb"), ({ return ERR_FILE_ERROR; }), __retTry, fclose(file))
 	{
 		uint lineIndex = 0;
 		char buf[STR_LINE_MAX];
@@ -0,0 +1,743 @@
+/*******************************
+ *         phase3.c            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "phase3.h"
+#include <pthread.h>
+
+extern String curWorkingDir;	  // Declared in neogit.c
+extern Repository *curRepository; // Declared in neogit.c
+
+int command_repack(int argc, constString argv[], bool performActions)
+{
+	if (!performActions)
+		return ERR_NOERR;
+	if (!curRepository)
+		return ERR_NOREPO;
+
+	uint count = 0;
+	int error = packLooseObjects(&count);
+	if (error != ERR_NOERR)
+	{
+		printError("Error while packing the objects!");
+		return error;
+	}
+
+	if (count)
+		printf("Successfully packed " _CYANB "%u" _RST " object(s).\n", count);
+	else
+		printWarning("No loose object found! Nothing to pack ...");
+	return ERR_NOERR;
+}
+
+// Move the files directly in a directory into its shard subdirectories
+static int __shard_directory(constString dirPath, uint *countDest)
+{
+	int error = ERR_NOERR;
+	tryWith(DIR *, dir, opendir(dirPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			// Skip shards, temporary files and anything which is not a regular file
+			size_t nameLen = strlen(entry->d_name);
+			char path[PATH_MAX], shardedPath[PATH_MAX], shardDir[PATH_MAX];
+			struct stat st;
+			if (entry->d_name[0] == '.' || nameLen <= SHARD_PREFIX_LEN || (nameLen > 4 && !strcmp(entry->d_name + nameLen - 4, ".tmp")) ||
+				stat(strcat_s(path, dirPath, "/", entry->d_name), &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			getShardedPath(shardedPath, dirPath, entry->d_name);
+			if (makeDirs(getParentName(shardDir, shardedPath)) != ERR_NOERR || rename(path, shardedPath) != 0)
+				error = ERR_FILE_ERROR;
+			else
+				(*countDest)++;
+		}
+	}
+	return error;
+}
+
+int command_migrate(int argc, constString argv[], bool performActions)
+{
+	if (!performActions)
+		return ERR_NOERR;
+	if (!curRepository)
+		return ERR_NOREPO;
+
+	char objectsPath[PATH_MAX], commitsPath[PATH_MAX];
+	strcat_s(objectsPath, curRepository->absPath, "/." PROGRAM_NAME "/objects");
+	strcat_s(commitsPath, curRepository->absPath, "/." PROGRAM_NAME "/commits");
+
+	uint objectCount = 0, commitCount = 0;
+	int error = __shard_directory(objectsPath, &objectCount);
+	error = __shard_directory(commitsPath, &commitCount) ?: error;
+	if (error != ERR_NOERR)
+		printError("Some files could not be moved! (They are still usable in the old layout)");
+
+	if (objectCount || commitCount)
+		printf("Successfully migrated " _CYANB "%u" _RST " object(s) and " _CYANB "%u" _RST " commit(s).\n", objectCount, commitCount);
+	else
+		printWarning("The repository is already in the sharded layout! Nothing to migrate ...");
+	return error;
+}
+
+// Statistics of garbage collection
+typedef struct _gc_stats_t
+{
+	uint objects;	 /**< Number of removed objects. */
+	uint commits;	 /**< Number of removed commits. */
+	uint staged;	 /**< Number of removed stale staged files. */
+	uint64_t freed;	 /**< Number of freed bytes. */
+} GcStats;
+
+// Mark an object, the chain of its delta bases and the chunks of chunked objects
+static void __gc_mark_object(StringSet *objects, constString hash)
+{
+	if (!strcmp(hash, "dddddddddd") || !strcmp(hash, "dirdirdird"))
+		return;
+	char base[OBJ_HASH_LEN + 1];
+	for (; stringSetAdd(objects, hash); hash = base)
+	{
+		String *chunks = NULL;
+		uint chunkCount = listObjectChunks(hash, &chunks);
+		for (uint i = 0; i < chunkCount; i++)
+		{
+			stringSetAdd(objects, chunks[i]);
+			free(chunks[i]);
+		}
+		free(chunks);
+		if (!getDeltaBase(base, hash))
+			break;
+	}
+}
+
+// Mark the object of a file of a tree (callback of walkTree)
+static void __gc_mark_tree_entry(const TreeEntry *entry, void *objects)
+{
+	__gc_mark_object(objects, entry->hashStr);
+}
+
+// Mark a commit, its trees and objects, and all of its ancestors
+static void __gc_mark_commit(StringSet *commits, StringSet *trees, StringSet *objects, uint64_t hash)
+{
+	// Iterative walk (a stack of hashes to be visited)
+	uint64_t *stack = NULL;
+	uint stackLen = 0;
+	ADD_EMPTY(stack, stackLen, uint64_t);
+	stack[0] = hash;
+	while (stackLen)
+	{
+		hash = stack[--stackLen];
+		char name[20];
+		sprintf(name, "%06lx", hash);
+		if (hash == 0 || hash == 0xFFFFFF || !stringSetAdd(commits, name))
+			continue;
+
+		Commit *commit = getCommitHeader(hash);
+		if (!commit)
+			continue;
+		// Trees shared with other commits are only walked once (HEAD files of old commits are in the commit file)
+		if (*commit->treeHash)
+			walkTree(commit->treeHash, trees, __gc_mark_tree_entry, objects);
+		else if (getCommitHeadFiles(commit))
+			for (uint i = 0; i < commit->headFiles.len; i++)
+				__gc_mark_object(objects, commit->headFiles.arr[i].hashStr);
+		if (getCommitedFiles(commit))
+			for (uint i = 0; i < commit->commitedFiles.len; i++)
+				__gc_mark_object(objects, commit->commitedFiles.arr[i].hashStr);
+
+		ADD_EMPTY(stack, stackLen, uint64_t);
+		stack[stackLen - 1] = commit->prev;
+		if (commit->mergedCommit)
+		{
+			ADD_EMPTY(stack, stackLen, uint64_t);
+			stack[stackLen - 1] = commit->mergedCommit;
+		}
+		freeCommitStruct(commit);
+	}
+	free(stack);
+}
+
+// Remove the files of a directory which are not marked (recursing into its shard directories)
+static void __gc_sweep_directory(constString dirPath, const StringSet *marked, bool recurse, uint *countDest, uint64_t *freedDest)
+{
+	tryWith(DIR *, dir, opendir(dirPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			char path[PATH_MAX];
+			struct stat st;
+			if (stat(strcat_s(path, dirPath, "/", entry->d_name), &st) != 0)
+				continue;
+
+			if (S_ISDIR(st.st_mode))
+			{
+				if (recurse && strlen(entry->d_name) == SHARD_PREFIX_LEN)
+				{
+					__gc_sweep_directory(path, marked, false, countDest, freedDest);
+					rmdir(path); // only if it became empty
+				}
+			}
+			else if (!stringSetContains(marked, entry->d_name) && remove(path) == 0)
+			{
+				// Leftovers of interrupted writes are not counted as objects
+				size_t nameLen = strlen(entry->d_name);
+				if (nameLen <= 4 || strcmp(entry->d_name + nameLen - 4, ".tmp") != 0)
+					(*countDest)++;
+				*freedDest += st.st_size;
+			}
+		}
+	}
+}
+
+// Format a number of bytes for humans
+static String __format_size(String dest, uint64_t bytes)
+{
+	if (bytes < 1024)
+		sprintf(dest, "%lu B", bytes);
+	else if (bytes < 1024 * 1024)
+		sprintf(dest, "%.1f KiB", bytes / 1024.0);
+	else if (bytes < 1024ULL * 1024 * 1024)
+		sprintf(dest, "%.1f MiB", bytes / (1024.0 * 1024));
+	else
+		sprintf(dest, "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+	return dest;
+}
+
+int command_gc(int argc, constString argv[], bool performActions)
+{
+	if (!performActions)
+		return ERR_NOERR;
+	if (!curRepository)
+		return ERR_NOREPO;
+
+	StringSet commits, trees, objects, staged;
+	stringSetInit(&commits, 0);
+	stringSetInit(&trees, 0);
+	stringSetInit(&objects, 0);
+	stringSetInit(&staged, curRepository->stagingArea.len);
+
+	// Mark: branch heads, tags and HEAD
+	String branches[20] = {NULL};
+	uint64_t branchHeads[20] = {0};
+	int branchCount = listBranches(branches, branchHeads);
+	for (int i = 0; i < branchCount; i++)
+		__gc_mark_commit(&commits, &trees, &objects, branchHeads[i]);
+	for (int i = 0; i <= branchCount && i < 20; i++)
+		free(branches[i]);
+
+	Tag *tags = NULL;
+	uint tagCount = listTags(&tags, 0);
+	for (uint i = 0; i < tagCount; i++)
+		__gc_mark_commit(&commits, &trees, &objects, tags[i].commitHash);
+	freeTagStruct(tags, tagCount);
+
+	__gc_mark_commit(&commits, &trees, &objects, curRepository->head.hash);
+
+	// Trees are objects too (They are kept in their own set, so a file with the same content does not hide their subtrees)
+	for (size_t i = 0; i < trees.cap; i++)
+		if (trees.slots[i])
+			stringSetAdd(&objects, trees.slots[i]);
+	stringSetFree(&trees);
+
+	// Mark: the staging area and all of its snapshots (they may refer to already stored objects)
+	for (uint i = 0; i < curRepository->stagingArea.len; i++)
+		stringSetAdd(&staged, curRepository->stagingArea.arr[i].hashStr);
+	addSnapshotObjects(&staged);
+	for (size_t i = 0; i < staged.cap; i++)
+		if (staged.slots[i])
+			__gc_mark_object(&objects, staged.slots[i]);
+	char stagePath[PATH_MAX], path[PATH_MAX];
+	strcat_s(stagePath, curRepository->absPath, "/." PROGRAM_NAME "/stage");
+	stringSetAdd(&staged, "index");
+	stringSetAdd(&staged, "info");
+	stringSetAdd(&staged, "journal");
+
+	// Sweep: loose objects, packs, commits and the staging area
+	GcStats stats = {0};
+	uint removedPacked = 0;
+	uint64_t freedPacked = 0;
+	int error = prunePacks(&objects, &removedPacked, &freedPacked);
+	stats.objects += removedPacked;
+	stats.freed += freedPacked;
+
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/objects");
+	__gc_sweep_directory(path, &objects, true, &stats.objects, &stats.freed);
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/commits");
+	__gc_sweep_directory(path, &commits, true, &stats.commits, &stats.freed);
+	if (stats.commits) // Removed commits must not remain in the commit graph
+		writeCommitGraph(NULL);
+	__gc_sweep_directory(stagePath, &staged, false, &stats.staged, &stats.freed);
+
+	stringSetFree(&commits);
+	stringSetFree(&objects);
+	stringSetFree(&staged);
+
+	if (error != ERR_NOERR)
+		printError("Error while rewriting the pack files! (Packed objects are not removed)");
+	char size[50];
+	printf("Removed " _CYANB "%u" _RST " object(s), " _CYANB "%u" _RST " commit(s) and " _CYANB "%u" _RST " stale staged file(s).\n",
+		   stats.objects, stats.commits, stats.staged);
+	printf("Reclaimed " _GRNB "%s" _RST " of disk space.\n", __format_size(size, stats.freed));
+	return error;
+}
+
+// Result of verifying an object by fsck
+#define FSCK_OK 0
+#define FSCK_MISSING 1
+#define FSCK_CORRUPT 2
+#define FSCK_MAX_THREADS 64
+
+// An object to be verified by fsck, and the commit which refers to it (0 for bases and chunks)
+typedef struct _fsck_job_t
+{
+	char hash[OBJ_HASH_LEN + 1];
+	uint64_t commit;
+} FsckJob;
+
+// State shared by the fsck workers (guarded by lock)
+typedef struct _fsck_state_t
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	FsckJob *jobs;	   /**< Stack of objects to be verified. */
+	size_t jobsLen;	   /**< Number of queued objects. */
+	size_t jobsCap;	   /**< Capacity of the stack. */
+	uint busy;		   /**< Number of workers which are verifying an object. */
+	StringSet seen;	   /**< Objects which are reachable (queued once). */
+	uint64_t verified; /**< Number of verified objects. */
+	uint64_t bytes;	   /**< Number of verified bytes (content). */
+	uint64_t missing;  /**< Number of missing objects. */
+	uint64_t corrupt;  /**< Number of unreadable objects, or objects which do not match their hash. */
+	uint64_t dangling; /**< Number of stored objects which are not reachable. */
+} FsckState;
+
+// Queue an object if it is not queued yet (The lock must be held)
+static bool __fsck_push(FsckState *state, constString hash, uint64_t commit)
+{
+	if (!strcmp(hash, "dddddddddd") || !strcmp(hash, "dirdirdird") || !stringSetAdd(&state->seen, hash))
+		return false;
+	if (state->jobsLen == state->jobsCap)
+	{
+		size_t cap = state->jobsCap ? state->jobsCap * 2 : 1024;
+		FsckJob *jobs = realloc(state->jobs, cap * sizeof(FsckJob));
+		if (!jobs)
+			return false;
+		state->jobs = jobs;
+		state->jobsCap = cap;
+	}
+	strcpy(state->jobs[state->jobsLen].hash, hash);
+	state->jobs[state->jobsLen++].commit = commit;
+	return true;
+}
+
+// Read the whole content of an object and check it against its content hash
+static int __fsck_verify_object(constString hash, uchar *buf, uint64_t *sizeDest)
+{
+	ObjectReader *reader = openObject(hash);
+	if (!reader)
+		return isObjectExist(hash) ? FSCK_CORRUPT : FSCK_MISSING;
+
+	Sha256Context ctx;
+	sha256Init(&ctx);
+	size_t n;
+	uint64_t size = 0;
+	while ((n = readObject(reader, buf, OBJ_BLOCK_SIZE)) > 0)
+	{
+		sha256Update(&ctx, buf, n);
+		size += n;
+	}
+	bool ok = !reader->error && size == reader->size;
+	closeObject(reader);
+	*sizeDest = size;
+
+	// Objects of old repositories have random IDs; they can only be checked for being readable
+	if (ok && isContentHash(hash))
+	{
+		uchar digest[SHA256_DIGEST_LEN];
+		char hex[OBJ_HASH_LEN + 1];
+		sha256Final(&ctx, digest);
+		ok = !strcmp(digestToHex(hex, digest, SHA256_DIGEST_LEN), hash);
+	}
+	return ok ? FSCK_OK : FSCK_CORRUPT;
+}
+
+// Worker of fsck: verify queued objects, and queue the bases and chunks they need
+static void *__fsck_worker(void *arg)
+{
+	FsckState *state = arg;
+	uchar *buf = malloc(OBJ_BLOCK_SIZE);
+	pthread_mutex_lock(&state->lock);
+	while (buf)
+	{
+		while (!state->jobsLen && state->busy)
+			pthread_cond_wait(&state->cond, &state->lock);
+		if (!state->jobsLen) // Nothing queued and nothing in progress -> done
+			break;
+		FsckJob job = state->jobs[--state->jobsLen];
+		state->busy++;
+		pthread_mutex_unlock(&state->lock);
+
+		// Objects are read without the lock
+		uint64_t size = 0;
+		int status = __fsck_verify_object(job.hash, buf, &size);
+		char base[OBJ_HASH_LEN + 1];
+		bool hasBase = status != FSCK_MISSING && getDeltaBase(base, job.hash);
+		String *chunks = NULL;
+		uint chunkCount = status != FSCK_MISSING ? listObjectChunks(job.hash, &chunks) : 0;
+
+		pthread_mutex_lock(&state->lock);
+		char from[30] = "";
+		if (job.commit)
+			sprintf(from, " (in commit %06lx)", job.commit);
+		if (status == FSCK_MISSING)
+		{
+			state->missing++;
+			printf(_REDB "missing object" _RST " %s%s\n", job.hash, from);
+		}
+		else if (status == FSCK_CORRUPT)
+		{
+			state->corrupt++;
+			printf(_REDB "corrupt object" _RST " %s%s\n", job.hash, from);
+		}
+		state->verified++;
+		state->bytes += size;
+
+		bool pushed = hasBase && __fsck_push(state, base, 0);
+		for (uint i = 0; i < chunkCount; i++)
+		{
+			pushed = __fsck_push(state, chunks[i], 0) || pushed;
+			free(chunks[i]);
+		}
+		free(chunks);
+		state->busy--;
+		if (pushed || (!state->busy && !state->jobsLen))
+			pthread_cond_broadcast(&state->cond);
+	}
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+	free(buf);
+	return NULL;
+}
+
+// A commit to be checked by fsck, and what refers to it
+typedef struct _fsck_commit_t
+{
+	uint64_t hash;
+	char from[64];
+} FsckCommit;
+
+// Queue a commit of the commit graph (No lock is needed; commits are walked before the workers start)
+static void __fsck_push_commit(FsckCommit **stack, uint *stackLen, uint64_t hash, constString from)
+{
+	ADD_EMPTY(*stack, *stackLen, FsckCommit);
+	(*stack)[*stackLen - 1].hash = hash;
+	snprintf((*stack)[*stackLen - 1].from, sizeof((*stack)[*stackLen - 1].from), "%s", from);
+}
+
+// Check that branches, tags and HEAD point at commits, and queue those commits
+static uint __fsck_check_refs(FsckCommit **stack, uint *stackLen)
+{
+	uint problems = 0;
+	char path[PATH_MAX], buf[STR_LINE_MAX], from[STR_LINE_MAX], name[STR_LINE_MAX];
+	uint64_t hash;
+
+	StringSet branches;
+	stringSetInit(&branches, 0);
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/branches");
+	with(file, fopen(path, "r"), fclose(file))
+		while (fgets(buf, STR_LINE_MAX, file))
+		{
+			if (sscanf(buf, "%[^:]:%lx", name, &hash) != 2)
+			{
+				printf(_REDB "invalid branch line" _RST " '%s'\n", strtrim(buf));
+				problems++;
+				continue;
+			}
+			stringSetAdd(&branches, name);
+			if (hash != 0xFFFFFF) // A branch without commits
+				__fsck_push_commit(stack, stackLen, hash, strcat_s(from, "branch '", name, "'"));
+		}
+
+	char message[STR_LINE_MAX], authorName[STR_LINE_MAX], authorEmail[STR_LINE_MAX];
+	time_t tagTime;
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/tags");
+	with(file, fopen(path, "r"), fclose(file))
+		while (fgets(buf, STR_LINE_MAX, file))
+		{
+			if (isEmpty(strtrim(buf)))
+				continue;
+			if (sscanf(buf, "[%[^]]]:[%[^]]]:%lx:%[^:]:%[^:]:%ld", name, message, &hash, authorName, authorEmail, &tagTime) != 6)
+			{
+				printf(_REDB "invalid tag line" _RST " '%s'\n", buf);
+				problems++;
+				continue;
+			}
+			__fsck_push_commit(stack, stackLen, hash, strcat_s(from, "tag '", name, "'"));
+		}
+
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/HEAD");
+	*buf = '\0';
+	with(file, fopen(path, "r"), fclose(file))
+		fgets(buf, STR_LINE_MAX, file);
+	strtrim(buf);
+	if (sscanf(buf, "branch/%s", name) == 1)
+	{
+		if (!stringSetContains(&branches, name))
+		{
+			printf(_REDB "invalid HEAD" _RST " (branch '%s' does not exist)\n", name);
+			problems++;
+		}
+	}
+	else if (sscanf(buf, "commit/%lx:%s", &hash, name) == 2)
+		__fsck_push_commit(stack, stackLen, hash, "HEAD");
+	else
+	{
+		printf(_REDB "invalid HEAD" _RST " '%s'\n", buf);
+		problems++;
+	}
+	stringSetFree(&branches);
+	return problems;
+}
+
+// A commit whose trees are walked by fsck
+typedef struct _fsck_tree_walk_t
+{
+	FsckState *state;
+	uint64_t commit;
+} FsckTreeWalk;
+
+// Queue the object of a file of a tree (callback of walkTree)
+static void __fsck_push_tree_entry(const TreeEntry *entry, void *arg)
+{
+	FsckTreeWalk *walk = arg;
+	__fsck_push(walk->state, entry->hashStr, walk->commit);
+}
+
+// Walk the commit graph from the refs, and queue the objects (and trees) of the commits
+static uint __fsck_walk_commits(FsckState *state, StringSet *commits)
+{
+	FsckCommit *stack = NULL;
+	uint stackLen = 0;
+	StringSet trees;
+	stringSetInit(&trees, 0);
+	uint problems = __fsck_check_refs(&stack, &stackLen);
+	while (stackLen)
+	{
+		FsckCommit item = stack[--stackLen];
+		char name[20];
+		sprintf(name, "%06lx", item.hash);
+		if (!stringSetAdd(commits, name))
+			continue;
+
+		Commit *commit = getCommitHeader(item.hash);
+		if (!commit || !getCommitedFiles(commit) || (!*commit->treeHash && !getCommitHeadFiles(commit)))
+		{
+			printf(_REDB "missing or broken commit" _RST " %s (referenced by %s)\n", name, item.from);
+			problems++;
+			freeCommitStruct(commit);
+			continue;
+		}
+		FsckTreeWalk walk = {state, commit->hash};
+		if (!*commit->treeHash)
+			for (uint i = 0; i < commit->headFiles.len; i++)
+				__fsck_push(state, commit->headFiles.arr[i].hashStr, commit->hash);
+		else if (walkTree(commit->treeHash, &trees, __fsck_push_tree_entry, &walk) != ERR_NOERR)
+		{
+			printf(_REDB "missing or broken tree" _RST " in commit %s\n", name);
+			problems++;
+		}
+		for (uint i = 0; i < commit->commitedFiles.len; i++)
+			__fsck_push(state, commit->commitedFiles.arr[i].hashStr, commit->hash);
+
+		char from[64];
+		sprintf(from, "commit %06lx", item.hash);
+		if (commit->prev != 0xFFFFFF)
+			__fsck_push_commit(&stack, &stackLen, commit->prev, from);
+		if (commit->mergedCommit)
+			__fsck_push_commit(&stack, &stackLen, commit->mergedCommit, from);
+		freeCommitStruct(commit);
+	}
+	free(stack);
+
+	// The trees themselves are verified like other objects
+	for (size_t i = 0; i < trees.cap; i++)
+		if (trees.slots[i])
+			__fsck_push(state, trees.slots[i], 0);
+	stringSetFree(&trees);
+	return problems;
+}
+
+// Report a stored object which is not reachable
+static void __fsck_check_dangling(constString hash, void *arg)
+{
+	FsckState *state = arg;
+	if (stringSetContains(&state->seen, hash))
+		return;
+	state->dangling++;
+	printf(_YELB "dangling object" _RST " %s\n", hash);
+}
+
+// Report the loose objects which are not reachable (in the flat layout and the shard directories)
+static void __fsck_check_loose_objects(FsckState *state, constString dirPath, bool recurse)
+{
+	tryWith(DIR *, dir, opendir(dirPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (entry->d_name[0] == '.')
+				continue;
+			char path[PATH_MAX];
+			size_t nameLen = strlen(entry->d_name);
+			if (nameLen == SHARD_PREFIX_LEN)
+			{
+				if (recurse)
+					__fsck_check_loose_objects(state, strcat_s(path, dirPath, "/", entry->d_name), false);
+			}
+			else if (nameLen <= 4 || strcmp(entry->d_name + nameLen - 4, ".tmp") != 0) // Unfinished writes are not objects
+				__fsck_check_dangling(entry->d_name, state);
+		}
+	}
+}
+
+// Get a monotonic time in seconds
+static double __get_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int command_fsck(int argc, constString argv[], bool performActions)
+{
+	long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc == 3)
+	{
+		if (!checkArgument(1, "-j") || (threadCount = atol(argv[2])) <= 0)
+			return ERR_ARGS_MISSING;
+	}
+	else if (argc != 1)
+		return ERR_ARGS_MISSING;
+	if (!performActions)
+		return ERR_NOERR;
+	if (!curRepository)
+		return ERR_NOREPO;
+	if (threadCount <= 0)
+		threadCount = 1;
+	else if (threadCount > FSCK_MAX_THREADS)
+		threadCount = FSCK_MAX_THREADS;
+
+	double startTime = __get_time();
+	FsckState state = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+	stringSetInit(&state.seen, 0);
+
+	// The commit graph is walked first (commits are small), then objects are verified in parallel
+	StringSet commits;
+	stringSetInit(&commits, 0);
+	uint problems = __fsck_walk_commits(&state, &commits);
+	for (uint i = 0; i < curRepository->stagingArea.len; i++)
+		__fsck_push(&state, curRepository->stagingArea.arr[i].hashStr, 0);
+
+	// Objects of the snapshots of the staging area are only reachable from them (they are not verified)
+	addSnapshotObjects(&state.seen);
+
+	pthread_t threads[FSCK_MAX_THREADS];
+	long started = 0;
+	for (; started < threadCount; started++)
+		if (pthread_create(&threads[started], NULL, __fsck_worker, &state) != 0)
+			break;
+	if (!started) // Could not start any thread -> verify in this thread
+		__fsck_worker(&state);
+	for (long i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = __get_time() - startTime;
+
+	// Dangling objects and commits
+	char path[PATH_MAX];
+	strcat_s(path, curRepository->absPath, "/." PROGRAM_NAME "/objects");
+	__fsck_check_loose_objects(&state, path, true);
+	forEachPackedObject(__fsck_check_dangling, &state);
+	uint64_t *commitHashes = NULL;
+	uint commitCount = listCommitHashes(&commitHashes);
+	for (uint i = 0; i < commitCount; i++)
+	{
+		char name[20];
+		if (!stringSetContains(&commits, (sprintf(name, "%06lx", commitHashes[i]), name)))
+		{
+			state.dangling++;
+			printf(_YELB "dangling commit" _RST " %s\n", name);
+		}
+	}
+	free(commitHashes);
+
+	problems += state.missing + state.corrupt;
+	char size[50];
+	printf("\nChecked " _CYANB "%u" _RST " commit(s) and " _CYANB "%lu" _RST " object(s) (%s) in %.2fs with %ld thread(s)",
+		   (uint)commits.len, state.verified, __format_size(size, state.bytes), elapsed, started ? started : 1);
+	if (elapsed > 0)
+		printf(": %.0f objects/s, %s/s", state.verified / elapsed, __format_size(size, state.bytes / elapsed));
+	printf(".\n");
+	if (state.dangling)
+		printf(_YEL "%lu dangling object(s)/commit(s) found; " _BOLD "neogit gc" _UNBOLD " removes them.\n" _RST, state.dangling);
+	fflush(stdout);
+	if (problems)
+		printError("Found %u problem(s)! (missing objects: %lu, corrupt objects: %lu)", problems, state.missing, state.corrupt);
+	else
+		printf(_GRNB "No problem found.\n" _RST);
+
+	free(state.jobs);
+	stringSetFree(&state.seen);
+	stringSetFree(&commits);
+	return problems ? ERR_GENERAL : ERR_NOERR;
+}
+
+int command_fsmonitor(int argc, constString argv[], bool performActions)
+{
+	if (!checkArgument(1, "start") && !checkArgument(1, "stop") && !checkArgument(1, "status"))
+		return ERR_ARGS_MISSING;
+	if (!performActions)
+		return ERR_NOERR;
+	if (!curRepository)
+		return ERR_NOREPO;
+
+	int error = ERR_NOERR;
+	if (checkArgument(1, "start"))
+	{
+		pid_t pid = 0;
+		uint dirCount = 0;
+		if ((error = startFsmonitor(&pid, &dirCount)) == ERR_NOERR)
+			printf("File system monitor started (pid " _CYANB "%d" _RST "), watching " _CYANB "%u" _RST " directories.\n", pid, dirCount);
+		else if (error == ERR_ALREADY_EXIST)
+			printWarning("File system monitor is already running.");
+		else
+			printError("Error! Could not start the file system monitor.");
+	}
+	else if (checkArgument(1, "stop"))
+	{
+		if ((error = stopFsmonitor()) == ERR_NOERR)
+			printf("File system monitor stopped.\n");
+		else
+			printWarning("File system monitor is not running.");
+	}
+	else
+	{
+		uint dirCount = 0, pathCount = 0;
+		bool overflowed = false;
+		if ((error = getFsmonitorStatus(&dirCount, &pathCount, &overflowed)) != ERR_NOERR)
+			printf("File system monitor is not running.\n");
+		else if (overflowed)
+			printf(_YEL "File system monitor has lost changes; the working tree is scanned (Restart it).\n" _RST);
+		else
+			printf("File system monitor is running: " _CYANB "%u" _RST " watched directories, " _CYANB "%u" _RST " changed paths.\n",
+				   dirCount, pathCount);
+		error = ERR_NOERR;
+	}
+	return error == ERR_ALREADY_EXIST || error == ERR_NOT_EXIST ? ERR_NOERR : error;
+}
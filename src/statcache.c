@@ -0,0 +1,242 @@
+/*******************************
+ *        statcache.c          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "statcache.h"
+
+extern Repository *curRepository; // Declared in neogit.c
+
+// A recorded working tree file
+typedef struct _stat_cache_entry_t
+{
+	String path;
+	uint64_t size;
+	uint64_t mtime; // nanoseconds
+	uint64_t ctime; // nanoseconds
+	uint64_t inode;
+	char hash[OBJ_HASH_LEN + 1];
+	bool trusted; // Loaded from the cache file and not racily clean
+	bool fresh;	  // Recorded by this process (its stat data were taken before its content was read)
+} StatCacheEntry;
+
+// Stat cache of the current repository (loaded on the first lookup)
+static StatCacheEntry *__entries = NULL;
+static uint __entryCount = 0, __entryCap = 0;
+static bool __loaded = false;
+static bool __modified = false;
+static uint64_t __hits = 0, __reads = 0;
+
+#define __ns(ts) ((uint64_t)(ts).tv_sec * 1000000000ULL + (uint64_t)(ts).tv_nsec)
+
+static String __get_cache_path(String dest)
+{
+	return strcat_s(dest, curRepository->absPath, "/." PROGRAM_NAME "/stat-cache");
+}
+
+static const void *__entry_key(const void *ctx, uint index)
+{
+	return __entries[index].path;
+}
+
+static IndexMap __table = {NULL, 0, 0, __entry_key, NULL, 0}; // Index of the entries by path
+
+static StatCacheEntry *__add_entry(constString path)
+{
+	if (__entryCount == __entryCap)
+	{
+		uint newCap = __entryCap ? __entryCap * 2 : 64;
+		StatCacheEntry *entries = realloc(__entries, newCap * sizeof(StatCacheEntry));
+		if (!entries)
+			return NULL;
+		__entries = entries;
+		__entryCap = newCap;
+	}
+	StatCacheEntry *entry = &__entries[__entryCount];
+	memset(entry, 0, sizeof(StatCacheEntry));
+	if (!(entry->path = strDup(path)))
+		return NULL;
+	if (!indexMapAdd(&__table, __entryCount))
+	{
+		free(entry->path);
+		return NULL;
+	}
+	__entryCount++;
+	return entry;
+}
+
+// Report the counters of the cache (NEOGIT_TRACE=1)
+static void __trace_stat_cache()
+{
+	fprintf(stderr, "[trace] stat cache : %lu hit(s), %lu content read(s), %u file(s) recorded\n", __hits, __reads, __entryCount);
+}
+
+// Read the cache file (A missing or invalid file is an empty cache)
+void loadStatCache()
+{
+	if (__loaded)
+		return;
+	__loaded = true;
+	if (getenv(TRACE_ENV))
+		atexit(__trace_stat_cache);
+
+	char path[PATH_MAX];
+	struct stat st = {0};
+	size_t len = 0;
+	const uchar *map = NULL;
+	if (stat(__get_cache_path(path), &st) == 0)
+		map = mapFile(path, &len);
+	uint count = map && len >= STAT_CACHE_HEADER_SIZE && !memcmp(map, STAT_CACHE_MAGIC, 4) && getLE32(map + 4) == STAT_CACHE_VERSION
+					 ? getLE32(map + 8)
+					 : 0;
+	if (count > (len - STAT_CACHE_HEADER_SIZE) / STAT_CACHE_ENTRY_SIZE)
+		count = 0;
+	indexMapReserve(&__table, count);
+
+	// Files which are changed in the same timestamp as the cache file may be changed after it is written
+	uint64_t cacheTime = __ns(st.st_mtim);
+	size_t pos = STAT_CACHE_HEADER_SIZE;
+	for (uint i = 0; __table.slots && i < count; i++)
+	{
+		const uchar *record = map + pos;
+		uint pathLen = pos + STAT_CACHE_ENTRY_SIZE <= len ? getLE32(record + 32) : 0;
+		if (!pathLen || pathLen > len - pos - STAT_CACHE_ENTRY_SIZE || !record[40])
+			break; // The rest is corrupted; it is only a cache
+		String entryPath = strndup((constString)record + STAT_CACHE_ENTRY_SIZE, pathLen);
+		StatCacheEntry *entry = entryPath ? __add_entry(entryPath) : NULL;
+		free(entryPath);
+		if (!entry)
+			break;
+		entry->size = getLE64(record);
+		entry->mtime = getLE64(record + 8);
+		entry->ctime = getLE64(record + 16);
+		entry->inode = getLE64(record + 24);
+		memcpy(entry->hash, record + 40, OBJ_HASH_LEN);
+		entry->hash[OBJ_HASH_LEN] = '\0';
+		entry->trusted = entry->mtime < cacheTime && entry->ctime < cacheTime;
+		pos += STAT_CACHE_ENTRY_SIZE + pathLen;
+	}
+	unmapFile(map, len);
+}
+
+static bool __is_stat_same(const StatCacheEntry *entry, const struct stat *st)
+{
+	return entry->size == (uint64_t)st->st_size && entry->mtime == __ns(st->st_mtim) && entry->ctime == __ns(st->st_ctim) &&
+		   entry->inode == (uint64_t)st->st_ino;
+}
+
+void recordStatCache(constString path, const struct stat *st, constString hash)
+{
+	loadStatCache();
+	if (!__table.slots)
+		return;
+	long index = indexMapFind(&__table, path);
+	StatCacheEntry *entry = index >= 0 ? &__entries[index] : __add_entry(path);
+	if (!entry)
+		return;
+	entry->size = st->st_size;
+	entry->mtime = __ns(st->st_mtim);
+	entry->ctime = __ns(st->st_ctim);
+	entry->inode = st->st_ino;
+	strcpy(entry->hash, hash);
+	entry->trusted = false; // It is trusted after the cache is written
+	entry->fresh = true;
+	__modified = true;
+}
+
+bool lookupStatCache(constString path, const struct stat *st, String hashDest)
+{
+	long index = indexMapFind(&__table, path);
+	const StatCacheEntry *entry = index >= 0 ? &__entries[index] : NULL;
+	if (!entry || !(entry->trusted || entry->fresh) || !__is_stat_same(entry, st))
+		return false;
+	strcpy(hashDest, entry->hash);
+	return true;
+}
+
+bool isWorkingFileSame(constString path, constString hash)
+{
+	char absPath[PATH_MAX];
+	struct stat st;
+	if (stat(strcat_s(absPath, curRepository->absPath, "/", path), &st) != 0)
+		return false;
+
+	loadStatCache();
+	long index = indexMapFind(&__table, path);
+	StatCacheEntry *entry = index >= 0 ? &__entries[index] : NULL;
+	if (entry && (entry->trusted || entry->fresh) && __is_stat_same(entry, &st))
+	{
+		if (!strcmp(entry->hash, hash))
+		{
+			__hits++;
+			return true;
+		}
+		// Different content hashes mean different contents (only old random IDs must be compared)
+		if (isContentHash(entry->hash) && isContentHash(hash))
+		{
+			__hits++;
+			return false;
+		}
+	}
+
+	__reads++;
+	bool same = isFileSameAsObject(absPath, hash);
+	if (same)
+		recordStatCache(path, &st, hash);
+	return same;
+}
+
+// Order of the entries of the cache file (by path)
+static int __entry_path_comparator(const void *a, const void *b)
+{
+	return strcmp((*(const StatCacheEntry **)a)->path, (*(const StatCacheEntry **)b)->path);
+}
+
+int writeStatCache()
+{
+	if (!curRepository || !__modified)
+		return ERR_NOERR;
+
+	const StatCacheEntry **sorted = malloc((__entryCount + 1) * sizeof(StatCacheEntry *));
+	if (!sorted)
+		return ERR_MALLOC;
+	for (uint i = 0; i < __entryCount; i++)
+		sorted[i] = &__entries[i];
+	qsort(sorted, __entryCount, sizeof(StatCacheEntry *), __entry_path_comparator);
+
+	char path[PATH_MAX], tmpPath[PATH_MAX];
+	strcat_s(tmpPath, __get_cache_path(path), ".tmp");
+	bool ok = false;
+	with(cacheFile, fopen(tmpPath, "wb"), fclose(cacheFile))
+	{
+		uchar header[STAT_CACHE_HEADER_SIZE] = {0}, record[STAT_CACHE_ENTRY_SIZE];
+		memcpy(header, STAT_CACHE_MAGIC, 4);
+		putLE32(header + 4, STAT_CACHE_VERSION);
+		putLE32(header + 8, __entryCount);
+		fwrite(header, 1, STAT_CACHE_HEADER_SIZE, cacheFile);
+		for (uint i = 0; i < __entryCount; i++)
+		{
+			size_t pathLen = strlen(sorted[i]->path);
+			memset(record, 0, STAT_CACHE_ENTRY_SIZE);
+			putLE64(record, sorted[i]->size);
+			putLE64(record + 8, sorted[i]->mtime);
+			putLE64(record + 16, sorted[i]->ctime);
+			putLE64(record + 24, sorted[i]->inode);
+			putLE32(record + 32, pathLen);
+			memcpy(record + 40, sorted[i]->hash, strlen(sorted[i]->hash));
+			fwrite(record, 1, STAT_CACHE_ENTRY_SIZE, cacheFile);
+			fwrite(sorted[i]->path, 1, pathLen, cacheFile);
+		}
+		ok = !ferror(cacheFile);
+	}
+	free(sorted);
+	if (!ok || rename(tmpPath, path) != 0)
+	{
+		remove(tmpPath);
+		return ERR_FILE_ERROR;
+	}
+	__modified = false;
+	return ERR_NOERR;
+}
@@ -6,6 +6,7 @@
  *     FOP Project NeoGIT      *
  ********************************/
 #include "string_funcs.h"
+#include <errno.h>
 
 String boldText(constString s)
 {
@@ -260,6 +261,124 @@ time_t parseDateTimeAuto(constString dateTimeStr)
 	return ERR_ARGS_MISSING;
 }
 
+bool parseSize(constString sizeStr, uint64_t *dest)
+{
+	// strtoull accepts leading spaces and signs ("-1" would become 2^64 - 1)
+	if (!isdigit((unsigned char)*sizeStr))
+		return false;
+	String end;
+	errno = 0;
+	uint64_t n = strtoull(sizeStr, &end, 10);
+	if (errno == ERANGE)
+		return false;
+	uint shift = 0;
+	switch (*end)
+	{
+	case 'g':
+	case 'G':
+		shift += 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		shift += 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		shift += 10;
+		end++;
+	}
+	// Only a single suffix is allowed (e.g. "16x" and "16MB" are rejected)
+	if (*end != '\0' || (shift && n > (UINT64_MAX >> shift)))
+		return false;
+	*dest = n << shift;
+	return true;
+}
+
+bool nextField(StrView *rest, constString delim, StrView *field)
+{
+	if (!rest->str)
+		return false;
+	size_t delimLen = strlen(delim);
+	for (size_t i = 0; i + delimLen <= rest->len; i++)
+		if (rest->str[i] == *delim && !memcmp(rest->str + i, delim, delimLen))
+		{
+			*field = (StrView){rest->str, i};
+			*rest = (StrView){rest->str + i + delimLen, rest->len - i - delimLen};
+			return true;
+		}
+	*field = *rest;
+	*rest = (StrView){NULL, 0};
+	return true;
+}
+
+bool lastField(StrView *rest, char delim, StrView *field)
+{
+	if (!rest->str)
+		return false;
+	for (size_t i = rest->len; i > 0; i--)
+		if (rest->str[i - 1] == delim)
+		{
+			*field = (StrView){rest->str + i, rest->len - i};
+			rest->len = i - 1;
+			return true;
+		}
+	*field = *rest;
+	*rest = (StrView){NULL, 0};
+	return true;
+}
+
+bool viewSkipPrefix(StrView *view, constString prefix)
+{
+	size_t len = strlen(prefix);
+	if (!view->str || view->len < len || memcmp(view->str, prefix, len))
+		return false;
+	view->str += len;
+	view->len -= len;
+	return true;
+}
+
+bool viewEquals(StrView view, constString str)
+{
+	return view.str && view.len == strlen(str) && !memcmp(view.str, str, view.len);
+}
+
+bool viewToU64(StrView view, int base, uint64_t *dest)
+{
+	if (!view.str || !view.len)
+		return false;
+	uint64_t n = 0;
+	for (size_t i = 0; i < view.len; i++)
+	{
+		char c = tolower(view.str[i]);
+		int digit = isdigit(c) ? c - '0' : (base == 16 && c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+		if (digit < 0)
+			return false;
+		n = n * base + digit;
+	}
+	*dest = n;
+	return true;
+}
+
+bool viewCopy(String dest, size_t destSize, StrView view)
+{
+	if (!view.str || view.len >= destSize)
+		return false;
+	memcpy(dest, view.str, view.len);
+	dest[view.len] = '\0';
+	return true;
+}
+
+String viewDup(StrView view)
+{
+	String str = malloc(view.len + 1);
+	if (str)
+	{
+		memcpy(str, view.str, view.len);
+		str[view.len] = '\0';
+	}
+	return str;
+}
+
 String _dynamic_strcat_impl(constString first, ...)
 {
 	va_list l;
@@ -0,0 +1,319 @@
+/*******************************
+ *          trees.c            *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "trees.h"
+
+// Order of tree entries: by name, a file before a subdirectory with the same name
+static int __tree_entry_comparator(const void *a, const void *b)
+{
+	const TreeEntry *e1 = a, *e2 = b;
+	int cmp = strcmp(e1->name, e2->name);
+	return cmp ? cmp : (int)e1->isTree - (int)e2->isTree;
+}
+
+// Order of changes: by path, then by their order in the commit (the last one wins)
+static int __change_comparator(const void *a, const void *b)
+{
+	const GitObject *c1 = *(const GitObject **)a, *c2 = *(const GitObject **)b;
+	int cmp = strcmp(c1->file.path, c2->file.path);
+	return cmp ? cmp : (c1 < c2 ? -1 : c1 > c2);
+}
+
+// Append an entry to a dynamic array of entries (doubling its capacity)
+static TreeEntry *__add_tree_entry(TreeEntry **entries, uint *count, uint *cap)
+{
+	if (*count == *cap)
+	{
+		uint newCap = *cap ? *cap * 2 : 16;
+		TreeEntry *newEntries = realloc(*entries, newCap * sizeof(TreeEntry));
+		if (!newEntries)
+			return NULL;
+		*entries = newEntries;
+		*cap = newCap;
+	}
+	TreeEntry *entry = &(*entries)[(*count)++];
+	memset(entry, 0, sizeof(TreeEntry));
+	return entry;
+}
+
+int readTree(constString hash, TreeEntry **entriesDest, uint *countDest)
+{
+	ObjectReader *reader = openObject(hash);
+	if (!reader)
+		return ERR_NOT_EXIST;
+	String content = malloc(reader->size + 1);
+	bool ok = content && readObject(reader, content, reader->size) == reader->size && !reader->error;
+	if (ok)
+		content[reader->size] = '\0';
+	closeObject(reader);
+	if (!ok)
+	{
+		free(content);
+		return ERR_FILE_ERROR;
+	}
+
+	TreeEntry *entries = NULL;
+	uint count = 0, cap = 0;
+	int error = ERR_NOERR;
+	for (String line = content, next; error == ERR_NOERR && *line; line = next)
+	{
+		if ((next = strchr(line, '\n')))
+			*(next++) = '\0';
+		else
+			next = line + strlen(line);
+
+		// "<name>/:<tree-hash>" or "<name>:<time>:<perm>:<hash>"
+		String colon = strchr(line, ':');
+		TreeEntry *entry = colon ? __add_tree_entry(&entries, &count, &cap) : NULL;
+		if (!entry)
+		{
+			error = colon ? ERR_MALLOC : ERR_FILE_ERROR;
+			break;
+		}
+		entry->isTree = colon > line && colon[-1] == '/';
+		entry->name = strndup(line, colon - line - entry->isTree);
+		if (entry->isTree)
+		{
+			if (strlen(colon + 1) != OBJ_HASH_LEN)
+				error = ERR_FILE_ERROR;
+			else
+				strcpy(entry->hashStr, colon + 1);
+		}
+		else if (sscanf(colon + 1, "%ld:%u:%64s", &entry->dateModif, &entry->permission, entry->hashStr) != 3)
+			error = ERR_FILE_ERROR;
+	}
+	free(content);
+
+	if (error != ERR_NOERR)
+	{
+		freeTreeEntries(entries, count);
+		return error;
+	}
+	*entriesDest = entries;
+	*countDest = count;
+	return ERR_NOERR;
+}
+
+void freeTreeEntries(TreeEntry *entries, uint count)
+{
+	for (uint i = 0; i < count; i++)
+		free(entries[i].name);
+	free(entries);
+}
+
+// Serialize sorted entries and store them as a tree object
+static int __store_tree(const TreeEntry *entries, uint count, String hashDest)
+{
+	size_t len = 0, cap = 4096;
+	String content = malloc(cap);
+	for (uint i = 0; content && i < count; i++)
+	{
+		// A line is never longer than the name + the hash + two numbers
+		size_t lineMax = strlen(entries[i].name) + OBJ_HASH_LEN + 64;
+		if (len + lineMax > cap)
+		{
+			while (len + lineMax > cap)
+				cap *= 2;
+			String newContent = realloc(content, cap);
+			if (!newContent)
+			{
+				free(content);
+				return ERR_MALLOC;
+			}
+			content = newContent;
+		}
+		if (entries[i].isTree)
+			len += sprintf(content + len, "%s/:%s\n", entries[i].name, entries[i].hashStr);
+		else
+			len += sprintf(content + len, "%s:%ld:%u:%s\n", entries[i].name, entries[i].dateModif, entries[i].permission, entries[i].hashStr);
+	}
+	if (!content)
+		return ERR_MALLOC;
+	int error = writeObjectBuffer(content, len, hashDest);
+	free(content);
+	return error;
+}
+
+// Write a new version of a directory: changes are sorted by path and all of them are in this directory (prefix)
+static int __write_tree(constString baseHash, constString prefix, GitObject **changes, uint changeCount, String hashDest)
+{
+	TreeEntry *base = NULL, *updates = NULL;
+	uint baseCount = 0, updatesCount = 0, updatesCap = 0;
+	int error = ERR_NOERR;
+	if (baseHash && *baseHash)
+		error = readTree(baseHash, &base, &baseCount);
+
+	// Files of this directory replace their entries; subdirectories with changes are written recursively
+	size_t prefixLen = strlen(prefix);
+	for (uint i = 0; error == ERR_NOERR && i < changeCount;)
+	{
+		constString rel = changes[i]->file.path + prefixLen;
+		constString slash = strchr(rel, '/');
+		if (!slash)
+		{
+			// The same path may be changed more than once; the last change wins
+			TreeEntry *entry = updatesCount && !updates[updatesCount - 1].isTree && !strcmp(updates[updatesCount - 1].name, rel)
+								   ? &updates[updatesCount - 1]
+								   : __add_tree_entry(&updates, &updatesCount, &updatesCap);
+			if (!entry)
+			{
+				error = ERR_MALLOC;
+				break;
+			}
+			if (!entry->name)
+				entry->name = strDup(rel);
+			entry->dateModif = changes[i]->file.dateModif;
+			entry->permission = changes[i]->file.permission;
+			strcpy(entry->hashStr, changes[i]->hashStr);
+			i++;
+			continue;
+		}
+
+		// All changes in the same subdirectory are next to each other (sorted by path)
+		size_t dirLen = slash - rel;
+		uint j = i + 1;
+		while (j < changeCount && !strncmp(changes[j]->file.path + prefixLen, rel, dirLen + 1))
+			j++;
+
+		TreeEntry key = {.name = strndup(rel, dirLen), .isTree = true};
+		TreeEntry *old = base ? bsearch(&key, base, baseCount, sizeof(TreeEntry), __tree_entry_comparator) : NULL;
+		String subPrefix = malloc(prefixLen + dirLen + 2);
+		TreeEntry *entry = key.name && subPrefix ? __add_tree_entry(&updates, &updatesCount, &updatesCap) : NULL;
+		if (!entry)
+		{
+			free(key.name);
+			free(subPrefix);
+			error = ERR_MALLOC;
+			break;
+		}
+		*entry = key;
+		sprintf(subPrefix, "%s%.*s/", prefix, (int)dirLen, rel);
+		error = __write_tree(old ? old->hashStr : NULL, subPrefix, changes + i, j - i, entry->hashStr);
+		free(subPrefix);
+		i = j;
+	}
+
+	// Merge the base entries and the updates (both sorted; an update replaces the base entry)
+	TreeEntry *merged = NULL;
+	uint mergedCount = 0, mergedCap = 0;
+	if (error == ERR_NOERR)
+	{
+		qsort(updates, updatesCount, sizeof(TreeEntry), __tree_entry_comparator);
+		uint b = 0, u = 0;
+		while (error == ERR_NOERR && (b < baseCount || u < updatesCount))
+		{
+			int cmp = b == baseCount ? 1 : u == updatesCount ? -1
+															 : __tree_entry_comparator(&base[b], &updates[u]);
+			TreeEntry *entry = __add_tree_entry(&merged, &mergedCount, &mergedCap);
+			if (!entry)
+				error = ERR_MALLOC;
+			else if (cmp < 0)
+				*entry = base[b++]; // The names are owned by the source arrays
+			else
+			{
+				*entry = updates[u++];
+				b += cmp == 0;
+			}
+		}
+	}
+	if (error == ERR_NOERR)
+		error = __store_tree(merged, mergedCount, hashDest);
+
+	free(merged);
+	freeTreeEntries(base, baseCount);
+	freeTreeEntries(updates, updatesCount);
+	return error;
+}
+
+int writeTree(constString baseHash, const GitObjectArray *changes, String hashDest)
+{
+	GitObject **sorted = malloc((changes->len + 1) * sizeof(GitObject *));
+	if (!sorted)
+		return ERR_MALLOC;
+	for (uint i = 0; i < changes->len; i++)
+		sorted[i] = &changes->arr[i];
+	qsort(sorted, changes->len, sizeof(GitObject *), __change_comparator);
+	int error = __write_tree(baseHash, "", sorted, changes->len, hashDest);
+	free(sorted);
+	return error;
+}
+
+// Append the files of a tree to an array (prefix is the path of the tree)
+static int __load_tree_files(constString hash, constString prefix, GitObjectArray *dest, uint *cap)
+{
+	TreeEntry *entries = NULL;
+	uint count = 0;
+	int error = readTree(hash, &entries, &count);
+	for (uint i = 0; error == ERR_NOERR && i < count; i++)
+	{
+		String path = strcat_d(prefix, entries[i].name, entries[i].isTree ? "/" : "");
+		if (!path)
+			error = ERR_MALLOC;
+		else if (entries[i].isTree)
+		{
+			error = __load_tree_files(entries[i].hashStr, path, dest, cap);
+			free(path);
+		}
+		else
+		{
+			if (dest->len == *cap)
+			{
+				uint newCap = *cap ? *cap * 2 : 64;
+				GitObject *arr = realloc(dest->arr, newCap * sizeof(GitObject));
+				if (!arr)
+				{
+					free(path);
+					error = ERR_MALLOC;
+					break;
+				}
+				dest->arr = arr;
+				*cap = newCap;
+			}
+			GitObject *obj = &dest->arr[dest->len++];
+			memset(obj, 0, sizeof(GitObject));
+			obj->file.path = path;
+			obj->file.dateModif = entries[i].dateModif;
+			obj->file.permission = entries[i].permission;
+			obj->file.isDeleted = !strcmp(entries[i].hashStr, "dddddddddd");
+			obj->file.isDir = !strcmp(entries[i].hashStr, "dirdirdird");
+			strcpy(obj->hashStr, entries[i].hashStr);
+		}
+	}
+	freeTreeEntries(entries, count);
+	return error;
+}
+
+int loadTreeFiles(constString hash, GitObjectArray *dest)
+{
+	uint cap = 0;
+	dest->arr = NULL;
+	dest->len = 0;
+	int error = __load_tree_files(hash, "", dest, &cap);
+	if (error != ERR_NOERR)
+	{
+		freeGitObjectArray(dest);
+		dest->arr = NULL;
+		dest->len = 0;
+	}
+	return error;
+}
+
+int walkTree(constString hash, StringSet *visited, void (*callback)(const TreeEntry *entry, void *arg), void *arg)
+{
+	if (!stringSetAdd(visited, hash))
+		return ERR_NOERR;
+	TreeEntry *entries = NULL;
+	uint count = 0;
+	int error = readTree(hash, &entries, &count);
+	for (uint i = 0; error == ERR_NOERR && i < count; i++)
+		if (entries[i].isTree)
+			error = walkTree(entries[i].hashStr, visited, callback, arg);
+		else if (callback)
+			callback(&entries[i], arg);
+	freeTreeEntries(entries, count);
+	return error;
+}
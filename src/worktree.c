@@ -0,0 +1,356 @@
+/*******************************
+ *         worktree.c          *
+ *    Copyright 2024 AHMZ      *
+ *  AmirHossein MohammadZadeh  *
+ *         402106434           *
+ *     FOP Project NeoGIT      *
+ ********************************/
+#include "worktree.h"
+#include "statcache.h"
+#include <pthread.h>
+#include <sched.h>
+
+extern Repository *curRepository; // Declared in neogit.c
+
+struct _scan_state_t;
+
+// A worker of a scan: its deque of directories (guarded by lock) and its results
+typedef struct _scan_worker_t
+{
+	struct _scan_state_t *state;
+	uint index;
+	pthread_mutex_t lock;
+	String *dirs;	  // Directories to be scanned (relative to the repository): [head, tail)
+	uint head, tail, cap;
+	ScanEntry *results; // Entries found by this worker
+	uint resultCount, resultCap;
+	uint64_t dirCount, hashCount;
+	bool failed; // Could not allocate memory
+} ScanWorker;
+
+// State shared by the workers of a scan
+typedef struct _scan_state_t
+{
+	ScanWorker *workers;
+	uint workerCount;
+	uint pending; // Directories which are queued or being scanned (atomic)
+} ScanState;
+
+uint getScanThreadCount()
+{
+	static uint count = 0;
+	if (!count)
+	{
+		long value = sysconf(_SC_NPROCESSORS_ONLN);
+		withString(config, getConfig(SCAN_THREADS_CONFIG))
+			value = atol(config);
+		count = value <= 0 ? 1 : value > SCAN_MAX_THREADS ? SCAN_MAX_THREADS
+														  : value;
+	}
+	return count;
+}
+
+// Queue a directory in the deque of a worker (The pending counter is increased first)
+static bool __scan_push(ScanWorker *worker, String dirPath)
+{
+	if (!dirPath)
+		return false;
+	__atomic_add_fetch(&worker->state->pending, 1, __ATOMIC_ACQ_REL);
+	bool ok = true;
+	pthread_mutex_lock(&worker->lock);
+	if (worker->tail == worker->cap)
+	{
+		// Move the queued directories to the front, or grow the deque
+		uint len = worker->tail - worker->head, newCap = len * 2 >= worker->cap ? (worker->cap ? worker->cap * 2 : 64) : worker->cap;
+		String *dirs = newCap == worker->cap ? worker->dirs : realloc(worker->dirs, newCap * sizeof(String));
+		if (dirs)
+		{
+			memmove(dirs, dirs + worker->head, len * sizeof(String));
+			worker->dirs = dirs;
+			worker->head = 0;
+			worker->tail = len;
+			worker->cap = newCap;
+		}
+		else
+			ok = false;
+	}
+	if (ok)
+		worker->dirs[worker->tail++] = dirPath;
+	pthread_mutex_unlock(&worker->lock);
+	if (!ok)
+	{
+		free(dirPath);
+		worker->failed = true;
+		__atomic_sub_fetch(&worker->state->pending, 1, __ATOMIC_ACQ_REL);
+	}
+	return ok;
+}
+
+// Take a directory from a deque: the newest one for its owner, the oldest one for thieves (NULL if it is empty)
+static String __scan_take(ScanWorker *worker, bool steal)
+{
+	String dirPath = NULL;
+	pthread_mutex_lock(&worker->lock);
+	if (worker->head < worker->tail)
+		dirPath = steal ? worker->dirs[worker->head++] : worker->dirs[--worker->tail];
+	pthread_mutex_unlock(&worker->lock);
+	return dirPath;
+}
+
+static bool __is_same_stat(const struct stat *st1, const struct stat *st2)
+{
+	return st1->st_size == st2->st_size && st1->st_mtim.tv_sec == st2->st_mtim.tv_sec && st1->st_mtim.tv_nsec == st2->st_mtim.tv_nsec &&
+		   st1->st_ctim.tv_sec == st2->st_ctim.tv_sec && st1->st_ctim.tv_nsec == st2->st_ctim.tv_nsec && st1->st_ino == st2->st_ino;
+}
+
+// Scan the entries of a directory (subdirectories are queued in the deque of the worker)
+static void __scan_directory(ScanWorker *worker, constString dirPath)
+{
+	bool root = !strcmp(dirPath, ".");
+	char absPath[PATH_MAX];
+	strcat_s(absPath, curRepository->absPath, root ? "" : "/", root ? "" : dirPath);
+	worker->dirCount++;
+
+	tryWith(DIR *, dir, opendir(absPath), {}, {}, closedir(dir))
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+			ScanEntry item = {0};
+			char childPath[PATH_MAX];
+			if (stat(strcat_s(childPath, absPath, "/", entry->d_name), &item.st) != 0)
+				continue;
+			item.isDir = S_ISDIR(item.st.st_mode);
+			item.path = root ? strDup(entry->d_name) : strcat_d(dirPath, "/", entry->d_name);
+
+			// Don't scan .neogit folder! (.gitignore patterns are handled here too)
+			FileEntry fileEntry = {.path = item.path, .isDir = item.isDir};
+			if (!item.path || (item.isDir && !strcmp(item.path, "." PROGRAM_NAME)) || isGitIgnore(&fileEntry))
+			{
+				worker->failed |= !item.path;
+				free(item.path);
+				continue;
+			}
+
+			if (item.isDir)
+				__scan_push(worker, strDup(item.path));
+			else if (isTrackedFile(item.path) && !lookupStatCache(item.path, &item.st, item.hash))
+			{
+				// The hash is only used if the file is not changed while it is read
+				struct stat after;
+				item.hashed = sha256File(childPath, item.hash) == ERR_NOERR && stat(childPath, &after) == 0 && __is_same_stat(&item.st, &after);
+				if (!item.hashed)
+					*item.hash = '\0';
+				worker->hashCount += item.hashed;
+			}
+
+			if (worker->resultCount == worker->resultCap)
+			{
+				uint newCap = worker->resultCap ? worker->resultCap * 2 : 256;
+				ScanEntry *results = realloc(worker->results, newCap * sizeof(ScanEntry));
+				if (!results)
+				{
+					free(item.path);
+					worker->failed = true;
+					continue;
+				}
+				worker->results = results;
+				worker->resultCap = newCap;
+			}
+			worker->results[worker->resultCount++] = item;
+		}
+	}
+}
+
+// Worker of a scan: scan directories of its own deque, or steal them from the others, until no directory is pending
+static void *__scan_worker(void *arg)
+{
+	ScanWorker *worker = arg;
+	ScanState *state = worker->state;
+	while (true)
+	{
+		String dirPath = __scan_take(worker, false);
+		for (uint i = 1; !dirPath && i < state->workerCount; i++)
+			dirPath = __scan_take(&state->workers[(worker->index + i) % state->workerCount], true);
+		if (!dirPath)
+		{
+			if (!__atomic_load_n(&state->pending, __ATOMIC_ACQUIRE))
+				break;
+			sched_yield(); // Other workers are scanning; they may queue more directories
+			continue;
+		}
+		__scan_directory(worker, dirPath);
+		free(dirPath);
+		__atomic_sub_fetch(&state->pending, 1, __ATOMIC_ACQ_REL);
+	}
+	return NULL;
+}
+
+// Order of a depth first walk: a directory is before its entries, and the entries of a directory are in the order
+// of ls (Directory first, Name Ascending)
+static int __scan_entry_comparator(const void *a, const void *b)
+{
+	const ScanEntry *e1 = a, *e2 = b;
+	constString name1 = e1->path, name2 = e2->path;
+	while (true)
+	{
+		// Compare the first different names of their paths
+		constString end1 = name1 + strcspn(name1, "/"), end2 = name2 + strcspn(name2, "/");
+		if (end1 - name1 == end2 - name2 && !strncmp(name1, name2, end1 - name1))
+		{
+			if (!*end1 || !*end2) // The same entry, or a directory and its entry
+				return (*end1 != '\0') - (*end2 != '\0');
+			name1 = end1 + 1;
+			name2 = end2 + 1;
+			continue;
+		}
+		bool isDir1 = *end1 || e1->isDir, isDir2 = *end2 || e2->isDir;
+		if (isDir1 != isDir2)
+			return isDir1 ? -1 : 1;
+		size_t len1 = end1 - name1, len2 = end2 - name2, len = len1 < len2 ? len1 : len2;
+		int result = strncasecmp(name1, name2, len);
+		if (!result)
+			result = len1 != len2 ? (len1 < len2 ? -1 : 1) : strncmp(name1, name2, len);
+		return result;
+	}
+}
+
+int scanWorkingTree(constString dirPath, ScanEntry **dest, uint *countDest)
+{
+	*dest = NULL;
+	*countDest = 0;
+
+	// Shared caches are loaded before the workers start (they only read them)
+	loadStatCache();
+	isTrackedFile(".");
+
+	uint threadCount = getScanThreadCount();
+	ScanWorker workers[SCAN_MAX_THREADS];
+	ScanState state = {.workers = workers, .workerCount = threadCount, .pending = 0};
+	memset(workers, 0, threadCount * sizeof(ScanWorker));
+	for (uint i = 0; i < threadCount; i++)
+	{
+		workers[i].state = &state;
+		workers[i].index = i;
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+
+	// The calling thread is the first worker
+	double startTime = 0;
+	struct timespec ts;
+	if (getenv(TRACE_ENV) && clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		startTime = ts.tv_sec + ts.tv_nsec / 1e9;
+	__scan_push(&workers[0], strDup(dirPath));
+	pthread_t threads[SCAN_MAX_THREADS];
+	uint started = 1;
+	for (; started < threadCount; started++)
+		if (pthread_create(&threads[started], NULL, __scan_worker, &workers[started]) != 0)
+			break;
+	__scan_worker(&workers[0]);
+	for (uint i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	// Merge the results of the workers
+	uint count = 0;
+	uint64_t dirCount = 0, hashCount = 0;
+	bool failed = false;
+	for (uint i = 0; i < threadCount; i++)
+	{
+		count += workers[i].resultCount;
+		dirCount += workers[i].dirCount;
+		hashCount += workers[i].hashCount;
+		failed |= workers[i].failed;
+	}
+	ScanEntry *entries = failed ? NULL : malloc((count + 1) * sizeof(ScanEntry));
+	uint merged = 0;
+	for (uint i = 0; i < threadCount; i++)
+	{
+		if (entries)
+		{
+			memcpy(entries + merged, workers[i].results, workers[i].resultCount * sizeof(ScanEntry));
+			merged += workers[i].resultCount;
+		}
+		else
+			freeScanEntries(workers[i].results, workers[i].resultCount);
+		free(workers[i].dirs);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+	if (!entries)
+		return ERR_MALLOC;
+	qsort(entries, count, sizeof(ScanEntry), __scan_entry_comparator);
+
+	// The following comparisons of the hashed files with staged or committed objects do not read them again
+	for (uint i = 0; i < count; i++)
+		if (entries[i].hashed)
+			recordStatCache(entries[i].path, &entries[i].st, entries[i].hash);
+
+	if (startTime && clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		fprintf(stderr, "[trace] worktree scan : %lu dir(s), %u entries, %lu file(s) hashed with %u thread(s) in %.1f ms\n",
+				dirCount, count, hashCount, started, (ts.tv_sec + ts.tv_nsec / 1e9 - startTime) * 1000);
+	*dest = entries;
+	*countDest = count;
+	return ERR_NOERR;
+}
+
+void freeScanEntries(ScanEntry *entries, uint count)
+{
+	for (uint i = 0; entries && i < count; i++)
+		free(entries[i].path);
+	free(entries);
+}
+
+static const void *__scan_entry_key(const void *ctx, uint index)
+{
+	return ((const ScanEntry *)ctx)[index].path;
+}
+
+int scanChangeCandidates(String **dest)
+{
+	*dest = NULL;
+	ScanEntry *entries = NULL;
+	uint count = 0;
+	if (scanWorkingTree(".", &entries, &count) != ERR_NOERR)
+		return -1;
+
+	GitObjectArray *head = &curRepository->head.headFiles;
+	IndexMap scanned;
+	indexMapInit(&scanned, __scan_entry_key, entries, 0);
+	String *files = indexMapReserve(&scanned, count) ? malloc((count + head->len + 1) * sizeof(String)) : NULL;
+	int fileCount = files ? 0 : -1;
+	for (uint i = 0; files && i < count; i++)
+		indexMapAdd(&scanned, i);
+
+	// The deleted files of HEAD (unless a file of the working tree is in the place of one of their directories)
+	for (uint i = 0; files && i < head->len; i++)
+	{
+		constString path = head->arr[i].file.path;
+		if (indexMapFind(&scanned, path) >= 0)
+			continue;
+		bool hidden = false;
+		char dirPath[PATH_MAX];
+		strcpy(dirPath, path);
+		for (String slash = strchr(dirPath, '/'); !hidden && slash; slash = strchr(slash + 1, '/'))
+		{
+			*slash = '\0';
+			long index = indexMapFind(&scanned, dirPath);
+			hidden = index >= 0 && !entries[index].isDir;
+			*slash = '/';
+		}
+		if (!hidden)
+			files[fileCount++] = strDup(path);
+	}
+	indexMapFree(&scanned);
+
+	// The files of the working tree (Their paths are moved)
+	for (uint i = 0; files && i < count; i++)
+		if (!entries[i].isDir)
+		{
+			files[fileCount++] = entries[i].path;
+			entries[i].path = NULL;
+		}
+	freeScanEntries(entries, count);
+	*dest = files;
+	return fileCount;
+}